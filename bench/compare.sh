@@ -0,0 +1,54 @@
+#!/bin/sh
+#
+# Compare two sets of results from bench/run.sh, showing the change in
+# throughput, latency and memory of each scenario.
+#
+# Usage: bench/compare.sh before.json after.json
+#
+
+if [ $# -ne 2 ]; then
+	echo "usage: $0 before.json after.json" >&2
+	exit 1
+fi
+
+awk '
+	function field(line, name,    m) {
+		if (match(line, "\"" name "\": *\"?[^,\"}]*")) {
+			m = substr(line, RSTART, RLENGTH);
+			sub(/^[^:]*: *"?/, "", m);
+			return m;
+		}
+		return "";
+	}
+	function change(a, b) {
+		if (a == "" || b == "" || a == "null" || b == "null" || a + 0 == 0)
+			return "-";
+		return sprintf("%+.1f%%", 100 * (b - a) / a);
+	}
+	FNR == 1 { file++ }
+	/"scenario"/ {
+		s = field($0, "scenario");
+		if (file == 1) {
+			order[++n] = s;
+			rps[s] = field($0, "rows_per_sec");
+			lat[s] = field($0, "latency_ms");
+			rss[s] = field($0, "peak_rss_kb");
+		} else {
+			rps2[s] = field($0, "rows_per_sec");
+			lat2[s] = field($0, "latency_ms");
+			rss2[s] = field($0, "peak_rss_kb");
+		}
+	}
+	END {
+		printf "%-16s %14s %14s %9s %14s %9s %9s\n", "scenario",
+			"rows/s before", "rows/s after", "change", "latency after",
+			"change", "memory";
+		for (i = 1; i <= n; i++) {
+			s = order[i];
+			if (!(s in rps2))
+				continue;
+			printf "%-16s %14s %14s %9s %14s %9s %9s\n", s, rps[s], rps2[s],
+				change(rps[s], rps2[s]), lat2[s] " ms",
+				change(lat[s], lat2[s]), change(rss[s], rss2[s]);
+		}
+	}' "$1" "$2"
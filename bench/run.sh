@@ -0,0 +1,306 @@
+#!/bin/sh
+#
+# Benchmark mysql_fdw scans against a throwaway local mysqld and
+# PostgreSQL, printing one line of JSON per scenario.
+#
+# Needs mysqld, mysql, mysqladmin, initdb, pg_ctl, psql and pgbench on the
+# PATH, with mysql_fdw installed into that PostgreSQL. psql must be 9.3 or
+# later, and backend memory is only measured on Linux.
+#
+# Usage: bench/run.sh [scenario ...] > results.json
+#
+# The scenarios are those in bench/scenarios; by default, all of them. The
+# data and run are set by these environment variables:
+#
+#	BENCH_ROWS			rows in the narrow table (100000)
+#	BENCH_COLUMNS		its columns besides the key (8)
+#	BENCH_TYPES			MySQL types its columns cycle through
+#						(int,bigint,double,varchar,datetime)
+#	BENCH_WIDE_ROWS		rows in the wide text table (BENCH_ROWS / 10)
+#	BENCH_WIDE_COLUMNS	its text columns (4)
+#	BENCH_TEXT_LENGTH	characters in each of its values (1000)
+#	BENCH_PROBE_ROWS	keys looked up by the nested loop scenario (100)
+#	BENCH_DURATION		seconds to run each scenario for (10)
+#	BENCH_CLIENTS		concurrent pgbench clients (1)
+#	BENCH_SERVER_OPTIONS	extra options for the foreign server, such as
+#						"streaming 'true', prefetch_buffers '4'"
+#	BENCH_MYSQL_PORT	(33061) and BENCH_PG_PORT (54321) to listen on
+#	BENCH_KEEP			if set, the data directories aren't removed
+#
+
+set -e
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+
+ROWS=${BENCH_ROWS:-100000}
+COLUMNS=${BENCH_COLUMNS:-8}
+TYPES=${BENCH_TYPES:-int,bigint,double,varchar,datetime}
+WIDE_ROWS=${BENCH_WIDE_ROWS:-$((ROWS / 10))}
+WIDE_COLUMNS=${BENCH_WIDE_COLUMNS:-4}
+TEXT_LENGTH=${BENCH_TEXT_LENGTH:-1000}
+PROBE_ROWS=${BENCH_PROBE_ROWS:-100}
+DURATION=${BENCH_DURATION:-10}
+CLIENTS=${BENCH_CLIENTS:-1}
+MYSQL_PORT=${BENCH_MYSQL_PORT:-33061}
+PG_PORT=${BENCH_PG_PORT:-54321}
+
+if [ $# -gt 0 ]; then
+	SCENARIOS="$*"
+else
+	SCENARIOS=$(cd "$BENCH_DIR/scenarios" && ls *.sql | sed 's/\.sql$//')
+fi
+
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/mysql_fdw_bench.XXXXXX")
+USER_NAME=$(id -un)
+
+log()
+{
+	echo "$@" >&2
+}
+
+cleanup()
+{
+	if [ -f "$WORK/pg/postmaster.pid" ]; then
+		pg_ctl -D "$WORK/pg" -m immediate stop >/dev/null 2>&1 || true
+	fi
+	if [ -f "$WORK/mysqld.pid" ]; then
+		kill "$(cat "$WORK/mysqld.pid")" 2>/dev/null || true
+		sleep 1
+	fi
+	if [ -z "$BENCH_KEEP" ]; then
+		rm -rf "$WORK"
+	else
+		log "data left in $WORK"
+	fi
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+my()
+{
+	mysql --no-defaults --user=root --socket="$WORK/mysql.sock" \
+		--local-infile=1 "$@"
+}
+
+pg()
+{
+	psql -X -q -v ON_ERROR_STOP=1 -h "$WORK" -p "$PG_PORT" -d bench "$@"
+}
+
+#
+# Start the servers
+#
+log "starting mysqld in $WORK"
+if ! mysqld --no-defaults --initialize-insecure --user="$USER_NAME" \
+		--datadir="$WORK/mysql" >"$WORK/mysql_init.log" 2>&1; then
+	# MariaDB has no --initialize
+	mysql_install_db --no-defaults --user="$USER_NAME" \
+		--datadir="$WORK/mysql" >"$WORK/mysql_init.log" 2>&1
+fi
+
+mysqld --no-defaults --user="$USER_NAME" --datadir="$WORK/mysql" \
+	--socket="$WORK/mysql.sock" --pid-file="$WORK/mysqld.pid" \
+	--port="$MYSQL_PORT" --bind-address=127.0.0.1 --local-infile=1 \
+	--log-error="$WORK/mysqld.log" &
+
+i=0
+until mysqladmin --no-defaults --user=root --socket="$WORK/mysql.sock" \
+		ping >/dev/null 2>&1; do
+	i=$((i + 1))
+	if [ $i -gt 60 ]; then
+		log "mysqld didn't start, see $WORK/mysqld.log"
+		BENCH_KEEP=1
+		exit 1
+	fi
+	sleep 1
+done
+
+log "starting PostgreSQL"
+initdb -D "$WORK/pg" -E UTF8 --no-locale -A trust >"$WORK/initdb.log" 2>&1
+pg_ctl -D "$WORK/pg" -w -l "$WORK/postgres.log" \
+	-o "-p $PG_PORT -k $WORK -c listen_addresses='' -c shared_preload_libraries=mysql_fdw" \
+	start >/dev/null
+createdb -h "$WORK" -p "$PG_PORT" bench
+
+#
+# Generate and load the tables
+#
+log "loading $ROWS rows"
+
+# Create a user that any client library can log in as over TCP
+my -e "CREATE DATABASE bench"
+my -e "CREATE USER 'bench'@'127.0.0.1' IDENTIFIED WITH mysql_native_password BY 'bench'" 2>/dev/null ||
+	my -e "CREATE USER 'bench'@'127.0.0.1' IDENTIFIED BY 'bench'"
+my -e "GRANT ALL ON bench.* TO 'bench'@'127.0.0.1'"
+
+# The narrow table's columns, as MySQL and PostgreSQL types
+MY_COLUMNS=""
+PG_COLUMNS=""
+COLUMN_TYPES=""
+i=1
+while [ $i -le "$COLUMNS" ]; do
+	t=$(echo "$TYPES" | awk -F, -v i=$i '{ print $(1 + (i - 1) % NF) }')
+	case $t in
+		int)		pgt=integer ;;
+		bigint)		pgt=bigint ;;
+		double)		pgt="double precision" ;;
+		varchar)	t="varchar(32)"; pgt=text ;;
+		datetime)	pgt=timestamp ;;
+		date)		pgt=date ;;
+		*)			log "unknown type $t"; exit 1 ;;
+	esac
+	MY_COLUMNS="$MY_COLUMNS, c$i $t"
+	PG_COLUMNS="$PG_COLUMNS, c$i $pgt"
+	COLUMN_TYPES="$COLUMN_TYPES ${t%%(*}"
+	i=$((i + 1))
+done
+
+awk -v rows="$ROWS" -v types="$COLUMN_TYPES" 'BEGIN {
+	n = split(types, type, " ");
+	for (r = 1; r <= rows; r++) {
+		line = r;
+		for (c = 1; c <= n; c++) {
+			if (type[c] == "int")
+				v = (r * 7919 + c) % 1000003;
+			else if (type[c] == "bigint")
+				v = r * 1000003 + c;
+			else if (type[c] == "double")
+				v = sprintf("%.6f", r / 7 + c);
+			else if (type[c] == "varchar")
+				v = "value " r " of " c;
+			else if (type[c] == "datetime")
+				v = sprintf("20%02d-%02d-%02d %02d:%02d:%02d", 10 + r % 10,
+							1 + r % 12, 1 + r % 28, r % 24, r % 60, (r * 7) % 60);
+			else
+				v = sprintf("20%02d-%02d-%02d", 10 + r % 10, 1 + r % 12,
+							1 + r % 28);
+			line = line "\t" v;
+		}
+		print line;
+	}
+}' >"$WORK/scan.tsv"
+
+awk -v rows="$WIDE_ROWS" -v cols="$WIDE_COLUMNS" -v len="$TEXT_LENGTH" 'BEGIN {
+	base = "";
+	while (length(base) < len + 26)
+		base = base "abcdefghijklmnopqrstuvwxyz";
+	for (r = 1; r <= rows; r++) {
+		line = r;
+		for (c = 1; c <= cols; c++)
+			line = line "\t" substr(base, 1 + (r + c) % 26, len);
+		print line;
+	}
+}' >"$WORK/wide.tsv"
+
+# Every tenth value has bytes that aren't valid UTF-8
+awk -v rows="$ROWS" 'BEGIN {
+	for (r = 1; r <= rows; r++)
+		printf "%d\tvalue %d%s\n", r, r, (r % 10 == 0) ? "\377\376" : "";
+}' >"$WORK/badenc.tsv"
+
+WIDE_MY=""
+WIDE_PG=""
+i=1
+while [ $i -le "$WIDE_COLUMNS" ]; do
+	WIDE_MY="$WIDE_MY, t$i text"
+	WIDE_PG="$WIDE_PG, t$i text"
+	i=$((i + 1))
+done
+
+my bench <<EOF
+CREATE TABLE bench_scan (id bigint PRIMARY KEY$MY_COLUMNS);
+CREATE TABLE bench_wide (id bigint PRIMARY KEY$WIDE_MY);
+CREATE TABLE bench_badenc (id bigint PRIMARY KEY, v varbinary(64));
+LOAD DATA LOCAL INFILE '$WORK/scan.tsv' INTO TABLE bench_scan;
+LOAD DATA LOCAL INFILE '$WORK/wide.tsv' INTO TABLE bench_wide;
+LOAD DATA LOCAL INFILE '$WORK/badenc.tsv' INTO TABLE bench_badenc
+	CHARACTER SET binary;
+ANALYZE TABLE bench_scan, bench_wide, bench_badenc;
+EOF
+
+SERVER_OPTIONS="address '127.0.0.1', port '$MYSQL_PORT'"
+if [ -n "$BENCH_SERVER_OPTIONS" ]; then
+	SERVER_OPTIONS="$SERVER_OPTIONS, $BENCH_SERVER_OPTIONS"
+fi
+
+pg <<EOF
+CREATE EXTENSION mysql_fdw;
+CREATE SERVER bench_svr FOREIGN DATA WRAPPER mysql_fdw
+	OPTIONS ($SERVER_OPTIONS);
+CREATE USER MAPPING FOR PUBLIC SERVER bench_svr
+	OPTIONS (username 'bench', password 'bench');
+CREATE FOREIGN TABLE bench_scan (id bigint$PG_COLUMNS)
+	SERVER bench_svr OPTIONS (database 'bench', table 'bench_scan');
+CREATE FOREIGN TABLE bench_wide (id bigint$WIDE_PG)
+	SERVER bench_svr OPTIONS (database 'bench', table 'bench_wide');
+CREATE FOREIGN TABLE bench_badenc (id bigint, v text)
+	SERVER bench_svr OPTIONS (database 'bench', table 'bench_badenc');
+CREATE TABLE bench_probe AS
+	SELECT id FROM generate_series(1, $ROWS,
+		greatest($ROWS / $PROBE_ROWS, 1)) AS id LIMIT $PROBE_ROWS;
+ANALYZE bench_probe;
+EOF
+
+#
+# Run the scenarios
+#
+GIT=$(git -C "$BENCH_DIR" rev-parse --short HEAD 2>/dev/null || echo unknown)
+
+# Invalid text is reported by a WARNING per value
+PGOPTIONS="-c client_min_messages=error"
+export PGOPTIONS
+
+for s in $SCENARIOS; do
+	script="$BENCH_DIR/scenarios/$s.sql"
+	if [ ! -f "$script" ]; then
+		log "no scenario $s"
+		exit 1
+	fi
+
+	case $s in
+		full_scan|bad_encoding)	per_txn=$ROWS ;;
+		first_row)		per_txn=1 ;;
+		limit)			per_txn=10 ;;
+		point_lookup)	per_txn=$PROBE_ROWS ;;
+		wide_text)		per_txn=$WIDE_ROWS ;;
+		*)				per_txn=0 ;;
+	esac
+
+	# One run in a backend of its own, to warm up and take its peak memory
+	log "running $s"
+	rm -f "$WORK/rss"
+	pg <<EOF
+SELECT pg_backend_pid() AS pid \gset
+\setenv BENCH_PID :pid
+\o /dev/null
+\i $script
+\o
+\! [ -r /proc/\$BENCH_PID/status ] && awk '/^VmHWM/ { print \$2 }' /proc/\$BENCH_PID/status > "$WORK/rss"
+EOF
+	rss=$(cat "$WORK/rss" 2>/dev/null || true)
+
+	pgbench -n -h "$WORK" -p "$PG_PORT" -c "$CLIENTS" -T "$DURATION" \
+		-f "$script" bench >"$WORK/pgbench.out" 2>"$WORK/pgbench.err" || {
+		log "pgbench failed:"
+		cat "$WORK/pgbench.err" >&2
+		exit 1
+	}
+
+	awk -v scenario="$s" -v per_txn="$per_txn" -v clients="$CLIENTS" \
+		-v duration="$DURATION" -v rss="${rss:-null}" -v git="$GIT" \
+		-v rows="$ROWS" -v columns="$COLUMNS" -v types="$TYPES" '
+		/^number of transactions actually processed/ { txns = $NF }
+		/^latency average/ { latency = $4 }
+		/^tps/ && tps == "" { tps = $3 }
+		END {
+			if (latency == "")
+				latency = tps > 0 ? 1000 * clients / tps : 0;
+			printf "{\"scenario\": \"%s\", \"git\": \"%s\", \"rows\": %d, " \
+				"\"columns\": %d, \"types\": \"%s\", \"clients\": %d, " \
+				"\"duration_s\": %d, \"transactions\": %d, \"tps\": %.3f, " \
+				"\"latency_ms\": %.3f, \"rows_per_txn\": %d, " \
+				"\"rows_per_sec\": %.0f, \"peak_rss_kb\": %s}\n",
+				scenario, git, rows, columns, types, clients, duration,
+				txns, tps, latency, per_txn, tps * per_txn, rss;
+		}' "$WORK/pgbench.out"
+done
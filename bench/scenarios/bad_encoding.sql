@@ -0,0 +1,2 @@
+-- Text that is invalid in the database encoding, one value in ten
+SELECT count(t.*) FROM bench_badenc t;
@@ -0,0 +1,2 @@
+-- Latency to the first row of a scan
+SELECT * FROM bench_scan LIMIT 1;
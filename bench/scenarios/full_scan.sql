@@ -0,0 +1,2 @@
+-- Every column of every row of the narrow table
+SELECT count(t.*) FROM bench_scan t;
@@ -0,0 +1,2 @@
+-- Top-N, with ORDER BY and LIMIT sent to MySQL
+SELECT * FROM bench_scan ORDER BY id LIMIT 10;
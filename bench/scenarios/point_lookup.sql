@@ -0,0 +1,5 @@
+-- A lookup by key for each row of a local table, by nested loop
+SET enable_hashjoin = off;
+SET enable_mergejoin = off;
+SET enable_material = off;
+SELECT count(t.*) FROM bench_probe p JOIN bench_scan t ON t.id = p.id;
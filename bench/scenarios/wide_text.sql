@@ -0,0 +1,2 @@
+-- Every column of the table of long text values
+SELECT count(t.*) FROM bench_wide t;
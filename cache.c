@@ -0,0 +1,647 @@
+/*-------------------------------------------------------------------------
+ *
+ *		  foreign-data wrapper for MySQL
+ *
+ * Copyright (c) 2011, PostgreSQL Global Development Group
+ *
+ * This software is released under the PostgreSQL Licence
+ *
+ * Author: Dave Page <dpage@pgadmin.org>
+ *
+ * IDENTIFICATION
+ *		  mysql_fdw/cache.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <limits.h>
+
+#include "mysql_fdw.h"
+
+#include "access/hash.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/timestamp.h"
+
+/*
+ * Shared result cache.
+ *
+ * The rows fetched by scans of foreign tables with the cache_ttl option are
+ * kept in shared memory, keyed by server, user mapping, database and
+ * query, so that scans in any backend can be answered without asking MySQL
+ * again until the entry expires. This needs mysql_fdw to be in
+ * shared_preload_libraries; otherwise nothing is cached.
+ *
+ * The cache is mysql_fdw.result_cache_size of memory, divided into blocks.
+ * An entry is a chain of blocks holding the database and query, followed
+ * by the result: the number of fields, then each value as its length and
+ * bytes, with a terminating NUL so that it can be used as libmysqlclient
+ * would return it. When there isn't room for a new entry, the least
+ * recently used ones are evicted. An entry is copied out of shared memory
+ * before its rows are used, so it may be evicted while a scan is reading
+ * it.
+ */
+
+#define CACHE_BLOCK_SIZE	8192
+
+/* Length recorded for a NULL value */
+#define CACHE_NULL			((uint32) -1)
+
+typedef struct MySQLFdwCacheKey
+{
+	Oid			serverid;
+	Oid			userid;			/* of the user mapping */
+	uint32		hash;			/* of the database and query */
+} MySQLFdwCacheKey;
+
+typedef struct MySQLFdwCacheEntry
+{
+	MySQLFdwCacheKey key;		/* hash key, must be first */
+	SHM_QUEUE	lru;			/* position in the LRU list */
+	Oid			relid;			/* foreign table it was fetched for */
+	TimestampTz expires;
+	Size		len;			/* bytes of data */
+	int			first_block;
+	int			nblocks;
+} MySQLFdwCacheEntry;
+
+typedef struct MySQLFdwCacheShared
+{
+	LWLockId	lock;
+	SHM_QUEUE	lru;			/* least recently used entry first */
+	int			free_block;		/* first free block, or -1 */
+	int			nfree;
+	int64		bytes;			/* data held by all entries */
+	int64		hits;
+	int64		misses;
+	int64		evictions;
+	int			next_block[1];	/* VARIABLE LENGTH ARRAY */
+} MySQLFdwCacheShared;
+
+/*
+ * A cached result copied into backend memory, for a scan to read.
+ */
+struct MySQLFdwCachedResult
+{
+	char	   *data;
+	Size		len;
+	Size		start;			/* offset of the first row */
+	Size		pos;			/* offset of the next row */
+	unsigned int nfields;
+	char	  **row;			/* the current row */
+	unsigned long *lengths;
+};
+
+/* GUC variables */
+static int	result_cache_size = 8192;	/* kB */
+
+static MySQLFdwCacheShared *CacheShared = NULL;
+static HTAB *CacheHash = NULL;
+static char *CacheBlocks = NULL;
+static int	cache_nblocks = 0;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+PG_FUNCTION_INFO_V1(mysql_fdw_result_cache_reset);
+PG_FUNCTION_INFO_V1(mysql_fdw_result_cache_invalidate);
+PG_FUNCTION_INFO_V1(mysql_fdw_result_cache_stats);
+
+static void mysqlCacheShmemStartup(void);
+static Size mysqlCacheShmemSize(void);
+static void mysqlCacheSetKey(MySQLFdwCacheKey *key, StringInfo text,
+							 MySQLFdwOptions *opts,
+							 const char *query);
+static char *mysqlCacheCopyOut(MySQLFdwCacheEntry *entry);
+static void mysqlCacheRemove(MySQLFdwCacheEntry *entry);
+static void mysqlCacheEvictOne(void);
+
+/*
+ * mysqlInitResultCache
+ *		Define the result cache GUC, and reserve shared memory for it if
+ *		we're being preloaded. Called from _PG_init().
+ */
+void
+mysqlInitResultCache(void)
+{
+	DefineCustomIntVariable("mysql_fdw.result_cache_size",
+							"Sets the amount of shared memory used to cache the results of foreign scans.",
+							"Only foreign tables with the cache_ttl option are cached.",
+							&result_cache_size,
+							8192,
+							0,
+							INT_MAX / (CACHE_BLOCK_SIZE / 1024),
+							PGC_POSTMASTER,
+							GUC_UNIT_KB,
+							NULL,
+							NULL,
+							NULL);
+
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+	cache_nblocks = result_cache_size / (CACHE_BLOCK_SIZE / 1024);
+	if (cache_nblocks == 0)
+		return;
+
+	RequestAddinShmemSpace(mysqlCacheShmemSize());
+	RequestAddinLWLocks(1);
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = mysqlCacheShmemStartup;
+}
+
+static Size
+mysqlCacheShmemSize(void)
+{
+	Size		size;
+
+	size = add_size(offsetof(MySQLFdwCacheShared, next_block),
+					mul_size(cache_nblocks, sizeof(int)));
+	size = add_size(MAXALIGN(size), mul_size(cache_nblocks, CACHE_BLOCK_SIZE));
+	size = add_size(size, hash_estimate_size(cache_nblocks,
+											 sizeof(MySQLFdwCacheEntry)));
+	return size;
+}
+
+/*
+ * Attach to, or create, the shared cache. Every entry has at least one
+ * block, so there can't be more entries than blocks.
+ */
+static void
+mysqlCacheShmemStartup(void)
+{
+	HASHCTL		info;
+	bool		found;
+	Size		size;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	size = MAXALIGN(offsetof(MySQLFdwCacheShared, next_block) +
+					cache_nblocks * sizeof(int));
+	CacheShared = ShmemInitStruct("mysql_fdw result cache",
+								  size + (Size) cache_nblocks * CACHE_BLOCK_SIZE,
+								  &found);
+	CacheBlocks = (char *) CacheShared + size;
+
+	if (!found)
+	{
+		int			i;
+
+		CacheShared->lock = LWLockAssign();
+		SHMQueueInit(&CacheShared->lru);
+		for (i = 0; i < cache_nblocks; i++)
+			CacheShared->next_block[i] = i + 1 < cache_nblocks ? i + 1 : -1;
+		CacheShared->free_block = 0;
+		CacheShared->nfree = cache_nblocks;
+		CacheShared->bytes = 0;
+		CacheShared->hits = 0;
+		CacheShared->misses = 0;
+		CacheShared->evictions = 0;
+	}
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(MySQLFdwCacheKey);
+	info.entrysize = sizeof(MySQLFdwCacheEntry);
+	info.hash = tag_hash;
+	CacheHash = ShmemInitHash("mysql_fdw result cache entries",
+							  cache_nblocks, cache_nblocks,
+							  &info, HASH_ELEM | HASH_FUNCTION);
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * mysqlCacheLookup
+ *		Return a copy of the cached result of a query, or NULL if it isn't
+ *		cached or has expired.
+ */
+MySQLFdwCachedResult *
+mysqlCacheLookup(MySQLFdwOptions *opts, const char *query)
+{
+	MySQLFdwCacheKey key;
+	MySQLFdwCacheEntry *entry;
+	MySQLFdwCachedResult *cr;
+	StringInfoData text;
+	char	   *data = NULL;
+	Size		len = 0;
+	Size		textlen;
+	uint32		nfields;
+
+	if (CacheShared == NULL)
+		return NULL;
+
+	mysqlCacheSetKey(&key, &text, opts, query);
+	textlen = text.len;
+
+	/* Moving the entry in the LRU list needs an exclusive lock */
+	LWLockAcquire(CacheShared->lock, LW_EXCLUSIVE);
+
+	entry = (MySQLFdwCacheEntry *) hash_search(CacheHash, &key, HASH_FIND, NULL);
+	if (entry && entry->expires <= GetCurrentTimestamp())
+	{
+		mysqlCacheRemove(entry);
+		entry = NULL;
+	}
+
+	if (entry)
+	{
+		data = mysqlCacheCopyOut(entry);
+		len = entry->len;
+		SHMQueueDelete(&entry->lru);
+		SHMQueueInsertBefore(&CacheShared->lru, &entry->lru);
+	}
+
+	/* A different query with the same hash is a miss */
+	if (data && (len < textlen || memcmp(data, text.data, textlen) != 0))
+	{
+		pfree(data);
+		data = NULL;
+	}
+
+	if (data)
+		CacheShared->hits++;
+	else
+		CacheShared->misses++;
+
+	LWLockRelease(CacheShared->lock);
+
+	pfree(text.data);
+	if (data == NULL)
+		return NULL;
+
+	cr = (MySQLFdwCachedResult *) palloc0(sizeof(MySQLFdwCachedResult));
+	cr->data = data;
+	cr->len = len;
+	memcpy(&nfields, data + textlen, sizeof(uint32));
+	cr->nfields = nfields;
+	cr->start = textlen + sizeof(uint32);
+	cr->pos = cr->start;
+	cr->row = (char **) palloc(Max(nfields, 1) * sizeof(char *));
+	cr->lengths = (unsigned long *) palloc(Max(nfields, 1) * sizeof(unsigned long));
+
+	return cr;
+}
+
+/*
+ * mysqlCacheStore
+ *		Cache a buffered result of a query run for a foreign table, for
+ *		ttl seconds. The result is left positioned at its first row.
+ *
+ * Results bigger than a quarter of the cache aren't stored, so that one
+ * big result can't flush out all the others.
+ */
+void
+mysqlCacheStore(MySQLFdwOptions *opts, Oid relid, const char *query,
+				MYSQL_RES *result)
+{
+	MySQLFdwCacheKey key;
+	MySQLFdwCacheEntry *entry;
+	unsigned int nfields = mysql_num_fields(result);
+	StringInfoData text;
+	Size		len;
+	Size		maxlen = (Size) cache_nblocks * CACHE_BLOCK_SIZE / 4;
+	StringInfoData buf;
+	MYSQL_ROW	row;
+	uint32		n;
+	int			nblocks;
+	int			block;
+	int			prev = -1;
+	int			i;
+
+	if (CacheShared == NULL || opts->cache_ttl <= 0)
+		return;
+
+	mysqlCacheSetKey(&key, &text, opts, query);
+
+	/* Serialize the query and result, giving up if it gets too big */
+	initStringInfo(&buf);
+	appendBinaryStringInfo(&buf, text.data, text.len);
+	pfree(text.data);
+	n = nfields;
+	appendBinaryStringInfo(&buf, (char *) &n, sizeof(uint32));
+
+	while ((row = mysql_fetch_row(result)) && (Size) buf.len <= maxlen)
+	{
+		unsigned long *lengths = mysql_fetch_lengths(result);
+		unsigned int f;
+
+		for (f = 0; f < nfields; f++)
+		{
+			n = row[f] ? (uint32) lengths[f] : CACHE_NULL;
+			appendBinaryStringInfo(&buf, (char *) &n, sizeof(uint32));
+			if (row[f])
+				appendBinaryStringInfo(&buf, row[f], lengths[f] + 1);
+		}
+	}
+	mysql_data_seek(result, 0);
+
+	len = buf.len;
+	if (len > maxlen)
+	{
+		pfree(buf.data);
+		return;
+	}
+
+	nblocks = Max((len + CACHE_BLOCK_SIZE - 1) / CACHE_BLOCK_SIZE, 1);
+
+	LWLockAcquire(CacheShared->lock, LW_EXCLUSIVE);
+
+	/* Replace any entry for the same key */
+	entry = (MySQLFdwCacheEntry *) hash_search(CacheHash, &key, HASH_FIND, NULL);
+	if (entry)
+		mysqlCacheRemove(entry);
+
+	while (CacheShared->nfree < nblocks && !SHMQueueEmpty(&CacheShared->lru))
+		mysqlCacheEvictOne();
+
+	entry = (MySQLFdwCacheEntry *) hash_search(CacheHash, &key, HASH_ENTER_NULL,
+											   NULL);
+	if (entry == NULL || CacheShared->nfree < nblocks)
+	{
+		if (entry)
+			hash_search(CacheHash, &key, HASH_REMOVE, NULL);
+		LWLockRelease(CacheShared->lock);
+		pfree(buf.data);
+		return;
+	}
+
+	/* Take blocks off the free list, and copy the data into them */
+	entry->relid = relid;
+	entry->expires = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+												 (int64) opts->cache_ttl * 1000);
+	entry->len = len;
+	entry->nblocks = nblocks;
+	entry->first_block = CacheShared->free_block;
+
+	for (i = 0; i < nblocks; i++)
+	{
+		Size		off = (Size) i * CACHE_BLOCK_SIZE;
+
+		block = CacheShared->free_block;
+		CacheShared->free_block = CacheShared->next_block[block];
+		if (prev >= 0)
+			CacheShared->next_block[prev] = block;
+		memcpy(CacheBlocks + (Size) block * CACHE_BLOCK_SIZE, buf.data + off,
+			   Min(len - off, CACHE_BLOCK_SIZE));
+		prev = block;
+	}
+	CacheShared->next_block[prev] = -1;
+	CacheShared->nfree -= nblocks;
+	CacheShared->bytes += len;
+
+	SHMQueueInsertBefore(&CacheShared->lru, &entry->lru);
+
+	LWLockRelease(CacheShared->lock);
+
+	pfree(buf.data);
+}
+
+/*
+ * mysqlCacheNext
+ *		Get the next row of a cached result, returning false at the end.
+ *		The row is valid until the result is freed.
+ */
+bool
+mysqlCacheNext(MySQLFdwCachedResult *cr, char ***row, unsigned long **lengths)
+{
+	unsigned int f;
+
+	if (cr->pos >= cr->len)
+		return false;
+
+	for (f = 0; f < cr->nfields; f++)
+	{
+		uint32		n;
+
+		memcpy(&n, cr->data + cr->pos, sizeof(uint32));
+		cr->pos += sizeof(uint32);
+
+		if (n == CACHE_NULL)
+		{
+			cr->row[f] = NULL;
+			cr->lengths[f] = 0;
+		}
+		else
+		{
+			cr->row[f] = cr->data + cr->pos;
+			cr->lengths[f] = n;
+			cr->pos += n + 1;
+		}
+	}
+
+	*row = cr->row;
+	*lengths = cr->lengths;
+	return true;
+}
+
+/*
+ * mysqlCacheNumFields
+ *		Return the number of fields in the rows of a cached result.
+ */
+unsigned int
+mysqlCacheNumFields(MySQLFdwCachedResult *cr)
+{
+	return cr->nfields;
+}
+
+/*
+ * mysqlCacheRewind
+ *		Go back to the first row of a cached result.
+ */
+void
+mysqlCacheRewind(MySQLFdwCachedResult *cr)
+{
+	cr->pos = cr->start;
+}
+
+/*
+ * Entries are found by server, user mapping and a hash of the database
+ * and query, since tables on one server may name different databases.
+ * The database and query, each NUL-terminated, are returned in text,
+ * which is stored in the entry to check for collisions.
+ */
+static void
+mysqlCacheSetKey(MySQLFdwCacheKey *key, StringInfo text,
+				 MySQLFdwOptions *opts, const char *query)
+{
+	const char *database = opts->database ? opts->database : "";
+
+	initStringInfo(text);
+	appendBinaryStringInfo(text, database, strlen(database) + 1);
+	appendBinaryStringInfo(text, query, strlen(query) + 1);
+
+	memset(key, 0, sizeof(MySQLFdwCacheKey));
+	key->serverid = opts->serverid;
+	key->userid = opts->userid;
+	key->hash = DatumGetUInt32(hash_any((const unsigned char *) text->data,
+										text->len));
+}
+
+/*
+ * Copy an entry's data out of its blocks. Must hold the lock.
+ */
+static char *
+mysqlCacheCopyOut(MySQLFdwCacheEntry *entry)
+{
+	char	   *data = palloc(entry->len);
+	int			block = entry->first_block;
+	Size		off;
+
+	for (off = 0; off < entry->len; off += CACHE_BLOCK_SIZE)
+	{
+		memcpy(data + off, CacheBlocks + (Size) block * CACHE_BLOCK_SIZE,
+			   Min(entry->len - off, CACHE_BLOCK_SIZE));
+		block = CacheShared->next_block[block];
+	}
+
+	return data;
+}
+
+/*
+ * Remove an entry, returning its blocks to the free list. Must hold the
+ * lock exclusively.
+ */
+static void
+mysqlCacheRemove(MySQLFdwCacheEntry *entry)
+{
+	int			last = entry->first_block;
+
+	while (CacheShared->next_block[last] >= 0)
+		last = CacheShared->next_block[last];
+	CacheShared->next_block[last] = CacheShared->free_block;
+	CacheShared->free_block = entry->first_block;
+	CacheShared->nfree += entry->nblocks;
+	CacheShared->bytes -= entry->len;
+
+	SHMQueueDelete(&entry->lru);
+	hash_search(CacheHash, &entry->key, HASH_REMOVE, NULL);
+}
+
+/*
+ * Evict the least recently used entry. Must hold the lock exclusively.
+ */
+static void
+mysqlCacheEvictOne(void)
+{
+	MySQLFdwCacheEntry *entry;
+
+	entry = (MySQLFdwCacheEntry *) SHMQueueNext(&CacheShared->lru,
+												&CacheShared->lru,
+												offsetof(MySQLFdwCacheEntry, lru));
+	if (entry)
+	{
+		mysqlCacheRemove(entry);
+		CacheShared->evictions++;
+	}
+}
+
+/*
+ * mysql_fdw_result_cache_reset
+ *		Empty the result cache, returning the number of entries removed.
+ */
+Datum
+mysql_fdw_result_cache_reset(PG_FUNCTION_ARGS)
+{
+	int64		count = 0;
+
+	if (CacheShared == NULL)
+		PG_RETURN_INT64(0);
+
+	LWLockAcquire(CacheShared->lock, LW_EXCLUSIVE);
+	while (!SHMQueueEmpty(&CacheShared->lru))
+	{
+		MySQLFdwCacheEntry *entry;
+
+		entry = (MySQLFdwCacheEntry *) SHMQueueNext(&CacheShared->lru,
+													&CacheShared->lru,
+													offsetof(MySQLFdwCacheEntry, lru));
+		mysqlCacheRemove(entry);
+		count++;
+	}
+	LWLockRelease(CacheShared->lock);
+
+	PG_RETURN_INT64(count);
+}
+
+/*
+ * mysql_fdw_result_cache_invalidate
+ *		Remove the cached results of scans of a foreign table, returning the
+ *		number of entries removed.
+ */
+Datum
+mysql_fdw_result_cache_invalidate(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	HASH_SEQ_STATUS scan;
+	MySQLFdwCacheEntry *entry;
+	int64		count = 0;
+
+	if (CacheShared == NULL)
+		PG_RETURN_INT64(0);
+
+	/* Removing the entry just returned is allowed during a scan */
+	LWLockAcquire(CacheShared->lock, LW_EXCLUSIVE);
+	hash_seq_init(&scan, CacheHash);
+	while ((entry = (MySQLFdwCacheEntry *) hash_seq_search(&scan)))
+	{
+		if (entry->relid == relid)
+		{
+			mysqlCacheRemove(entry);
+			count++;
+		}
+	}
+	LWLockRelease(CacheShared->lock);
+
+	PG_RETURN_INT64(count);
+}
+
+/*
+ * mysql_fdw_result_cache_stats
+ *		Report how full the result cache is and how well it's working.
+ */
+Datum
+mysql_fdw_result_cache_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Datum		values[6];
+	bool		nulls[6];
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	memset(values, 0, sizeof(values));
+	memset(nulls, 0, sizeof(nulls));
+
+	if (CacheShared)
+	{
+		LWLockAcquire(CacheShared->lock, LW_SHARED);
+		values[0] = Int64GetDatum(hash_get_num_entries(CacheHash));
+		values[1] = Int64GetDatum(CacheShared->bytes);
+		values[2] = Int64GetDatum((int64) cache_nblocks * CACHE_BLOCK_SIZE);
+		values[3] = Int64GetDatum(CacheShared->hits);
+		values[4] = Int64GetDatum(CacheShared->misses);
+		values[5] = Int64GetDatum(CacheShared->evictions);
+		LWLockRelease(CacheShared->lock);
+	}
+	else
+	{
+		int			i;
+
+		for (i = 0; i < 6; i++)
+			values[i] = Int64GetDatum(0);
+	}
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(BlessTupleDesc(tupdesc),
+													  values, nulls)));
+}
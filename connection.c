@@ -0,0 +1,1499 @@
+/*-------------------------------------------------------------------------
+ *
+ *		  foreign-data wrapper for MySQL
+ *
+ * Copyright (c) 2011, PostgreSQL Global Development Group
+ *
+ * This software is released under the PostgreSQL Licence
+ *
+ * Author: Dave Page <dpage@pgadmin.org>
+ *
+ * IDENTIFICATION
+ *		  mysql_fdw/connection.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <limits.h>
+#include <poll.h>
+
+#include "mysql_fdw.h"
+
+#include <mysqld_error.h>
+
+#include "access/htup.h"
+#include "access/xact.h"
+#include "foreign/foreign.h"
+#include "funcapi.h"
+#include "mb/pg_wchar.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/memutils.h"
+#include "utils/syscache.h"
+#include "utils/tuplestore.h"
+
+/*
+ * Connections are kept open for the life of the backend, per foreign server
+ * and user mapping, so that planning and execution (and subsequent queries)
+ * don't each pay for a new TCP connection and authentication.
+ *
+ * Usually one connection per server and user suffices, but a streaming scan
+ * holds its connection until it has read the whole result, so further
+ * connections are opened in the next slot while the earlier ones are busy.
+ * A server's replicas have connections of their own.
+ */
+typedef struct ConnCacheKey
+{
+	Oid			serverid;		/* foreign server */
+	Oid			userid;			/* user of the mapping, InvalidOid for PUBLIC */
+	int			host;			/* 0 for the primary, i for the i'th replica */
+	int			slot;			/* connection number for this server/user */
+} ConnCacheKey;
+
+/*
+ * Statements prepared on a connection are kept for reuse, up to the
+ * server's statement_cache_size, so that a query run again needn't be
+ * parsed and planned by MySQL again. Table names in the SQL are resolved
+ * in the database selected when it was prepared, so that is part of the
+ * key too.
+ */
+typedef struct CachedStatement
+{
+	char	   *query;			/* SQL it was prepared from */
+	char	   *database;		/* database selected then, or NULL */
+	MYSQL_STMT *stmt;
+	bool		in_use;			/* handed out and not yet given back? */
+	uint64		last_used;		/* for evicting the least recently used */
+} CachedStatement;
+
+typedef struct ConnCacheEntry
+{
+	ConnCacheKey key;			/* hash key (must be first) */
+	MYSQL	   *conn;			/* connection, or NULL if not connected */
+	char	   *address;		/* host conn is to, if connected */
+	int			port;
+	char	   *socket;			/* Unix socket conn is to, or NULL */
+	char	   *username;		/* as connected, to kill queries with */
+	char	   *password;
+	int			fd;				/* conn's socket descriptor */
+	char	   *transport;		/* how, for EXPLAIN */
+	char	   *database;		/* database selected on conn, or NULL */
+	bool		checked;		/* known to be alive in this transaction? */
+	bool		invalidated;	/* server or mapping changed since connect? */
+	bool		busy;			/* claimed by a scan until released */
+	SubTransactionId busy_subid;	/* subtransaction owning the claim */
+	bool		counted;		/* claim counted in the host's load? */
+	MYSQL_RES  *result;			/* unbuffered result being read, if any */
+	MYSQL_STMT *stmt;			/* statement being executed, if any */
+	void		(*abort_callback) (void *arg);	/* to call before closing */
+	void	   *abort_arg;
+	CachedStatement *stmts;		/* prepared statements, if any */
+	int			nstmts;
+	int			max_stmts;		/* room in stmts, or -1 if not yet known */
+	int			cache_size;		/* statement_cache_size when connected */
+} ConnCacheEntry;
+
+static HTAB *ConnectionHash = NULL;
+
+/* Ticks each time a cached statement is used, to order them for eviction */
+static uint64 StatementClock = 0;
+
+PG_FUNCTION_INFO_V1(mysql_fdw_get_connections);
+PG_FUNCTION_INFO_V1(mysql_fdw_disconnect);
+PG_FUNCTION_INFO_V1(mysql_fdw_disconnect_all);
+
+static ConnCacheEntry *mysqlFindEntry(MYSQL *conn);
+static ConnCacheEntry *mysqlGetEntry(MySQLFdwOptions *opts, int host,
+									 const char *address, int port,
+									 bool throw_error);
+static MYSQL *mysqlGetReplicaConnection(MySQLFdwOptions *opts);
+static int	mysqlReplicaLag(ConnCacheEntry *entry, MySQLFdwOptions *opts);
+static bool mysqlConnect(ConnCacheEntry *entry, MySQLFdwOptions *opts,
+						 const char *address, int port, bool throw_error);
+static void mysqlUncount(ConnCacheEntry *entry);
+static CachedStatement *mysqlFindStatement(ConnCacheEntry *entry,
+										   MYSQL_STMT *stmt);
+static bool mysqlEvictStatement(ConnCacheEntry *entry);
+static void mysqlFreeStatement(CachedStatement *cs);
+static bool mysqlSameDatabase(const char *a, const char *b);
+static MySQLFdwCompression mysqlCompression(MySQLFdwOptions *opts,
+											const char *address,
+											const char *socket);
+static const char *mysqlCompressionName(MySQLFdwCompression compression);
+static void mysqlDisconnect(ConnCacheEntry *entry);
+static void mysqlKillQuery(ConnCacheEntry *entry);
+static SubTransactionId mysqlClaimOwner(MySQLFdwOptions *opts);
+static void mysqlAbortConnections(SubTransactionId subid);
+static void mysqlInvalCallback(Datum arg, int cacheid, ItemPointer tuplePtr);
+static void mysqlXactCallback(XactEvent event, void *arg);
+static void mysqlSubXactCallback(SubXactEvent event, SubTransactionId mySubid,
+								 SubTransactionId parentSubid, void *arg);
+static void mysqlExitCallback(int code, Datum arg);
+
+/*
+ * mysqlGetConnection
+ *		Return a connection suitable for the given options, reusing a cached
+ *		one for the server and user mapping if it is still usable.
+ *
+ * An exclusive connection is not handed out again until it is given back
+ * with mysqlReleaseConnection(); that is needed while a result is being
+ * read with mysql_use_result(). Otherwise the caller must be done with the
+ * connection before anyone else can ask for it.
+ *
+ * If the server has replicas, exclusive connections are made to one of
+ * them unless the options say the primary must be used; see
+ * mysqlGetReplicaConnection().
+ */
+MYSQL *
+mysqlGetConnection(MySQLFdwOptions *opts, bool exclusive)
+{
+	ConnCacheEntry *entry;
+
+	if (ConnectionHash == NULL)
+	{
+		HASHCTL		ctl;
+
+		MemSet(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(ConnCacheKey);
+		ctl.entrysize = sizeof(ConnCacheEntry);
+		ctl.hash = tag_hash;
+		ctl.hcxt = CacheMemoryContext;
+		ConnectionHash = hash_create("mysql_fdw connections", 8, &ctl,
+									 HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+
+		CacheRegisterSyscacheCallback(FOREIGNSERVEROID,
+									  mysqlInvalCallback, (Datum) 0);
+		CacheRegisterSyscacheCallback(USERMAPPINGOID,
+									  mysqlInvalCallback, (Datum) 0);
+		RegisterXactCallback(mysqlXactCallback, NULL);
+		RegisterSubXactCallback(mysqlSubXactCallback, NULL);
+		/* Before ProcKill, while we may still take LWLocks */
+		on_shmem_exit(mysqlExitCallback, (Datum) 0);
+	}
+
+	if (exclusive && opts->replicas && !opts->primary_only)
+	{
+		MYSQL	   *conn = mysqlGetReplicaConnection(opts);
+
+		if (conn)
+			return conn;
+	}
+
+	entry = mysqlGetEntry(opts, 0, opts->address, opts->port, true);
+
+	if (exclusive)
+	{
+		entry->busy = true;
+		entry->busy_subid = mysqlClaimOwner(opts);
+	}
+
+	return entry->conn;
+}
+
+/*
+ * mysqlGetSiblingConnection
+ *		Claim another exclusive connection to the same host, primary or
+ *		replica, as an exclusive connection from mysqlGetConnection().
+ *
+ * This is for scans whose queries must all see the same data, which
+ * different replicas, being behind by different amounts, wouldn't.
+ */
+MYSQL *
+mysqlGetSiblingConnection(MySQLFdwOptions *opts, MYSQL *conn)
+{
+	ConnCacheEntry *entry = mysqlFindEntry(conn);
+	ConnCacheEntry *sibling;
+	char	   *address;
+
+	if (entry == NULL)
+		elog(ERROR, "connection not found in the mysql_fdw cache");
+
+	/* The entry's own copy would be freed if this connection failed */
+	address = pstrdup(entry->address);
+	sibling = mysqlGetEntry(opts, entry->key.host, address, entry->port, true);
+	pfree(address);
+
+	sibling->busy = true;
+	sibling->busy_subid = mysqlClaimOwner(opts);
+	if (sibling->key.host > 0)
+	{
+		sibling->counted = true;
+		mysqlHostAddInflight(opts->serverid, sibling->address, sibling->port,
+							 1);
+	}
+
+	return sibling->conn;
+}
+
+/*
+ * Return the first unclaimed cache entry for a host of the server, with
+ * a usable connection. Host 0 is the primary, and host i the i'th replica.
+ * If connecting fails, this throws an error if asked to, or else returns
+ * NULL.
+ */
+static ConnCacheEntry *
+mysqlGetEntry(MySQLFdwOptions *opts, int host, const char *address, int port,
+			  bool throw_error)
+{
+	ConnCacheKey key;
+	ConnCacheEntry *entry;
+	bool		found;
+
+	MemSet(&key, 0, sizeof(key));
+	key.serverid = opts->serverid;
+	key.userid = opts->userid;
+	key.host = host;
+
+	/* Find the first connection that nobody has claimed */
+	for (key.slot = 0;; key.slot++)
+	{
+		entry = (ConnCacheEntry *) hash_search(ConnectionHash, &key,
+											   HASH_ENTER, &found);
+		if (!found)
+		{
+			entry->conn = NULL;
+			entry->address = NULL;
+			entry->port = 0;
+			entry->socket = NULL;
+			entry->username = NULL;
+			entry->password = NULL;
+			entry->fd = -1;
+			entry->transport = NULL;
+			entry->database = NULL;
+			entry->checked = false;
+			entry->invalidated = false;
+			entry->busy = false;
+			entry->busy_subid = InvalidSubTransactionId;
+			entry->counted = false;
+			entry->result = NULL;
+			entry->stmt = NULL;
+			entry->abort_callback = NULL;
+			entry->abort_arg = NULL;
+			entry->stmts = NULL;
+			entry->nstmts = 0;
+			entry->max_stmts = -1;
+			entry->cache_size = 0;
+		}
+
+		if (!entry->busy)
+			break;
+	}
+
+	/* Don't keep using a connection made with out of date options */
+	if (entry->conn && entry->invalidated)
+		mysqlDisconnect(entry);
+
+	/*
+	 * MySQL has no way to deselect a database, so a table without one must
+	 * not inherit whatever the previous user of the connection selected.
+	 */
+	if (entry->conn && !opts->database && entry->database)
+		mysqlDisconnect(entry);
+
+	/*
+	 * The server may have timed out or dropped an idle connection, so check
+	 * it once per transaction before handing it out.
+	 */
+	if (entry->conn && !entry->checked)
+	{
+		if (mysql_ping(entry->conn) != 0)
+			mysqlDisconnect(entry);
+		else
+			entry->checked = true;
+	}
+
+	if (!entry->conn)
+	{
+		if (!mysqlConnect(entry, opts, address, port, throw_error))
+			return NULL;
+	}
+	else if (opts->database &&
+			 (!entry->database || strcmp(entry->database, opts->database) != 0))
+	{
+		if (mysql_select_db(entry->conn, opts->database) != 0)
+		{
+			char *err = pstrdup(mysql_error(entry->conn));
+			mysqlDisconnect(entry);
+			if (!throw_error)
+				return NULL;
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+				errmsg("failed to select MySQL database \"%s\": %s",
+					   opts->database, err)
+				));
+		}
+
+		if (entry->database)
+			pfree(entry->database);
+		entry->database = MemoryContextStrdup(CacheMemoryContext,
+											  opts->database);
+	}
+
+	return entry;
+}
+
+/*
+ * Claim a connection to one of the server's replicas, or return NULL if
+ * none of them can be used, so that the primary is used instead.
+ *
+ * The replica with the fewest connections claimed by scans is chosen,
+ * counting those of all backends if we were preloaded. Ties are broken by
+ * process ID, so that backends starting at once don't all pick the same
+ * one. Replicas that recently failed to connect are skipped, as are those
+ * further behind than max_replica_lag, if it's set.
+ */
+static MYSQL *
+mysqlGetReplicaConnection(MySQLFdwOptions *opts)
+{
+	char	  **addresses;
+	int		   *ports;
+	int		   *load;
+	int			n;
+	int			i;
+
+	n = mysqlParseHosts(opts->replicas, &addresses, &ports);
+	load = (int *) palloc(n * sizeof(int));
+	for (i = 0; i < n; i++)
+		load[i] = mysqlHostInflight(opts->serverid, addresses[i], ports[i]);
+
+	for (;;)
+	{
+		ConnCacheEntry *entry;
+		int			best = -1;
+		int			j;
+
+		for (j = 0; j < n; j++)
+		{
+			i = (j + MyProcPid) % n;
+			if (load[i] >= 0 && (best < 0 || load[i] < load[best]))
+				best = i;
+		}
+		if (best < 0)
+			return NULL;
+
+		entry = mysqlGetEntry(opts, best + 1, addresses[best], ports[best],
+							  false);
+		mysqlHostConnected(opts->serverid, addresses[best], ports[best],
+						   entry != NULL);
+		if (entry == NULL ||
+			(opts->max_replica_lag >= 0 &&
+			 mysqlReplicaLag(entry, opts) > opts->max_replica_lag))
+		{
+			load[best] = -1;
+			continue;
+		}
+
+		entry->busy = true;
+		entry->busy_subid = mysqlClaimOwner(opts);
+		entry->counted = true;
+		mysqlHostAddInflight(opts->serverid, entry->address, entry->port, 1);
+
+		return entry->conn;
+	}
+}
+
+/*
+ * Return how many seconds a replica is behind its primary, as last found
+ * by asking it with SHOW REPLICA STATUS (or SHOW SLAVE STATUS, before
+ * MySQL 8.0.22). That's checked every few seconds at most. A server that
+ * isn't replicating at all is taken to be up to date; one whose
+ * replication is stopped, or that won't tell us, is taken to be too far
+ * behind to use.
+ */
+static int
+mysqlReplicaLag(ConnCacheEntry *entry, MySQLFdwOptions *opts)
+{
+	MYSQL_RES  *result;
+	MYSQL_ROW	row;
+	int			lag;
+
+	lag = mysqlHostGetLag(opts->serverid, entry->address, entry->port);
+	if (lag >= 0)
+		return lag;
+
+	lag = INT_MAX;
+	if (mysql_query(entry->conn, "SHOW REPLICA STATUS") != 0 &&
+		mysql_query(entry->conn, "SHOW SLAVE STATUS") != 0)
+		result = NULL;
+	else
+		result = mysql_store_result(entry->conn);
+
+	if (result)
+	{
+		row = mysql_fetch_row(result);
+		if (row == NULL)
+			lag = 0;
+		else
+		{
+			MYSQL_FIELD *fields = mysql_fetch_fields(result);
+			unsigned int nfields = mysql_num_fields(result);
+			unsigned int i;
+
+			for (i = 0; i < nfields; i++)
+			{
+				if ((strcmp(fields[i].name, "Seconds_Behind_Source") == 0 ||
+					 strcmp(fields[i].name, "Seconds_Behind_Master") == 0) &&
+					row[i] != NULL)
+					lag = atoi(row[i]);
+			}
+		}
+		mysql_free_result(result);
+	}
+
+	mysqlHostSetLag(opts->serverid, entry->address, entry->port, lag);
+	return lag;
+}
+
+/*
+ * mysqlSetPendingResult
+ *		Remember the unbuffered result being read on an exclusive connection,
+ *		so that it can be cleaned up if the transaction aborts.
+ */
+void
+mysqlSetPendingResult(MYSQL *conn, MYSQL_RES *result)
+{
+	ConnCacheEntry *entry = mysqlFindEntry(conn);
+
+	if (entry)
+		entry->result = result;
+}
+
+/*
+ * mysqlSetPendingStatement
+ *		Likewise for a prepared statement being executed.
+ */
+void
+mysqlSetPendingStatement(MYSQL *conn, MYSQL_STMT *stmt)
+{
+	ConnCacheEntry *entry = mysqlFindEntry(conn);
+
+	if (entry)
+		entry->stmt = stmt;
+}
+
+/*
+ * mysqlSetAbortCallback
+ *		Register a function to be called before an exclusive connection is
+ *		closed by mysqlDiscardConnection() or a transaction abort, for
+ *		example to stop another thread using it. NULL unregisters it.
+ */
+void
+mysqlSetAbortCallback(MYSQL *conn, void (*callback) (void *arg), void *arg)
+{
+	ConnCacheEntry *entry = mysqlFindEntry(conn);
+
+	if (entry)
+	{
+		entry->abort_callback = callback;
+		entry->abort_arg = arg;
+	}
+}
+
+/*
+ * mysqlReleaseConnection
+ *		Give back an exclusive connection. Any result read or statement
+ *		executed on it must have been freed already.
+ */
+void
+mysqlReleaseConnection(MYSQL *conn)
+{
+	ConnCacheEntry *entry = mysqlFindEntry(conn);
+
+	if (entry)
+	{
+		mysqlUncount(entry);
+		entry->busy = false;
+		entry->result = NULL;
+		entry->stmt = NULL;
+		entry->abort_callback = NULL;
+		entry->abort_arg = NULL;
+	}
+}
+
+/*
+ * mysqlDiscardConnection
+ *		Close a cached connection that is in an unknown state, for example
+ *		after a failed query, so that the next user gets a fresh one.
+ */
+void
+mysqlDiscardConnection(MYSQL *conn)
+{
+	ConnCacheEntry *entry = mysqlFindEntry(conn);
+
+	if (entry)
+		mysqlDisconnect(entry);
+}
+
+/*
+ * mysqlCancelQuery
+ *		Stop the query running on a connection, and close it without reading
+ *		the rest of its result, which is freed along with any statement or
+ *		prefetch registered for the connection.
+ */
+void
+mysqlCancelQuery(MYSQL *conn)
+{
+	ConnCacheEntry *entry = mysqlFindEntry(conn);
+
+	if (entry)
+	{
+		mysqlKillQuery(entry);
+		mysqlDisconnect(entry);
+	}
+}
+
+/*
+ * mysqlPrepareStatement
+ *		Return a statement prepared from a query on an exclusive connection,
+ *		reusing one prepared earlier if there is one not in use, and set
+ *		*hit to say which. The statement must be given back with
+ *		mysqlReleaseStatement().
+ *
+ * The cache holds at most statement_cache_size statements per connection,
+ * and no more than MySQL's max_prepared_stmt_count. Should MySQL run out
+ * of statements all the same, which are counted over all its sessions, the
+ * least recently used one of ours is closed to make room.
+ */
+MYSQL_STMT *
+mysqlPrepareStatement(MYSQL *conn, const char *query, bool *hit)
+{
+	ConnCacheEntry *entry = mysqlFindEntry(conn);
+	MYSQL_STMT *stmt;
+	int			i;
+
+	*hit = false;
+
+	if (entry && entry->cache_size > 0)
+	{
+		for (i = 0; i < entry->nstmts; i++)
+		{
+			CachedStatement *cs = &entry->stmts[i];
+
+			if (!cs->in_use && strcmp(cs->query, query) == 0 &&
+				mysqlSameDatabase(cs->database, entry->database))
+			{
+				cs->in_use = true;
+				cs->last_used = ++StatementClock;
+				*hit = true;
+				return cs->stmt;
+			}
+		}
+
+		/* Find out how many statements MySQL allows, once per connection */
+		if (entry->max_stmts < 0)
+		{
+			MYSQL_RES  *result;
+			MYSQL_ROW	row;
+
+			entry->max_stmts = entry->cache_size;
+			if (mysql_query(conn, "SELECT @@max_prepared_stmt_count") == 0 &&
+				(result = mysql_store_result(conn)) != NULL)
+			{
+				row = mysql_fetch_row(result);
+				if (row && row[0])
+					entry->max_stmts = Min(entry->max_stmts, atoi(row[0]));
+				mysql_free_result(result);
+			}
+			entry->stmts = (CachedStatement *)
+				MemoryContextAlloc(CacheMemoryContext,
+								   Max(entry->max_stmts, 1) * sizeof(CachedStatement));
+		}
+	}
+
+	stmt = mysql_stmt_init(conn);
+	if (!stmt)
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+			errmsg("failed to initialise the MySQL statement object")
+			));
+
+	while (mysql_stmt_prepare(stmt, query, strlen(query)) != 0)
+	{
+		char	   *err;
+
+		if (mysql_stmt_errno(stmt) == ER_MAX_PREPARED_STMT_COUNT_REACHED &&
+			entry && mysqlEvictStatement(entry))
+			continue;
+
+		err = pstrdup(mysql_stmt_error(stmt));
+		mysql_stmt_close(stmt);
+		mysqlDiscardConnection(conn);
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				 errmsg("failed to prepare the MySQL query: %s", err)));
+	}
+
+	/* Keep it, if there's room or can be made */
+	if (entry && entry->cache_size > 0 && entry->max_stmts > 0 &&
+		(entry->nstmts < entry->max_stmts || mysqlEvictStatement(entry)))
+	{
+		CachedStatement *cs = &entry->stmts[entry->nstmts++];
+
+		cs->query = MemoryContextStrdup(CacheMemoryContext, query);
+		cs->database = entry->database ?
+			MemoryContextStrdup(CacheMemoryContext, entry->database) : NULL;
+		cs->stmt = stmt;
+		cs->in_use = true;
+		cs->last_used = ++StatementClock;
+	}
+
+	return stmt;
+}
+
+/*
+ * mysqlReleaseStatement
+ *		Give back a statement from mysqlPrepareStatement(), discarding any
+ *		rows of its result not yet read.
+ */
+void
+mysqlReleaseStatement(MYSQL *conn, MYSQL_STMT *stmt)
+{
+	ConnCacheEntry *entry = mysqlFindEntry(conn);
+	CachedStatement *cs = entry ? mysqlFindStatement(entry, stmt) : NULL;
+
+	if (cs == NULL)
+	{
+		mysql_stmt_close(stmt);
+		return;
+	}
+
+	if (mysql_stmt_free_result(stmt) != 0)
+	{
+		/* Don't hand out a statement in an unknown state */
+		mysql_stmt_close(stmt);
+		mysqlFreeStatement(cs);
+		*cs = entry->stmts[--entry->nstmts];
+		return;
+	}
+
+	cs->in_use = false;
+}
+
+/*
+ * Find a statement in a connection's cache.
+ */
+static CachedStatement *
+mysqlFindStatement(ConnCacheEntry *entry, MYSQL_STMT *stmt)
+{
+	int			i;
+
+	for (i = 0; i < entry->nstmts; i++)
+	{
+		if (entry->stmts[i].stmt == stmt)
+			return &entry->stmts[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Close the least recently used of a connection's cached statements that
+ * isn't in use. Returns false if there's none.
+ */
+static bool
+mysqlEvictStatement(ConnCacheEntry *entry)
+{
+	int			victim = -1;
+	int			i;
+
+	for (i = 0; i < entry->nstmts; i++)
+	{
+		if (!entry->stmts[i].in_use &&
+			(victim < 0 ||
+			 entry->stmts[i].last_used < entry->stmts[victim].last_used))
+			victim = i;
+	}
+
+	if (victim < 0)
+		return false;
+
+	mysql_stmt_close(entry->stmts[victim].stmt);
+	mysqlFreeStatement(&entry->stmts[victim]);
+	entry->stmts[victim] = entry->stmts[--entry->nstmts];
+
+	return true;
+}
+
+/*
+ * Free the strings of a cached statement that has been closed.
+ */
+static void
+mysqlFreeStatement(CachedStatement *cs)
+{
+	pfree(cs->query);
+	if (cs->database)
+		pfree(cs->database);
+}
+
+/*
+ * Were two statements prepared with the same database selected?
+ */
+static bool
+mysqlSameDatabase(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL)
+		return a == b;
+	return strcmp(a, b) == 0;
+}
+
+/* How often to check for interrupts while waiting for MySQL, in ms */
+#define WAIT_POLL_MS	100
+
+/*
+ * mysqlWaitForResult
+ *		Wait for the answer to a query sent with mysql_send_query(), checking
+ *		for interrupts meanwhile. If the wait is interrupted, the query is
+ *		cancelled rather than being left running on MySQL.
+ *
+ * This must be called before anything has been read on the connection
+ * since the query was sent, so there's nothing buffered by libmysqlclient.
+ */
+void
+mysqlWaitForResult(MYSQL *conn)
+{
+	struct pollfd pfd;
+
+	pfd.fd = mysqlConnectionSocket(conn);
+	pfd.events = POLLIN;
+
+	/* Not one of ours; just let libmysqlclient wait */
+	if (pfd.fd < 0)
+		return;
+
+	PG_TRY();
+	{
+		for (;;)
+		{
+			int			rc;
+
+			/* Errors are left for libmysqlclient to find when it reads */
+			pfd.revents = 0;
+			rc = poll(&pfd, 1, WAIT_POLL_MS);
+			if (rc > 0 || (rc < 0 && errno != EINTR))
+				break;
+
+			CHECK_FOR_INTERRUPTS();
+		}
+	}
+	PG_CATCH();
+	{
+		mysqlCancelQuery(conn);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+}
+
+/*
+ * mysqlConnectionSocket
+ *		Return the socket descriptor of a cached connection, or -1 if it
+ *		isn't one.
+ */
+int
+mysqlConnectionSocket(MYSQL *conn)
+{
+	ConnCacheEntry *entry = mysqlFindEntry(conn);
+
+	return entry ? entry->fd : -1;
+}
+
+/*
+ * Find the cache entry holding a connection.
+ */
+static ConnCacheEntry *
+mysqlFindEntry(MYSQL *conn)
+{
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+
+	if (ConnectionHash == NULL || conn == NULL)
+		return NULL;
+
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+	{
+		if (entry->conn == conn)
+		{
+			hash_seq_term(&scan);
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Open a new connection to the given host for a cache entry. Returns false
+ * if that fails and we weren't asked to throw an error.
+ *
+ * The primary is reached through its Unix socket, if the socket option is
+ * set; replicas always over TCP/IP.
+ */
+static bool
+mysqlConnect(ConnCacheEntry *entry, MySQLFdwOptions *opts,
+			 const char *address, int port, bool throw_error)
+{
+	MYSQL	   *conn;
+	const char *socket = entry->key.host == 0 ? opts->socket : NULL;
+	MySQLFdwCompression compression;
+	unsigned long flags = CLIENT_REMEMBER_OPTIONS;
+	char		transport[256];
+
+	conn = mysql_init(NULL);
+	if (!conn)
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+			errmsg("failed to initialise the MySQL connection object")
+			));
+
+	mysql_options(conn, MYSQL_SET_CHARSET_NAME, GetDatabaseEncodingName());
+
+	if (socket)
+	{
+		unsigned int protocol = MYSQL_PROTOCOL_SOCKET;
+
+		mysql_options(conn, MYSQL_OPT_PROTOCOL, &protocol);
+		address = NULL;
+	}
+
+	/*
+	 * Compressing a local connection just burns CPU at both ends, so by
+	 * default only remote ones are.
+	 */
+	compression = mysqlCompression(opts, address, socket);
+	if (compression == MYSQL_FDW_COMPRESSION_ZLIB)
+		flags |= CLIENT_COMPRESS;
+#ifdef HAVE_MYSQL_ZSTD
+	else if (compression == MYSQL_FDW_COMPRESSION_ZSTD)
+		mysql_options(conn, MYSQL_OPT_COMPRESSION_ALGORITHMS, "zstd");
+#endif
+
+#ifdef HAVE_MYSQL_NET_BUFFER_LENGTH
+	if (opts->net_buffer_length > 0)
+	{
+		unsigned long length = opts->net_buffer_length;
+
+		mysql_options(conn, MYSQL_OPT_NET_BUFFER_LENGTH, &length);
+	}
+#endif
+
+	if (opts->read_timeout > 0)
+	{
+		unsigned int timeout = opts->read_timeout;
+
+		mysql_options(conn, MYSQL_OPT_READ_TIMEOUT, &timeout);
+	}
+
+	if (!mysql_real_connect(conn, address, opts->username, opts->password,
+							opts->database, port, socket, flags))
+	{
+		char *err = pstrdup(mysql_error(conn));
+		mysql_close(conn);
+		if (!throw_error)
+			return false;
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+			errmsg("failed to connect to MySQL: %s", err)
+			));
+	}
+
+	snprintf(transport, sizeof(transport), "%s, %s",
+			 mysql_get_host_info(conn), mysqlCompressionName(compression));
+
+	entry->conn = conn;
+	entry->address = MemoryContextStrdup(CacheMemoryContext,
+										 address ? address : socket);
+	entry->port = port;
+	entry->socket = socket ?
+		MemoryContextStrdup(CacheMemoryContext, socket) : NULL;
+	entry->username = opts->username ?
+		MemoryContextStrdup(CacheMemoryContext, opts->username) : NULL;
+	entry->password = opts->password ?
+		MemoryContextStrdup(CacheMemoryContext, opts->password) : NULL;
+#ifdef HAVE_MYSQL_GET_SOCKET
+	entry->fd = mysql_get_socket(conn);
+#else
+	/* MySQL has no call for this, but it has always been kept here */
+	entry->fd = conn->net.fd;
+#endif
+	entry->transport = MemoryContextStrdup(CacheMemoryContext, transport);
+	entry->database = opts->database ?
+		MemoryContextStrdup(CacheMemoryContext, opts->database) : NULL;
+	entry->checked = true;
+	entry->invalidated = false;
+	entry->max_stmts = -1;
+	entry->cache_size = opts->statement_cache_size;
+
+	return true;
+}
+
+/*
+ * Resolve the compression option for a host: auto means zlib, unless the
+ * host is reached by a Unix socket or the loopback interface.
+ */
+static MySQLFdwCompression
+mysqlCompression(MySQLFdwOptions *opts, const char *address,
+				 const char *socket)
+{
+	if (opts->compression != MYSQL_FDW_COMPRESSION_AUTO)
+		return opts->compression;
+
+	if (socket || mysqlIsLocalHost(address))
+		return MYSQL_FDW_COMPRESSION_OFF;
+
+	return MYSQL_FDW_COMPRESSION_ZLIB;
+}
+
+static const char *
+mysqlCompressionName(MySQLFdwCompression compression)
+{
+	switch (compression)
+	{
+		case MYSQL_FDW_COMPRESSION_ZLIB:
+			return "zlib compression";
+		case MYSQL_FDW_COMPRESSION_ZSTD:
+			return "zstd compression";
+		default:
+			return "uncompressed";
+	}
+}
+
+/*
+ * mysqlIsLocalHost
+ *		Is a MySQL host on this machine? As with libmysqlclient, no address
+ *		at all means localhost.
+ */
+bool
+mysqlIsLocalHost(const char *address)
+{
+	return address == NULL ||
+		strcmp(address, "localhost") == 0 ||
+		strcmp(address, "127.0.0.1") == 0 ||
+		strcmp(address, "::1") == 0;
+}
+
+/*
+ * mysqlPlannedTransport
+ *		Describe how scans with the given options will reach the primary,
+ *		in the words of mysql_get_host_info(), for EXPLAIN.
+ */
+char *
+mysqlPlannedTransport(MySQLFdwOptions *opts)
+{
+	StringInfoData buf;
+
+	initStringInfo(&buf);
+
+	if (opts->socket)
+		appendStringInfo(&buf, "%s via UNIX socket", opts->socket);
+	else if (strcmp(opts->address, "localhost") == 0)
+		appendStringInfoString(&buf, "Localhost via UNIX socket");
+	else
+		appendStringInfo(&buf, "%s via TCP/IP", opts->address);
+
+	appendStringInfo(&buf, ", %s",
+					 mysqlCompressionName(mysqlCompression(opts,
+														   opts->address,
+														   opts->socket)));
+
+	if (opts->replicas && !opts->primary_only)
+		appendStringInfoString(&buf, ", or a replica");
+
+	return buf.data;
+}
+
+/*
+ * MySQL character sets that are the same as a PostgreSQL server encoding.
+ * MySQL's latin1 is really Windows-1252, not ISO 8859-1.
+ */
+static const struct
+{
+	const char *charset;
+	int			encoding;
+}	charset_encodings[] =
+{
+	{"utf8mb4", PG_UTF8},
+	{"utf8mb3", PG_UTF8},
+	{"utf8", PG_UTF8},
+	{"latin1", PG_WIN1252},
+	{"latin2", PG_LATIN2},
+	{"latin5", PG_LATIN5},
+	{"latin7", PG_LATIN7},
+	{"greek", PG_ISO_8859_7},
+	{"hebrew", PG_ISO_8859_8},
+	{"cp1250", PG_WIN1250},
+	{"cp1251", PG_WIN1251},
+	{"cp1256", PG_WIN1256},
+	{"cp1257", PG_WIN1257},
+	{"koi8r", PG_KOI8R},
+	{"koi8u", PG_KOI8U},
+	{"ujis", PG_EUC_JP},
+	{"euckr", PG_EUC_KR},
+	{"gb2312", PG_EUC_CN},
+	{NULL, 0}
+};
+
+/*
+ * mysqlCharsetMatches
+ *		Is the character set MySQL converts strings to for a connection the
+ *		same as the database encoding?
+ */
+bool
+mysqlCharsetMatches(MYSQL *conn)
+{
+	const char *charset = mysql_character_set_name(conn);
+	int			i;
+
+	for (i = 0; charset_encodings[i].charset; i++)
+	{
+		if (pg_strcasecmp(charset, charset_encodings[i].charset) == 0)
+			return charset_encodings[i].encoding == GetDatabaseEncoding();
+	}
+
+	return false;
+}
+
+/*
+ * mysqlConnectionTransport
+ *		Describe how a cached connection reaches its server, or return NULL
+ *		if it isn't one of ours.
+ */
+const char *
+mysqlConnectionTransport(MYSQL *conn)
+{
+	ConnCacheEntry *entry = mysqlFindEntry(conn);
+
+	return entry ? entry->transport : NULL;
+}
+
+/*
+ * Stop counting a claimed replica connection in the replica's load.
+ */
+static void
+mysqlUncount(ConnCacheEntry *entry)
+{
+	if (entry->counted)
+	{
+		mysqlHostAddInflight(entry->key.serverid, entry->address, entry->port,
+							 -1);
+		entry->counted = false;
+	}
+}
+
+/*
+ * Close the connection of a cache entry, if any.
+ */
+static void
+mysqlDisconnect(ConnCacheEntry *entry)
+{
+	if (entry->abort_callback)
+	{
+		void		(*callback) (void *arg) = entry->abort_callback;
+
+		entry->abort_callback = NULL;
+		callback(entry->abort_arg);
+	}
+
+	mysqlUncount(entry);
+
+	/*
+	 * mysql_close() frees the MYSQL, which an unfinished streamed result
+	 * still points at, so detach the result first; otherwise freeing it
+	 * would try to read the rest of it from the freed connection.
+	 */
+	if (entry->result)
+		entry->result->handle = NULL;
+
+	if (entry->conn)
+	{
+		mysql_close(entry->conn);
+		entry->conn = NULL;
+	}
+
+	if (entry->address)
+	{
+		pfree(entry->address);
+		entry->address = NULL;
+	}
+
+	if (entry->socket)
+	{
+		pfree(entry->socket);
+		entry->socket = NULL;
+	}
+
+	if (entry->username)
+	{
+		pfree(entry->username);
+		entry->username = NULL;
+	}
+
+	if (entry->password)
+	{
+		pfree(entry->password);
+		entry->password = NULL;
+	}
+
+	entry->fd = -1;
+
+	if (entry->transport)
+	{
+		pfree(entry->transport);
+		entry->transport = NULL;
+	}
+
+	/* Once the connection is gone, these don't try to read the rest */
+	if (entry->result)
+	{
+		mysql_free_result(entry->result);
+		entry->result = NULL;
+	}
+
+	if (entry->stmt)
+	{
+		if (mysqlFindStatement(entry, entry->stmt) == NULL)
+			mysql_stmt_close(entry->stmt);
+		entry->stmt = NULL;
+	}
+
+	if (entry->stmts)
+	{
+		int			i;
+
+		for (i = 0; i < entry->nstmts; i++)
+		{
+			mysql_stmt_close(entry->stmts[i].stmt);
+			mysqlFreeStatement(&entry->stmts[i]);
+		}
+		pfree(entry->stmts);
+		entry->stmts = NULL;
+		entry->nstmts = 0;
+	}
+
+	if (entry->database)
+	{
+		pfree(entry->database);
+		entry->database = NULL;
+	}
+
+	entry->checked = false;
+	entry->invalidated = false;
+	entry->busy = false;
+}
+
+/*
+ * Ask MySQL to stop whatever query is running on a connection, with KILL
+ * QUERY sent over another. Closing the connection isn't enough, since
+ * MySQL only notices that when it next sends something, which for a big
+ * sort or join may be minutes away.
+ *
+ * An idle cached connection to the same server is used if there is one,
+ * otherwise a short-lived one is opened with the same host and user. This
+ * is called while aborting, so it mustn't throw errors or look at the
+ * catalogs, and a failure just means the query runs on.
+ */
+static void
+mysqlKillQuery(ConnCacheEntry *entry)
+{
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *other;
+	MYSQL	   *conn = entry->conn;
+	MYSQL	   *side = NULL;
+	bool		temporary = false;
+	char		sql[64];
+
+	if (conn == NULL)
+		return;
+
+	hash_seq_init(&scan, ConnectionHash);
+	while ((other = (ConnCacheEntry *) hash_seq_search(&scan)))
+	{
+		if (other != entry && other->conn && !other->busy &&
+			other->key.serverid == entry->key.serverid &&
+			other->key.userid == entry->key.userid &&
+			other->key.host == entry->key.host)
+		{
+			side = other->conn;
+			hash_seq_term(&scan);
+			break;
+		}
+	}
+
+	if (side == NULL)
+	{
+		unsigned int timeout = 5;
+
+		side = mysql_init(NULL);
+		if (side == NULL)
+			return;
+		mysql_options(side, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+		mysql_options(side, MYSQL_OPT_READ_TIMEOUT, &timeout);
+		if (!mysql_real_connect(side, entry->socket ? NULL : entry->address,
+								entry->username, entry->password, NULL,
+								entry->port, entry->socket, 0))
+		{
+			mysql_close(side);
+			return;
+		}
+		temporary = true;
+	}
+
+	snprintf(sql, sizeof(sql), "KILL QUERY %lu", mysql_thread_id(conn));
+	if (mysql_query(side, sql) != 0 && !temporary)
+	{
+		/* The idle connection may well have gone; don't use it again */
+		other->checked = false;
+	}
+
+	if (temporary)
+		mysql_close(side);
+}
+
+/*
+ * Return the subtransaction a claim for these options belongs to. A scan
+ * only takes its connection at the first fetch, which may come from a
+ * savepoint opened after the scan (or a cursor over it) began, so it is
+ * the scan's subtransaction that counts, not the current one.
+ */
+static SubTransactionId
+mysqlClaimOwner(MySQLFdwOptions *opts)
+{
+	if (opts->owner != InvalidSubTransactionId)
+		return opts->owner;
+	return GetCurrentSubTransactionId();
+}
+
+/*
+ * Close the connections claimed by the given subtransaction or any started
+ * after it, which are its children; InvalidSubTransactionId means all of
+ * them. The scans using them were abandoned part way through, so the
+ * connections may still have queries running, or unread results pending.
+ */
+static void
+mysqlAbortConnections(SubTransactionId subid)
+{
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+	{
+		if (entry->busy && entry->busy_subid >= subid)
+		{
+			mysqlKillQuery(entry);
+			mysqlDisconnect(entry);
+		}
+	}
+}
+
+/*
+ * Server or user mapping options changed. We can't tell which entries are
+ * affected from here, so reconnect them all when they are next used.
+ */
+static void
+mysqlInvalCallback(Datum arg, int cacheid, ItemPointer tuplePtr)
+{
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+		entry->invalidated = true;
+}
+
+/*
+ * Liveness checks are only valid for the transaction they were made in, and
+ * connections still claimed at the end of it belong to abandoned scans.
+ */
+static void
+mysqlXactCallback(XactEvent event, void *arg)
+{
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+
+	mysqlAbortConnections(InvalidSubTransactionId);
+
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+		entry->checked = false;
+}
+
+/*
+ * Scans started in an aborted subtransaction won't be ended either. Those
+ * started in a committed one now belong to its parent, like their portals.
+ */
+static void
+mysqlSubXactCallback(SubXactEvent event, SubTransactionId mySubid,
+					 SubTransactionId parentSubid, void *arg)
+{
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+
+	if (event == SUBXACT_EVENT_ABORT_SUB)
+		mysqlAbortConnections(mySubid);
+	else if (event == SUBXACT_EVENT_COMMIT_SUB)
+	{
+		hash_seq_init(&scan, ConnectionHash);
+		while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+		{
+			if (entry->busy && entry->busy_subid >= mySubid)
+				entry->busy_subid = parentSubid;
+		}
+	}
+}
+
+/*
+ * Say goodbye properly, so that MySQL doesn't log aborted connections.
+ *
+ * This runs before the transaction of a dying backend is aborted, so scans
+ * may still be using their connections, with prefetch threads reading from
+ * them. Those are stopped as on abort, before any connection is closed.
+ * mysqlDisconnect() also gives back our claims on replicas, which other
+ * backends would otherwise count forever.
+ */
+static void
+mysqlExitCallback(int code, Datum arg)
+{
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+
+	mysqlAbortConnections(InvalidSubTransactionId);
+
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+		mysqlDisconnect(entry);
+}
+
+/*
+ * mysql_fdw_get_connections
+ *		List the connections cached by this backend.
+ */
+Datum
+mysql_fdw_get_connections(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	if (ConnectionHash)
+	{
+		hash_seq_init(&scan, ConnectionHash);
+		while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+		{
+			Datum		values[5];
+			bool		nulls[5];
+
+			if (!entry->conn)
+				continue;
+
+			MemSet(nulls, 0, sizeof(nulls));
+
+			values[0] = CStringGetTextDatum(GetForeignServer(entry->key.serverid)->servername);
+			if (OidIsValid(entry->key.userid))
+				values[1] = CStringGetTextDatum(GetUserNameFromId(entry->key.userid));
+			else
+				values[1] = CStringGetTextDatum("public");
+			if (entry->database)
+				values[2] = CStringGetTextDatum(entry->database);
+			else
+				nulls[2] = true;
+			values[3] = Int64GetDatum((int64) mysql_thread_id(entry->conn));
+			values[4] = BoolGetDatum(!entry->invalidated);
+
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+		}
+	}
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
+
+/*
+ * mysql_fdw_disconnect
+ *		Close the cached connections to the named server, other than those
+ *		in use by a running scan. Returns true if any were closed.
+ */
+Datum
+mysql_fdw_disconnect(PG_FUNCTION_ARGS)
+{
+	char	   *servername = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	ForeignServer *server = GetForeignServerByName(servername, false);
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+	bool		result = false;
+
+	if (ConnectionHash == NULL)
+		PG_RETURN_BOOL(false);
+
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+	{
+		if (entry->key.serverid == server->serverid && entry->conn &&
+			!entry->busy)
+		{
+			mysqlDisconnect(entry);
+			result = true;
+		}
+	}
+
+	PG_RETURN_BOOL(result);
+}
+
+/*
+ * mysql_fdw_disconnect_all
+ *		Close all cached connections not in use by a running scan. Returns
+ *		true if any were closed.
+ */
+Datum
+mysql_fdw_disconnect_all(PG_FUNCTION_ARGS)
+{
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+	bool		result = false;
+
+	if (ConnectionHash == NULL)
+		PG_RETURN_BOOL(false);
+
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+	{
+		if (entry->conn && !entry->busy)
+		{
+			mysqlDisconnect(entry);
+			result = true;
+		}
+	}
+
+	PG_RETURN_BOOL(result);
+}
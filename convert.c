@@ -0,0 +1,426 @@
+/*-------------------------------------------------------------------------
+ *
+ *		  foreign-data wrapper for MySQL
+ *
+ * Copyright (c) 2011, PostgreSQL Global Development Group
+ *
+ * This software is released under the PostgreSQL Licence
+ *
+ * Author: Dave Page <dpage@pgadmin.org>
+ *
+ * IDENTIFICATION
+ *		  mysql_fdw/convert.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <errno.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+
+#include "mysql_fdw.h"
+
+#include "catalog/pg_type.h"
+#include "parser/parse_coerce.h"
+#include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/datetime.h"
+#include "utils/lsyscache.h"
+#include "utils/timestamp.h"
+
+/*
+ * Converting text protocol values.
+ *
+ * Which converter to use for each column is worked out once per scan.
+ * The common types MySQL sends in a fixed format are parsed directly, and
+ * anything else, including values the fast paths don't recognize, goes
+ * through the type's input function, so errors are reported just as they
+ * would be without the fast paths.
+ */
+typedef enum MySQLFdwConvKind
+{
+	CONV_INT2,
+	CONV_INT4,
+	CONV_INT8,
+	CONV_FLOAT4,
+	CONV_FLOAT8,
+	CONV_BOOL,
+	CONV_TEXT,					/* text or unconstrained varchar */
+	CONV_DATE,
+	CONV_TIMESTAMP,				/* timestamp without typmod */
+	CONV_GENERIC				/* input function */
+} MySQLFdwConvKind;
+
+typedef struct MySQLFdwColumn
+{
+	int			attnum;			/* attribute the value goes into */
+	MySQLFdwConvKind kind;
+	bool		is_string;		/* needs encoding verification? */
+	bool		trusted;		/* converted by MySQL, so only NULs need it? */
+	FmgrInfo	infunc;			/* input function, for CONV_GENERIC and */
+	Oid			ioparam;		/* for values the fast paths reject */
+	int32		typmod;
+} MySQLFdwColumn;
+
+struct MySQLFdwConverter
+{
+	int			ncols;
+	MySQLFdwColumn cols[1];		/* VARIABLE LENGTH ARRAY */
+};
+
+static bool mysqlParseInt64(const char *str, unsigned long len, int64 *result);
+static bool mysqlParseDigits(const char *str, int n, int *result);
+static bool mysqlParseDate(const char *str, unsigned long len, struct pg_tm *tm);
+static bool mysqlParseTime(const char *str, unsigned long len, struct pg_tm *tm,
+						   fsec_t *fsec);
+static Datum mysqlConvertValue(MySQLFdwColumn *col, char *str,
+							   unsigned long len);
+
+/*
+ * mysqlBuildConverter
+ *		Work out how to convert each field of a result; field i goes into
+ *		attribute attnums[i] of the tuple descriptor.
+ */
+MySQLFdwConverter *
+mysqlBuildConverter(TupleDesc tupdesc, int *attnums, int num_attrs)
+{
+	MySQLFdwConverter *conv;
+	int			i;
+
+	conv = (MySQLFdwConverter *) palloc0(offsetof(MySQLFdwConverter, cols) +
+										 Max(num_attrs, 1) * sizeof(MySQLFdwColumn));
+	conv->ncols = num_attrs;
+
+	for (i = 0; i < num_attrs; i++)
+	{
+		MySQLFdwColumn *col = &conv->cols[i];
+		Form_pg_attribute attr = tupdesc->attrs[attnums[i] - 1];
+		Oid			type = attr->atttypid;
+		Oid			typinput;
+
+		col->attnum = attnums[i];
+		col->typmod = attr->atttypmod;
+		col->is_string = (TypeCategory(type) == TYPCATEGORY_STRING);
+
+		getTypeInputInfo(type, &typinput, &col->ioparam);
+		fmgr_info(typinput, &col->infunc);
+
+		switch (type)
+		{
+			case INT2OID:
+				col->kind = CONV_INT2;
+				break;
+			case INT4OID:
+				col->kind = CONV_INT4;
+				break;
+			case INT8OID:
+				col->kind = CONV_INT8;
+				break;
+			case FLOAT4OID:
+				col->kind = CONV_FLOAT4;
+				break;
+			case FLOAT8OID:
+				col->kind = CONV_FLOAT8;
+				break;
+			case BOOLOID:
+				col->kind = CONV_BOOL;
+				break;
+			case TEXTOID:
+				col->kind = CONV_TEXT;
+				break;
+			case VARCHAROID:
+				col->kind = (col->typmod == -1) ? CONV_TEXT : CONV_GENERIC;
+				break;
+			case DATEOID:
+				col->kind = CONV_DATE;
+				break;
+			case TIMESTAMPOID:
+				col->kind = (col->typmod == -1) ? CONV_TIMESTAMP : CONV_GENERIC;
+				break;
+			default:
+				col->kind = CONV_GENERIC;
+				break;
+		}
+	}
+
+	return conv;
+}
+
+/*
+ * mysqlConvertRow
+ *		Convert a row of nfields text values into the given arrays, which
+ *		must be sized for the tuple descriptor.
+ *
+ * Only the attributes being fetched are set. Values are NUL terminated,
+ * as libmysqlclient returns them.
+ */
+void
+mysqlConvertRow(MySQLFdwConverter *conv, char **row, unsigned long *lengths,
+				int nfields, Datum *values, bool *nulls)
+{
+	int			n = Min(nfields, conv->ncols);
+	int			i;
+
+	for (i = 0; i < n; i++)
+	{
+		MySQLFdwColumn *col = &conv->cols[i];
+		int			att = col->attnum - 1;
+
+		if (row[i] == NULL)
+		{
+			values[att] = (Datum) 0;
+			nulls[att] = true;
+		}
+		else if (col->is_string && lengths[i] > 0 &&
+				 (!col->trusted || memchr(row[i], '\0', lengths[i]) != NULL) &&
+				 !mysqlVerifymbstr(row[i], lengths[i]))
+		{
+			/* mysqlVerifymbstr has issued a WARNING */
+			values[att] = (Datum) 0;
+			nulls[att] = true;
+		}
+		else
+		{
+			values[att] = mysqlConvertValue(col, row[i], lengths[i]);
+			nulls[att] = false;
+		}
+	}
+}
+
+/*
+ * mysqlConverterTrustEncoding
+ *		Stop verifying the encoding of string fields of a result, other than
+ *		those of raw bytes, which MySQL sends unconverted. The caller must
+ *		know that MySQL converts the rest to the database encoding. They're
+ *		still checked for NULs, which MySQL allows in strings.
+ */
+void
+mysqlConverterTrustEncoding(MySQLFdwConverter *conv, MYSQL_FIELD *fields,
+							int nfields)
+{
+	int			n = Min(nfields, conv->ncols);
+	int			i;
+
+	for (i = 0; i < n; i++)
+	{
+		if (fields[i].charsetnr != MYSQL_BINARY_CHARSET)
+			conv->cols[i].trusted = true;
+	}
+}
+
+/*
+ * Convert one non-NULL value.
+ */
+static Datum
+mysqlConvertValue(MySQLFdwColumn *col, char *str, unsigned long len)
+{
+	switch (col->kind)
+	{
+		case CONV_INT2:
+		case CONV_INT4:
+		case CONV_INT8:
+			{
+				int64		val;
+
+				if (!mysqlParseInt64(str, len, &val))
+					break;
+				if (col->kind == CONV_INT8)
+					return Int64GetDatum(val);
+				if (col->kind == CONV_INT4 && val >= INT_MIN && val <= INT_MAX)
+					return Int32GetDatum((int32) val);
+				if (col->kind == CONV_INT2 && val >= SHRT_MIN && val <= SHRT_MAX)
+					return Int16GetDatum((int16) val);
+				break;
+			}
+
+		case CONV_FLOAT4:
+		case CONV_FLOAT8:
+			{
+				double		val;
+				char	   *end;
+
+				if (len == 0)
+					break;
+				errno = 0;
+				val = strtod(str, &end);
+				if (end != str + len || errno != 0 || isinf(val) || isnan(val))
+					break;
+				if (col->kind == CONV_FLOAT8)
+					return Float8GetDatum(val);
+				if (fabs(val) <= FLT_MAX && (val == 0.0 || fabs(val) >= FLT_MIN))
+					return Float4GetDatum((float4) val);
+				break;
+			}
+
+		case CONV_BOOL:
+			if (len == 1 && str[0] == '1')
+				return BoolGetDatum(true);
+			if (len == 1 && str[0] == '0')
+				return BoolGetDatum(false);
+			break;
+
+		case CONV_TEXT:
+			return PointerGetDatum(cstring_to_text_with_len(str, len));
+
+		case CONV_DATE:
+			{
+				struct pg_tm tm;
+
+				if (len != 10 || !mysqlParseDate(str, len, &tm))
+					break;
+				return DateADTGetDatum(date2j(tm.tm_year, tm.tm_mon, tm.tm_mday) -
+									   POSTGRES_EPOCH_JDATE);
+			}
+
+		case CONV_TIMESTAMP:
+			{
+				struct pg_tm tm;
+				fsec_t		fsec;
+				Timestamp	result;
+
+				if (!mysqlParseDate(str, len, &tm) ||
+					!mysqlParseTime(str, len, &tm, &fsec))
+					break;
+				if (tm2timestamp(&tm, fsec, NULL, &result) != 0)
+					break;
+				return TimestampGetDatum(result);
+			}
+
+		case CONV_GENERIC:
+			break;
+	}
+
+	return InputFunctionCall(&col->infunc, str, col->ioparam, col->typmod);
+}
+
+/*
+ * Parse an optionally negative decimal integer, failing on anything else,
+ * including overflow.
+ */
+static bool
+mysqlParseInt64(const char *str, unsigned long len, int64 *result)
+{
+	const char *p = str;
+	const char *end = str + len;
+	bool		neg = false;
+	uint64		val = 0;
+
+	if (p < end && *p == '-')
+	{
+		neg = true;
+		p++;
+	}
+	if (p == end || end - p > 19)
+		return false;
+
+	for (; p < end; p++)
+	{
+		if (*p < '0' || *p > '9')
+			return false;
+		val = val * 10 + (*p - '0');
+	}
+
+	/* 19 digits can't overflow a uint64, but may overflow an int64 */
+	if (neg)
+	{
+		if (val > (uint64) INT64CONST(0x7FFFFFFFFFFFFFFF) + 1)
+			return false;
+		*result = (int64) (0 - val);
+	}
+	else
+	{
+		if (val > (uint64) INT64CONST(0x7FFFFFFFFFFFFFFF))
+			return false;
+		*result = (int64) val;
+	}
+
+	return true;
+}
+
+/*
+ * Parse exactly n decimal digits.
+ */
+static bool
+mysqlParseDigits(const char *str, int n, int *result)
+{
+	int			val = 0;
+	int			i;
+
+	for (i = 0; i < n; i++)
+	{
+		if (str[i] < '0' || str[i] > '9')
+			return false;
+		val = val * 10 + (str[i] - '0');
+	}
+
+	*result = val;
+	return true;
+}
+
+/*
+ * Parse the "YYYY-MM-DD" that MySQL sends for dates and at the start of
+ * datetimes. Zero dates and the like are left for the input function to
+ * complain about.
+ */
+static bool
+mysqlParseDate(const char *str, unsigned long len, struct pg_tm *tm)
+{
+	if (len < 10 || str[4] != '-' || str[7] != '-')
+		return false;
+
+	memset(tm, 0, sizeof(struct pg_tm));
+	if (!mysqlParseDigits(str, 4, &tm->tm_year) ||
+		!mysqlParseDigits(str + 5, 2, &tm->tm_mon) ||
+		!mysqlParseDigits(str + 8, 2, &tm->tm_mday))
+		return false;
+
+	if (tm->tm_year < 1 || tm->tm_mon < 1 || tm->tm_mon > MONTHS_PER_YEAR ||
+		tm->tm_mday < 1 ||
+		tm->tm_mday > day_tab[isleap(tm->tm_year)][tm->tm_mon - 1])
+		return false;
+
+	return true;
+}
+
+/*
+ * Parse the " HH:MM:SS[.ffffff]" following the date of a datetime.
+ */
+static bool
+mysqlParseTime(const char *str, unsigned long len, struct pg_tm *tm,
+			   fsec_t *fsec)
+{
+	int			frac = 0;
+	int			ndigits;
+
+	if (len < 19 || str[10] != ' ' || str[13] != ':' || str[16] != ':')
+		return false;
+
+	if (!mysqlParseDigits(str + 11, 2, &tm->tm_hour) ||
+		!mysqlParseDigits(str + 14, 2, &tm->tm_min) ||
+		!mysqlParseDigits(str + 17, 2, &tm->tm_sec))
+		return false;
+
+	if (tm->tm_hour > 23 || tm->tm_min > 59 || tm->tm_sec > 59)
+		return false;
+
+	if (len > 19)
+	{
+		ndigits = len - 20;
+		if (str[19] != '.' || ndigits < 1 || ndigits > 6 ||
+			!mysqlParseDigits(str + 20, ndigits, &frac))
+			return false;
+		for (; ndigits < 6; ndigits++)
+			frac *= 10;
+	}
+
+#ifdef HAVE_INT64_TIMESTAMP
+	*fsec = frac;
+#else
+	*fsec = frac / 1000000.0;
+#endif
+
+	return true;
+}
@@ -0,0 +1,1154 @@
+/*-------------------------------------------------------------------------
+ *
+ *		  foreign-data wrapper for MySQL
+ *
+ * Copyright (c) 2011, PostgreSQL Global Development Group
+ *
+ * This software is released under the PostgreSQL Licence
+ *
+ * Author: Dave Page <dpage@pgadmin.org>
+ *
+ * IDENTIFICATION
+ *		  mysql_fdw/deparse.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <ctype.h>
+
+#include "mysql_fdw.h"
+
+#include "access/heapam.h"
+#include "access/sysattr.h"
+#include "access/transam.h"
+#include "catalog/pg_proc.h"
+#include "catalog/pg_type.h"
+#include "miscadmin.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/relation.h"
+#include "optimizer/tlist.h"
+#include "optimizer/var.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/lsyscache.h"
+#include "utils/timestamp.h"
+#include "utils/typcache.h"
+
+/*
+ * The executor always re-checks a foreign scan's quals locally, so a
+ * condition sent to MySQL only has to accept every row that PostgreSQL
+ * would. That lets us push string equality and LIKE, which under MySQL's
+ * usual case-insensitive, pad-space collations accept a superset of the
+ * rows PostgreSQL does. Such "loose" conditions must not be negated or
+ * compared further though, since that would turn the superset into a
+ * subset; ordering comparisons of strings aren't pushed at all.
+ */
+typedef struct deparse_expr_cxt
+{
+	RelOptInfo *baserel;		/* the foreign table being planned */
+	Oid			relid;			/* its OID, for looking up column names */
+	MySQLFdwOptions *opts;		/* its options, for connecting to MySQL */
+	MYSQL	   *conn;			/* connection, once needed to escape literals */
+	StringInfo	buf;			/* output buffer */
+	bool		loose;			/* output may accept rows PG rejects */
+	List	   *params;			/* Params sent as placeholders, in order */
+} deparse_expr_cxt;
+
+/*
+ * Operators that mean the same thing in MySQL. Those marked numeric_only
+ * are not pushed for strings, where the collations may disagree, and the
+ * arithmetic ones only for numbers: MySQL would add to a date or timestamp
+ * as if it were a number like 20240131.
+ */
+typedef struct MySQLFdwOperator
+{
+	const char *pgname;
+	const char *mysqlname;
+	bool		numeric_only;
+	bool		loose;			/* string version is only a superset */
+	bool		arithmetic;		/* operands and result must be numbers */
+} MySQLFdwOperator;
+
+static const MySQLFdwOperator pushable_operators[] =
+{
+	{ "=",		"=",		false,	true,	false },
+	{ "<>",		"<>",		true,	false,	false },
+	{ "<",		"<",		true,	false,	false },
+	{ "<=",		"<=",		true,	false,	false },
+	{ ">",		">",		true,	false,	false },
+	{ ">=",		">=",		true,	false,	false },
+	{ "+",		"+",		true,	false,	true },
+	{ "-",		"-",		true,	false,	true },
+	{ "*",		"*",		true,	false,	true },
+	{ "~~",		"LIKE",		false,	true,	false },
+	{ NULL,		NULL,		false,	false,	false }
+};
+
+/*
+ * Immutable functions with a MySQL equivalent, for non-string arguments
+ * unless string_args is set.
+ */
+typedef struct MySQLFdwFunction
+{
+	const char *pgname;
+	const char *mysqlname;
+	int			nargs;
+	bool		string_args;
+} MySQLFdwFunction;
+
+static const MySQLFdwFunction pushable_functions[] =
+{
+	{ "abs",				"ABS",			1,	false },
+	{ "ceil",				"CEIL",			1,	false },
+	{ "ceiling",			"CEILING",		1,	false },
+	{ "floor",				"FLOOR",		1,	false },
+	{ "round",				"ROUND",		1,	false },
+	{ "mod",				"MOD",			2,	false },
+	{ "length",				"CHAR_LENGTH",	1,	true },
+	{ "char_length",		"CHAR_LENGTH",	1,	true },
+	{ "character_length",	"CHAR_LENGTH",	1,	true },
+	{ NULL,					NULL,			0,	false }
+};
+
+static void deparseTargetList(StringInfo buf, Oid relid, RelOptInfo *baserel,
+							  List **retrieved_attrs);
+static bool mysqlAllRowsAggregated(PlannerInfo *root);
+static bool mysqlIsPushableType(Oid type, bool *is_string);
+static bool mysqlIsNumericType(Oid type);
+static bool mysqlIsWideningCast(Oid source, Oid target);
+static bool deparseExpr(Expr *node, deparse_expr_cxt *context);
+static bool deparseExactExpr(Expr *node, deparse_expr_cxt *context);
+static bool deparseVar(Var *node, deparse_expr_cxt *context);
+static bool deparseConstValue(Oid type, Datum value, bool isnull,
+							  deparse_expr_cxt *context);
+static bool deparseParam(Param *node, deparse_expr_cxt *context);
+static bool deparseOpExpr(OpExpr *node, deparse_expr_cxt *context);
+static bool deparseScalarArrayOpExpr(ScalarArrayOpExpr *node,
+									 deparse_expr_cxt *context);
+static bool deparseBoolExpr(BoolExpr *node, deparse_expr_cxt *context);
+static bool deparseFuncExpr(FuncExpr *node, deparse_expr_cxt *context);
+
+/*
+ * mysqlDeparseSelect
+ *		Build the query for a scan of a foreign table, fetching only the
+ *		columns the query uses and adding a WHERE clause for those of the
+ *		restriction clauses that MySQL can evaluate.
+ *
+ * The clauses that were sent are returned in *remote_conds, and the
+ * attribute numbers of the columns fetched, in order, in *retrieved_attrs.
+ * Params in the clauses are sent as ? placeholders, to be bound when the
+ * query is executed; they are returned, in order, in *params.
+ *
+ * A scan that needs no columns at all and feeds only aggregates, as in
+ * SELECT count(*) FROM t WHERE ..., only needs to know how many rows
+ * there are, so it asks MySQL to count them rather than send them;
+ * *count_only is set if so, and the result is a single row holding the
+ * count. Other scans without columns, such as under EXISTS or a LIMIT,
+ * may well stop after a few rows, which COUNT(*) would make MySQL find
+ * all of first, so they fetch rows as usual.
+ *
+ * Tables defined by a query are used as given, since we can't tell how its
+ * columns relate to ours other than by position, unless subquery_pushdown
+ * says that they have the same names. Then the query is treated like a
+ * table, as a derived table in the FROM clause, so that a join or other
+ * query done by MySQL can still have only the rows and columns we need
+ * sent back.
+ */
+void
+mysqlDeparseSelect(StringInfo buf, MySQLFdwOptions *opts, Oid relid,
+				   PlannerInfo *root, RelOptInfo *baserel, List **remote_conds,
+				   List **retrieved_attrs, List **params, bool *count_only)
+{
+	StringInfoData targets;
+	StringInfoData where;
+	StringInfoData from;
+	ListCell   *lc;
+	bool		first = true;
+
+	*remote_conds = NIL;
+	*retrieved_attrs = NIL;
+	*params = NIL;
+	*count_only = false;
+
+	if (opts->query && !opts->subquery_pushdown)
+	{
+		Relation	rel = heap_open(relid, NoLock);
+		TupleDesc	tupdesc = RelationGetDescr(rel);
+		int			i;
+
+		for (i = 0; i < tupdesc->natts; i++)
+		{
+			if (!tupdesc->attrs[i]->attisdropped)
+				*retrieved_attrs = lappend_int(*retrieved_attrs, i + 1);
+		}
+		heap_close(rel, NoLock);
+
+		appendStringInfoString(buf, opts->query);
+		return;
+	}
+
+	initStringInfo(&from);
+	if (opts->query)
+	{
+		int			len = strlen(opts->query);
+
+		/* A trailing semicolon would end the statement early */
+		while (len > 0 && (opts->query[len - 1] == ';' ||
+						   isspace((unsigned char) opts->query[len - 1])))
+			len--;
+		appendStringInfoChar(&from, '(');
+		appendBinaryStringInfo(&from, opts->query, len);
+		appendStringInfoString(&from, ") AS `mysql_fdw_subquery`");
+	}
+	else
+		appendStringInfoString(&from, opts->table);
+
+	initStringInfo(&targets);
+	deparseTargetList(&targets, relid, baserel, retrieved_attrs);
+
+	initStringInfo(&where);
+	foreach(lc, baserel->baserestrictinfo)
+	{
+		RestrictInfo *ri = (RestrictInfo *) lfirst(lc);
+		StringInfoData cond;
+		deparse_expr_cxt context;
+
+		if (!opts->pushdown)
+			break;
+
+		initStringInfo(&cond);
+		context.baserel = baserel;
+		context.relid = relid;
+		context.opts = opts;
+		context.conn = NULL;
+		context.buf = &cond;
+		context.loose = false;
+		context.params = NIL;
+
+		if (deparseExpr(ri->clause, &context))
+		{
+			appendStringInfoString(&where, first ? " WHERE " : " AND ");
+			appendStringInfoString(&where, cond.data);
+			*remote_conds = lappend(*remote_conds, ri);
+			*params = list_concat(*params, context.params);
+			first = false;
+		}
+
+		pfree(cond.data);
+	}
+
+	/*
+	 * Counting needs the statement to return the count, so isn't done for
+	 * the prepared statements that scans with Params use.
+	 */
+	*count_only = (*retrieved_attrs == NIL && *params == NIL &&
+				   mysqlAllRowsAggregated(root));
+
+	appendStringInfo(buf, "SELECT %s FROM %s%s",
+					 *count_only ? "COUNT(*)" : targets.data,
+					 from.data, where.data);
+
+	pfree(from.data);
+	pfree(targets.data);
+	pfree(where.data);
+}
+
+/*
+ * Does every row of the scan go into the query's aggregates? Only if the
+ * query is on this table alone; a LIMIT then applies to the aggregated
+ * rows, not the scan's.
+ */
+static bool
+mysqlAllRowsAggregated(PlannerInfo *root)
+{
+	Query	   *parse = root->parse;
+
+	return parse->commandType == CMD_SELECT &&
+		parse->hasAggs && !parse->hasWindowFuncs &&
+		!parse->setOperations &&
+		list_length(parse->rtable) == 1;
+}
+
+/*
+ * Emit the list of columns that the scan has to return: those in the
+ * relation's target list, and those used by any of its quals, since the
+ * executor checks them all locally.
+ */
+static void
+deparseTargetList(StringInfo buf, Oid relid, RelOptInfo *baserel,
+				  List **retrieved_attrs)
+{
+	Bitmapset  *attrs_used = NULL;
+	bool		have_wholerow;
+	Relation	rel;
+	TupleDesc	tupdesc;
+	ListCell   *lc;
+	bool		first = true;
+	int			i;
+
+	pull_varattnos((Node *) baserel->reltargetlist, &attrs_used);
+	foreach(lc, baserel->baserestrictinfo)
+	{
+		RestrictInfo *ri = (RestrictInfo *) lfirst(lc);
+
+		pull_varattnos((Node *) ri->clause, &attrs_used);
+	}
+
+	/* A whole-row reference needs every column */
+	have_wholerow = bms_is_member(0 - FirstLowInvalidHeapAttributeNumber,
+								  attrs_used);
+
+	rel = heap_open(relid, NoLock);
+	tupdesc = RelationGetDescr(rel);
+
+	for (i = 1; i <= tupdesc->natts; i++)
+	{
+		Form_pg_attribute attr = tupdesc->attrs[i - 1];
+
+		if (attr->attisdropped)
+			continue;
+
+		if (have_wholerow ||
+			bms_is_member(i - FirstLowInvalidHeapAttributeNumber, attrs_used))
+		{
+			if (!first)
+				appendStringInfoString(buf, ", ");
+			mysqlQuoteIdentifier(buf, NameStr(attr->attname));
+			*retrieved_attrs = lappend_int(*retrieved_attrs, i);
+			first = false;
+		}
+	}
+
+	heap_close(rel, NoLock);
+
+	/* Something like count(*) needs rows, but no columns */
+	if (first)
+		appendStringInfoString(buf, "NULL");
+}
+
+/*
+ * mysqlDeparseOrderLimit
+ *		Append ORDER BY and LIMIT clauses to the query of a scan, if the
+ *		query it is part of has them and it is safe for MySQL to apply them
+ *		too, returning the number of rows MySQL is limited to, or 0 if
+ *		nothing was added.
+ *
+ * PostgreSQL still sorts and limits the rows we return, but MySQL can
+ * often get the first rows from an index, and the rest are never sent.
+ * That is only safe if the rows MySQL picks are the ones PostgreSQL
+ * would: the query must be on this table alone, with no grouping or the
+ * like between the scan and the LIMIT, every qual must be evaluated by
+ * MySQL exactly, and the sort keys must be columns of types that MySQL
+ * orders the same way.
+ */
+double
+mysqlDeparseOrderLimit(StringInfo buf, MySQLFdwOptions *opts, Oid relid,
+					   PlannerInfo *root, RelOptInfo *baserel)
+{
+	Query	   *parse = root->parse;
+	StringInfoData order;
+	double		limit;
+	Const	   *c;
+	ListCell   *lc;
+	bool		first = true;
+
+	if (opts->query && !opts->subquery_pushdown)
+		return 0;
+
+	if (parse->commandType != CMD_SELECT ||
+		list_length(parse->rtable) != 1 ||
+		parse->hasAggs || parse->hasWindowFuncs ||
+		parse->groupClause || parse->havingQual ||
+		parse->distinctClause || parse->setOperations ||
+		expression_returns_set((Node *) parse->targetList))
+		return 0;
+
+	/* We need a constant LIMIT, and OFFSET if any */
+	if (!parse->limitCount || !IsA(parse->limitCount, Const))
+		return 0;
+	c = (Const *) parse->limitCount;
+	if (c->constisnull)
+		return 0;
+	limit = (double) DatumGetInt64(c->constvalue);
+
+	if (parse->limitOffset)
+	{
+		if (!IsA(parse->limitOffset, Const))
+			return 0;
+		c = (Const *) parse->limitOffset;
+		if (!c->constisnull)
+			limit += (double) DatumGetInt64(c->constvalue);
+	}
+
+	/* Check that MySQL evaluates all of the quals, and exactly */
+	if (!opts->pushdown && baserel->baserestrictinfo != NIL)
+		return 0;
+	foreach(lc, baserel->baserestrictinfo)
+	{
+		RestrictInfo *ri = (RestrictInfo *) lfirst(lc);
+		StringInfoData cond;
+		deparse_expr_cxt context;
+		bool		ok;
+
+		initStringInfo(&cond);
+		context.baserel = baserel;
+		context.relid = relid;
+		context.opts = opts;
+		context.conn = NULL;
+		context.buf = &cond;
+		context.loose = false;
+		context.params = NIL;
+
+		ok = deparseExpr(ri->clause, &context) && !context.loose;
+		pfree(cond.data);
+		if (!ok)
+			return 0;
+	}
+
+	initStringInfo(&order);
+	foreach(lc, parse->sortClause)
+	{
+		SortGroupClause *sgc = (SortGroupClause *) lfirst(lc);
+		Node	   *expr = get_sortgroupclause_expr(sgc, parse->targetList);
+		Var		   *var;
+		TypeCacheEntry *typentry;
+		bool		is_string;
+		bool		desc;
+		char	   *colname;
+
+		if (IsA(expr, RelabelType))
+			expr = (Node *) ((RelabelType *) expr)->arg;
+		if (!IsA(expr, Var))
+			return 0;
+
+		var = (Var *) expr;
+		if (var->varno != baserel->relid || var->varlevelsup != 0 ||
+			var->varattno <= 0)
+			return 0;
+
+		/* Strings may sort differently under MySQL's collations */
+		if (!mysqlIsPushableType(var->vartype, &is_string) || is_string)
+			return 0;
+
+		/* Only the type's usual ordering, ascending or descending */
+		typentry = lookup_type_cache(var->vartype,
+									 TYPECACHE_LT_OPR | TYPECACHE_GT_OPR);
+		if (sgc->sortop == typentry->lt_opr)
+			desc = false;
+		else if (sgc->sortop == typentry->gt_opr)
+			desc = true;
+		else
+			return 0;
+
+		/* MySQL sorts NULLs as the lowest values, so say where they go */
+		colname = get_relid_attribute_name(relid, var->varattno);
+		appendStringInfoString(&order, first ? " ORDER BY " : ", ");
+		mysqlQuoteIdentifier(&order, colname);
+		appendStringInfoString(&order, sgc->nulls_first ? " IS NULL DESC, " :
+							   " IS NULL, ");
+		mysqlQuoteIdentifier(&order, colname);
+		if (desc)
+			appendStringInfoString(&order, " DESC");
+		first = false;
+	}
+
+	limit = Max(limit, 0);
+	appendStringInfo(buf, "%s LIMIT %.0f", order.data, limit);
+	pfree(order.data);
+
+	return Max(limit, 1);
+}
+
+/*
+ * Append a column or table name, quoted for MySQL.
+ */
+void
+mysqlQuoteIdentifier(StringInfo buf, const char *ident)
+{
+	const char *p;
+
+	appendStringInfoChar(buf, '`');
+	for (p = ident; *p; p++)
+	{
+		if (*p == '`')
+			appendStringInfoChar(buf, '`');
+		appendStringInfoChar(buf, *p);
+	}
+	appendStringInfoChar(buf, '`');
+}
+
+/*
+ * Types whose values and comparisons we know how to send to MySQL.
+ *
+ * Not real: MySQL compares a FLOAT column as a double, so a constant such
+ * as 1.1 doesn't match the rows that equal it in single precision, and
+ * rows MySQL drops can't be brought back by our recheck.
+ */
+static bool
+mysqlIsPushableType(Oid type, bool *is_string)
+{
+	*is_string = false;
+
+	switch (type)
+	{
+		case BOOLOID:
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case FLOAT8OID:
+		case NUMERICOID:
+		case DATEOID:
+		case TIMESTAMPOID:
+			return true;
+
+		case TEXTOID:
+		case VARCHAROID:
+		case BPCHAROID:
+			*is_string = true;
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+/*
+ * Types that MySQL does arithmetic on the same way we do.
+ */
+static bool
+mysqlIsNumericType(Oid type)
+{
+	switch (type)
+	{
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case FLOAT8OID:
+		case NUMERICOID:
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+/*
+ * Casts that can't change the outcome of a comparison, so MySQL can do
+ * without them.
+ */
+static bool
+mysqlIsWideningCast(Oid source, Oid target)
+{
+	switch (source)
+	{
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+			return target == INT4OID || target == INT8OID ||
+				target == NUMERICOID || target == FLOAT8OID;
+
+		case VARCHAROID:
+		case BPCHAROID:
+			return target == TEXTOID;
+
+		default:
+			return false;
+	}
+}
+
+/*
+ * Deparse an expression into context->buf, returning false if any part of
+ * it can't be sent to MySQL. context->loose is set if the result may accept
+ * more rows than PostgreSQL would.
+ */
+static bool
+deparseExpr(Expr *node, deparse_expr_cxt *context)
+{
+	if (node == NULL)
+		return false;
+
+	switch (nodeTag(node))
+	{
+		case T_Var:
+			return deparseVar((Var *) node, context);
+
+		case T_Const:
+			{
+				Const	   *c = (Const *) node;
+
+				return deparseConstValue(c->consttype, c->constvalue,
+										 c->constisnull, context);
+			}
+
+		case T_Param:
+			return deparseParam((Param *) node, context);
+
+		case T_OpExpr:
+			return deparseOpExpr((OpExpr *) node, context);
+
+		case T_ScalarArrayOpExpr:
+			return deparseScalarArrayOpExpr((ScalarArrayOpExpr *) node,
+											context);
+
+		case T_BoolExpr:
+			return deparseBoolExpr((BoolExpr *) node, context);
+
+		case T_NullTest:
+			{
+				NullTest   *nt = (NullTest *) node;
+
+				if (nt->argisrow)
+					return false;
+
+				appendStringInfoChar(context->buf, '(');
+				if (!deparseExactExpr(nt->arg, context))
+					return false;
+				if (nt->nulltesttype == IS_NULL)
+					appendStringInfoString(context->buf, " IS NULL)");
+				else
+					appendStringInfoString(context->buf, " IS NOT NULL)");
+				return true;
+			}
+
+		case T_RelabelType:
+			return deparseExpr(((RelabelType *) node)->arg, context);
+
+		case T_FuncExpr:
+			return deparseFuncExpr((FuncExpr *) node, context);
+
+		default:
+			return false;
+	}
+}
+
+/*
+ * Deparse an expression whose result must be exactly what PostgreSQL would
+ * compute, because it is negated or used as an operand.
+ */
+static bool
+deparseExactExpr(Expr *node, deparse_expr_cxt *context)
+{
+	bool		loose = context->loose;
+
+	context->loose = false;
+	if (!deparseExpr(node, context) || context->loose)
+		return false;
+	context->loose = loose;
+
+	return true;
+}
+
+/*
+ * A column of the foreign table, sent by name.
+ */
+static bool
+deparseVar(Var *node, deparse_expr_cxt *context)
+{
+	bool		is_string;
+
+	if (node->varno != context->baserel->relid || node->varlevelsup != 0)
+		return false;
+
+	/* System columns and whole-row references have no MySQL equivalent */
+	if (node->varattno <= 0)
+		return false;
+
+	if (!mysqlIsPushableType(node->vartype, &is_string))
+		return false;
+
+	mysqlQuoteIdentifier(context->buf,
+						 get_relid_attribute_name(context->relid,
+												  node->varattno));
+	return true;
+}
+
+/*
+ * A literal value. Dates and floats are printed in a style MySQL reads
+ * back exactly, whatever the session settings are.
+ */
+static bool
+deparseConstValue(Oid type, Datum value, bool isnull,
+				  deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	bool		is_string;
+	Oid			typoutput;
+	bool		typIsVarlena;
+	char	   *extval;
+
+	if (!mysqlIsPushableType(type, &is_string))
+		return false;
+
+	if (isnull)
+	{
+		appendStringInfoString(buf, "NULL");
+		return true;
+	}
+
+	switch (type)
+	{
+		case BOOLOID:
+			appendStringInfoString(buf, DatumGetBool(value) ? "TRUE" : "FALSE");
+			return true;
+
+		case DATEOID:
+			if (DATE_NOT_FINITE(DatumGetDateADT(value)))
+				return false;
+			break;
+
+		case TIMESTAMPOID:
+			if (TIMESTAMP_NOT_FINITE(DatumGetTimestamp(value)))
+				return false;
+			break;
+
+		default:
+			break;
+	}
+
+	getTypeOutputInfo(type, &typoutput, &typIsVarlena);
+
+	if (type == DATEOID || type == TIMESTAMPOID || type == FLOAT8OID)
+	{
+		int			save_datestyle = DateStyle;
+		int			save_float_digits = extra_float_digits;
+
+		DateStyle = USE_ISO_DATES;
+		extra_float_digits = 3;
+		PG_TRY();
+		{
+			extval = OidOutputFunctionCall(typoutput, value);
+		}
+		PG_CATCH();
+		{
+			DateStyle = save_datestyle;
+			extra_float_digits = save_float_digits;
+			PG_RE_THROW();
+		}
+		PG_END_TRY();
+		DateStyle = save_datestyle;
+		extra_float_digits = save_float_digits;
+	}
+	else
+		extval = OidOutputFunctionCall(typoutput, value);
+
+	switch (type)
+	{
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case FLOAT8OID:
+		case NUMERICOID:
+			/* MySQL has no NaN or infinity */
+			if (strspn(extval, "0123456789+-.eE") != strlen(extval))
+				return false;
+			/* Parenthesize negative values, "--" starts a comment */
+			if (extval[0] == '-')
+				appendStringInfo(buf, "(%s)", extval);
+			else
+				appendStringInfoString(buf, extval);
+			break;
+
+		case DATEOID:
+		case TIMESTAMPOID:
+			/* MySQL has no BC dates */
+			if (strstr(extval, "BC") != NULL)
+				return false;
+			appendStringInfoChar(buf, '\'');
+			appendStringInfoString(buf, extval);
+			appendStringInfoChar(buf, '\'');
+			break;
+
+		default:
+			/* Only escaping strings needs a connection, so connect lazily */
+			if (context->conn == NULL)
+				context->conn = mysqlGetConnection(context->opts, false);
+			mysqlDeparseStringLiteral(buf, extval, context->conn);
+			break;
+	}
+
+	pfree(extval);
+	return true;
+}
+
+/*
+ * An operator from pushable_operators, with operands of pushable types.
+ */
+static bool
+deparseOpExpr(OpExpr *node, deparse_expr_cxt *context)
+{
+	const MySQLFdwOperator *op;
+	char	   *opname;
+	ListCell   *lc;
+	bool		is_string = false;
+
+	/* Only built-in operators, users can redefine the rest */
+	if (node->opno >= FirstNormalObjectId)
+		return false;
+
+	foreach(lc, node->args)
+	{
+		bool		arg_is_string;
+
+		if (!mysqlIsPushableType(exprType((Node *) lfirst(lc)), &arg_is_string))
+			return false;
+		is_string |= arg_is_string;
+	}
+
+	opname = get_opname(node->opno);
+	for (op = pushable_operators; op->pgname; op++)
+	{
+		if (strcmp(op->pgname, opname) == 0)
+			break;
+	}
+	if (!op->pgname)
+		return false;
+
+	if (is_string && op->numeric_only)
+		return false;
+	if (!is_string && strcmp(op->pgname, "~~") == 0)
+		return false;
+	if (op->arithmetic)
+	{
+		if (!mysqlIsNumericType(node->opresulttype))
+			return false;
+		foreach(lc, node->args)
+		{
+			if (!mysqlIsNumericType(exprType((Node *) lfirst(lc))))
+				return false;
+		}
+	}
+
+	appendStringInfoChar(context->buf, '(');
+	if (list_length(node->args) == 2)
+	{
+		if (!deparseExactExpr(linitial(node->args), context))
+			return false;
+		appendStringInfo(context->buf, " %s ", op->mysqlname);
+		if (!deparseExactExpr(lsecond(node->args), context))
+			return false;
+	}
+	else if (list_length(node->args) == 1 && strcmp(op->pgname, "-") == 0)
+	{
+		/* Prefix minus, the only unary operator we push */
+		appendStringInfo(context->buf, "%s ", op->mysqlname);
+		if (!deparseExactExpr(linitial(node->args), context))
+			return false;
+	}
+	else
+		return false;
+	appendStringInfoChar(context->buf, ')');
+
+	if (is_string && op->loose)
+		context->loose = true;
+
+	return true;
+}
+
+/*
+ * "expr = ANY (array)" becomes "expr IN (...)", and "expr <> ALL (array)"
+ * becomes "expr NOT IN (...)" where negation is safe.
+ */
+static bool
+deparseScalarArrayOpExpr(ScalarArrayOpExpr *node, deparse_expr_cxt *context)
+{
+	Expr	   *arg1 = linitial(node->args);
+	Expr	   *arg2 = lsecond(node->args);
+	char	   *opname;
+	bool		is_string;
+	bool		first = true;
+
+	if (node->opno >= FirstNormalObjectId)
+		return false;
+
+	if (!mysqlIsPushableType(exprType((Node *) arg1), &is_string))
+		return false;
+
+	opname = get_opname(node->opno);
+	if (node->useOr && strcmp(opname, "=") == 0)
+		;
+	else if (!node->useOr && strcmp(opname, "<>") == 0 && !is_string)
+		;
+	else
+		return false;
+
+	appendStringInfoChar(context->buf, '(');
+	if (!deparseExactExpr(arg1, context))
+		return false;
+	appendStringInfoString(context->buf, node->useOr ? " IN (" : " NOT IN (");
+
+	if (IsA(arg2, Const))
+	{
+		Const	   *c = (Const *) arg2;
+		ArrayType  *arr;
+		Oid			elemtype;
+		int16		elmlen;
+		bool		elmbyval;
+		char		elmalign;
+		Datum	   *elem_values;
+		bool	   *elem_nulls;
+		int			num_elems;
+		int			i;
+
+		if (c->constisnull)
+			return false;
+
+		arr = DatumGetArrayTypeP(c->constvalue);
+		elemtype = ARR_ELEMTYPE(arr);
+		get_typlenbyvalalign(elemtype, &elmlen, &elmbyval, &elmalign);
+		deconstruct_array(arr, elemtype, elmlen, elmbyval, elmalign,
+						  &elem_values, &elem_nulls, &num_elems);
+
+		for (i = 0; i < num_elems; i++)
+		{
+			if (!first)
+				appendStringInfoString(context->buf, ", ");
+			if (!deparseConstValue(elemtype, elem_values[i], elem_nulls[i],
+								   context))
+				return false;
+			first = false;
+		}
+	}
+	else if (IsA(arg2, ArrayExpr))
+	{
+		ListCell   *lc;
+
+		foreach(lc, ((ArrayExpr *) arg2)->elements)
+		{
+			if (!first)
+				appendStringInfoString(context->buf, ", ");
+			if (!deparseExactExpr((Expr *) lfirst(lc), context))
+				return false;
+			first = false;
+		}
+	}
+	else
+		return false;
+
+	/* MySQL doesn't accept an empty list */
+	if (first)
+		return false;
+
+	appendStringInfoString(context->buf, "))");
+
+	if (is_string)
+		context->loose = true;
+
+	return true;
+}
+
+/*
+ * AND and OR keep the looseness of their arguments, NOT needs exact ones.
+ */
+static bool
+deparseBoolExpr(BoolExpr *node, deparse_expr_cxt *context)
+{
+	const char *op;
+	ListCell   *lc;
+	bool		first = true;
+
+	switch (node->boolop)
+	{
+		case AND_EXPR:
+			op = " AND ";
+			break;
+		case OR_EXPR:
+			op = " OR ";
+			break;
+		case NOT_EXPR:
+			appendStringInfoString(context->buf, "(NOT ");
+			if (!deparseExactExpr(linitial(node->args), context))
+				return false;
+			appendStringInfoChar(context->buf, ')');
+			return true;
+		default:
+			return false;
+	}
+
+	appendStringInfoChar(context->buf, '(');
+	foreach(lc, node->args)
+	{
+		if (!first)
+			appendStringInfoString(context->buf, op);
+		if (!deparseExpr((Expr *) lfirst(lc), context))
+			return false;
+		first = false;
+	}
+	appendStringInfoChar(context->buf, ')');
+
+	return true;
+}
+
+/*
+ * Widening casts are left to MySQL, and a few immutable functions are sent
+ * under their MySQL names.
+ */
+static bool
+deparseFuncExpr(FuncExpr *node, deparse_expr_cxt *context)
+{
+	const MySQLFdwFunction *func;
+	char	   *funcname;
+	ListCell   *lc;
+	bool		is_string;
+	bool		first = true;
+
+	if (node->funcformat == COERCE_IMPLICIT_CAST ||
+		node->funcformat == COERCE_EXPLICIT_CAST)
+	{
+		Expr	   *arg = linitial(node->args);
+
+		if (!mysqlIsWideningCast(exprType((Node *) arg), node->funcresulttype))
+			return false;
+		return deparseExactExpr(arg, context);
+	}
+
+	if (node->funcformat != COERCE_EXPLICIT_CALL)
+		return false;
+
+	if (node->funcid >= FirstNormalObjectId ||
+		func_volatile(node->funcid) != PROVOLATILE_IMMUTABLE)
+		return false;
+
+	if (!mysqlIsPushableType(node->funcresulttype, &is_string) || is_string)
+		return false;
+
+	funcname = get_func_name(node->funcid);
+	for (func = pushable_functions; func->pgname; func++)
+	{
+		if (strcmp(func->pgname, funcname) == 0 &&
+			func->nargs == list_length(node->args))
+			break;
+	}
+	if (!func->pgname)
+		return false;
+
+	foreach(lc, node->args)
+	{
+		if (!mysqlIsPushableType(exprType((Node *) lfirst(lc)), &is_string) ||
+			is_string != func->string_args)
+			return false;
+	}
+
+	appendStringInfo(context->buf, "%s(", func->mysqlname);
+	foreach(lc, node->args)
+	{
+		if (!first)
+			appendStringInfoString(context->buf, ", ");
+		if (!deparseExactExpr((Expr *) lfirst(lc), context))
+			return false;
+		first = false;
+	}
+	appendStringInfoChar(context->buf, ')');
+
+	return true;
+}
+
+/*
+ * A parameter, such as a column of the outer query in a correlated
+ * subquery, or an argument of a prepared statement or PL/pgSQL function.
+ * It is sent as a placeholder and bound when the query is executed, so
+ * that the statement can be run again with new values on a rescan.
+ *
+ * Only types whose values MySQL can always represent are sent, since we
+ * can't check the value here as we do for constants.
+ */
+static bool
+deparseParam(Param *node, deparse_expr_cxt *context)
+{
+	if (node->paramkind != PARAM_EXTERN && node->paramkind != PARAM_EXEC)
+		return false;
+
+	switch (node->paramtype)
+	{
+		case BOOLOID:
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case TEXTOID:
+		case VARCHAROID:
+		case BPCHAROID:
+			break;
+
+		default:
+			return false;
+	}
+
+	appendStringInfoChar(context->buf, '?');
+	context->params = lappend(context->params, node);
+	return true;
+}
+
+/*
+ * mysqlDeparseLiteral
+ *		Append a value to be stored in MySQL. Values of types we don't
+ *		otherwise handle are sent as strings, for MySQL to convert.
+ */
+void
+mysqlDeparseLiteral(StringInfo buf, Oid type, Datum value, bool isnull,
+					MYSQL *conn)
+{
+	deparse_expr_cxt context;
+	bool		is_string;
+
+	if (isnull)
+	{
+		appendStringInfoString(buf, "NULL");
+		return;
+	}
+
+	/*
+	 * A real is sent as the double it widens to exactly, which is what
+	 * MySQL compares a FLOAT column as, and rounds back to the same real.
+	 */
+	if (type == FLOAT4OID)
+	{
+		value = Float8GetDatum((float8) DatumGetFloat4(value));
+		type = FLOAT8OID;
+	}
+
+	if (!mysqlIsPushableType(type, &is_string))
+	{
+		Oid			typoutput;
+		bool		typIsVarlena;
+		char	   *extval;
+
+		getTypeOutputInfo(type, &typoutput, &typIsVarlena);
+		extval = OidOutputFunctionCall(typoutput, value);
+		mysqlDeparseStringLiteral(buf, extval, conn);
+		pfree(extval);
+		return;
+	}
+
+	memset(&context, 0, sizeof(context));
+	context.buf = buf;
+	context.conn = conn;
+
+	if (!deparseConstValue(type, value, false, &context))
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+				 errmsg("value of type %s cannot be stored in MySQL",
+						format_type_be(type)),
+				 errdetail("MySQL has no NaN, infinite or BC values.")));
+}
+
+/*
+ * mysqlDeparseStringLiteral
+ *		Append a string literal, escaped for the connection's character set
+ *		and SQL mode.
+ */
+void
+mysqlDeparseStringLiteral(StringInfo buf, const char *val, MYSQL *conn)
+{
+	unsigned long len = strlen(val);
+	char	   *escaped = palloc(len * 2 + 1);
+
+	mysql_real_escape_string(conn, escaped, val, len);
+
+	appendStringInfoChar(buf, '\'');
+	appendStringInfoString(buf, escaped);
+	appendStringInfoChar(buf, '\'');
+
+	pfree(escaped);
+}
@@ -0,0 +1,630 @@
+/*-------------------------------------------------------------------------
+ *
+ *		  foreign-data wrapper for MySQL
+ *
+ * Copyright (c) 2011, PostgreSQL Global Development Group
+ *
+ * This software is released under the PostgreSQL Licence
+ *
+ * Author: Dave Page <dpage@pgadmin.org>
+ *
+ * IDENTIFICATION
+ *		  mysql_fdw/materialize.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "mysql_fdw.h"
+
+#include "access/heapam.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "miscadmin.h"
+#include "optimizer/plancat.h"
+#include "utils/acl.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/snapmgr.h"
+#include "utils/timestamp.h"
+
+/*
+ * Materialized foreign tables.
+ *
+ * A foreign table with the materialize option has a local copy, a regular
+ * table with the same column names, which mysql_fdw_refresh() fills from
+ * MySQL. Once it has been refreshed, and for as long as it's no older than
+ * max_staleness, scans read the copy instead of MySQL.
+ *
+ * With watermark_column set, a refresh only fetches the rows whose
+ * watermark has advanced since the last one, replacing the old versions
+ * of rows, found by key_column, if that's set. Otherwise the copy is
+ * emptied and fetched again in full.
+ *
+ * When each foreign table was last refreshed is recorded in the
+ * extension's mysql_fdw_snapshots table.
+ */
+
+struct MySQLFdwLocalScan
+{
+	Relation	rel;			/* the local copy */
+	HeapScanDesc scan;
+	AttrNumber *map;			/* its attnum for each of ours, or 0 */
+	int			natts;			/* of the foreign table */
+	Datum	   *values;			/* of a local row */
+	bool	   *nulls;
+};
+
+PG_FUNCTION_INFO_V1(mysql_fdw_refresh);
+
+static Oid	mysqlSnapshotRelid(MySQLFdwOptions *opts, bool missing_ok);
+static char *mysqlSnapshotsTable(Oid *owner);
+static char *mysqlQualifiedRelName(Oid relid);
+static void mysqlRecordRefresh(Oid relid);
+
+/*
+ * mysqlGetSnapshot
+ *		Return the OID of a foreign table's local copy, if it has one that
+ *		scans by the current user may read instead of MySQL, otherwise
+ *		InvalidOid.
+ */
+Oid
+mysqlGetSnapshot(Oid relid, MySQLFdwOptions *opts)
+{
+	Oid			localrelid;
+	Oid			argtypes[1] = {REGCLASSOID};
+	Datum		args[1];
+	StringInfoData query;
+	bool		usable = false;
+
+	if (!opts->materialize)
+		return InvalidOid;
+
+	/* If they can't read the copy, they'll have to read MySQL */
+	localrelid = mysqlSnapshotRelid(opts, true);
+	if (!OidIsValid(localrelid) ||
+		pg_class_aclcheck(localrelid, GetUserId(), ACL_SELECT) != ACLCHECK_OK)
+		return InvalidOid;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	initStringInfo(&query);
+	appendStringInfo(&query, "SELECT refreshed FROM %s WHERE relid = $1",
+					 mysqlSnapshotsTable(NULL));
+
+	args[0] = ObjectIdGetDatum(relid);
+	if (SPI_execute_with_args(query.data, 1, argtypes, args, NULL,
+							  true, 1) != SPI_OK_SELECT)
+		elog(ERROR, "failed to look up when \"%s\" was refreshed",
+			 get_rel_name(relid));
+
+	if (SPI_processed > 0)
+	{
+		bool		isnull;
+		Datum		refreshed;
+
+		refreshed = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc,
+								  1, &isnull);
+		usable = !isnull &&
+			(opts->max_staleness < 0 ||
+			 !TimestampDifferenceExceeds(DatumGetTimestampTz(refreshed),
+										 GetCurrentTimestamp(),
+										 opts->max_staleness * 1000));
+	}
+
+	SPI_finish();
+
+	return usable ? localrelid : InvalidOid;
+}
+
+/*
+ * mysqlSnapshotSize
+ *		Estimate the size of a local copy, as the planner would.
+ */
+void
+mysqlSnapshotSize(Oid localrelid, BlockNumber *pages, double *tuples)
+{
+	Relation	rel = heap_open(localrelid, AccessShareLock);
+
+	estimate_rel_size(rel, NULL, pages, tuples);
+
+	heap_close(rel, AccessShareLock);
+}
+
+/*
+ * mysqlLocalScanBegin
+ *		Start a scan of a local copy, returning rows shaped like the given
+ *		foreign table's.
+ */
+MySQLFdwLocalScan *
+mysqlLocalScanBegin(Oid localrelid, TupleDesc tupdesc)
+{
+	MySQLFdwLocalScan *ls;
+	TupleDesc	localdesc;
+	int			i;
+
+	ls = (MySQLFdwLocalScan *) palloc0(sizeof(MySQLFdwLocalScan));
+	ls->rel = heap_open(localrelid, AccessShareLock);
+	localdesc = RelationGetDescr(ls->rel);
+
+	ls->natts = tupdesc->natts;
+	ls->map = (AttrNumber *) palloc0(Max(tupdesc->natts, 1) * sizeof(AttrNumber));
+	ls->values = (Datum *) palloc(Max(localdesc->natts, 1) * sizeof(Datum));
+	ls->nulls = (bool *) palloc(Max(localdesc->natts, 1) * sizeof(bool));
+
+	/* Match the columns by name; any missing from the copy are NULL */
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		Form_pg_attribute attr = tupdesc->attrs[i];
+		AttrNumber	localattnum;
+
+		if (attr->attisdropped)
+			continue;
+
+		localattnum = get_attnum(localrelid, NameStr(attr->attname));
+		if (localattnum <= 0)
+			continue;
+
+		if (localdesc->attrs[localattnum - 1]->atttypid != attr->atttypid)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATATYPE_MISMATCH),
+					 errmsg("column \"%s\" of \"%s\" is of type %s, but the foreign table's is of type %s",
+							NameStr(attr->attname),
+							RelationGetRelationName(ls->rel),
+							format_type_be(localdesc->attrs[localattnum - 1]->atttypid),
+							format_type_be(attr->atttypid))));
+
+		ls->map[i] = localattnum;
+	}
+
+	ls->scan = heap_beginscan(ls->rel, GetActiveSnapshot(), 0, NULL);
+
+	return ls;
+}
+
+/*
+ * mysqlLocalScanNext
+ *		Fetch the next row of the copy into the given arrays, which must be
+ *		sized for the foreign table. Returns false at the end.
+ *
+ * The values point into the row, which stays valid until the next call.
+ */
+bool
+mysqlLocalScanNext(MySQLFdwLocalScan *ls, Datum *values, bool *nulls)
+{
+	HeapTuple	tuple;
+	int			i;
+
+	tuple = heap_getnext(ls->scan, ForwardScanDirection);
+	if (tuple == NULL)
+		return false;
+
+	heap_deform_tuple(tuple, RelationGetDescr(ls->rel), ls->values, ls->nulls);
+
+	for (i = 0; i < ls->natts; i++)
+	{
+		if (ls->map[i] == 0)
+		{
+			nulls[i] = true;
+			continue;
+		}
+		values[i] = ls->values[ls->map[i] - 1];
+		nulls[i] = ls->nulls[ls->map[i] - 1];
+	}
+
+	return true;
+}
+
+/*
+ * mysqlLocalScanRescan
+ *		Go back to the start of the copy.
+ */
+void
+mysqlLocalScanRescan(MySQLFdwLocalScan *ls)
+{
+	heap_rescan(ls->scan, NULL);
+}
+
+/*
+ * mysqlLocalScanEnd
+ *		Finish scanning the copy.
+ */
+void
+mysqlLocalScanEnd(MySQLFdwLocalScan *ls)
+{
+	heap_endscan(ls->scan);
+	heap_close(ls->rel, AccessShareLock);
+}
+
+/*
+ * mysqlLocalScanRelName
+ *		Return the name of the copy being scanned, for EXPLAIN.
+ */
+char *
+mysqlLocalScanRelName(MySQLFdwLocalScan *ls)
+{
+	return mysqlQualifiedRelName(RelationGetRelid(ls->rel));
+}
+
+/*
+ * mysql_fdw_refresh
+ *		Bring a foreign table's local copy up to date, and return the
+ *		number of rows fetched from MySQL.
+ */
+Datum
+mysql_fdw_refresh(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	MySQLFdwOptions opts;
+	Relation	rel;
+	TupleDesc	tupdesc;
+	Oid			localrelid;
+	char	   *localname;
+	int		   *attnums;
+	Oid		   *argtypes;
+	Datum	   *args;
+	char	   *argnulls;
+	int			num_attrs = 0;
+	int			keyarg = -1;
+	AttrNumber	wmattnum = InvalidAttrNumber;
+	Datum		watermark = (Datum) 0;
+	bool		have_watermark = false;
+	StringInfoData remote;
+	StringInfoData insert;
+	StringInfoData values;
+	StringInfoData lock;
+	SPIPlanPtr	insplan;
+	SPIPlanPtr	delplan = NULL;
+	MYSQL	   *conn;
+	MYSQL_RES  *result;
+	MYSQL_ROW	row;
+	MySQLFdwConverter *conv;
+	Datum	   *rowvalues;
+	bool	   *rownulls;
+	MemoryContext rowcxt;
+	int64		count = 0;
+	int			i;
+
+	if (get_rel_relkind(relid) != RELKIND_FOREIGN_TABLE)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not a foreign table",
+						get_rel_name(relid))));
+
+	if (!pg_class_ownercheck(relid, GetUserId()))
+		aclcheck_error(ACLCHECK_NOT_OWNER, ACL_KIND_CLASS,
+					   get_rel_name(relid));
+
+	mysqlGetOptions(relid, &opts);
+
+	if (!opts.materialize || !opts.table)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_OPTION_NAME_NOT_FOUND),
+				 errmsg("foreign table \"%s\" must have the table and materialize options to be refreshed",
+						get_rel_name(relid))));
+
+	localrelid = mysqlSnapshotRelid(&opts, false);
+	localname = mysqlQualifiedRelName(localrelid);
+
+	rel = heap_open(relid, AccessShareLock);
+	tupdesc = RelationGetDescr(rel);
+
+	attnums = (int *) palloc(Max(tupdesc->natts, 1) * sizeof(int));
+	argtypes = (Oid *) palloc(Max(tupdesc->natts, 1) * sizeof(Oid));
+	args = (Datum *) palloc(Max(tupdesc->natts, 1) * sizeof(Datum));
+	argnulls = (char *) palloc(Max(tupdesc->natts, 1) * sizeof(char));
+	rowvalues = (Datum *) palloc(Max(tupdesc->natts, 1) * sizeof(Datum));
+	rownulls = (bool *) palloc(Max(tupdesc->natts, 1) * sizeof(bool));
+
+	/* Copy every column, by name, into a parameter of the INSERT */
+	initStringInfo(&remote);
+	initStringInfo(&insert);
+	initStringInfo(&values);
+	appendStringInfoString(&remote, "SELECT ");
+	appendStringInfo(&insert, "INSERT INTO %s (", localname);
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		Form_pg_attribute attr = tupdesc->attrs[i];
+		const char *attname = NameStr(attr->attname);
+
+		if (attr->attisdropped)
+			continue;
+
+		if (num_attrs > 0)
+		{
+			appendStringInfoString(&remote, ", ");
+			appendStringInfoString(&insert, ", ");
+			appendStringInfoString(&values, ", ");
+		}
+		mysqlQuoteIdentifier(&remote, attname);
+		appendStringInfoString(&insert, quote_identifier(attname));
+		appendStringInfo(&values, "$%d", num_attrs + 1);
+
+		if (opts.key_column && strcmp(attname, opts.key_column) == 0)
+			keyarg = num_attrs;
+		if (opts.watermark_column && strcmp(attname, opts.watermark_column) == 0)
+			wmattnum = attr->attnum;
+
+		attnums[num_attrs] = attr->attnum;
+		argtypes[num_attrs] = attr->atttypid;
+		num_attrs++;
+	}
+	appendStringInfo(&remote, " FROM %s", opts.table);
+	appendStringInfo(&insert, ") VALUES (%s)", values.data);
+
+	if (num_attrs == 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("foreign table \"%s\" has no columns",
+						get_rel_name(relid))));
+	if (opts.watermark_column && wmattnum == InvalidAttrNumber)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_COLUMN),
+				 errmsg("watermark column \"%s\" of foreign table \"%s\" does not exist",
+						opts.watermark_column, get_rel_name(relid))));
+	if (opts.watermark_column && opts.key_column && keyarg < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_COLUMN),
+				 errmsg("key column \"%s\" of foreign table \"%s\" does not exist",
+						opts.key_column, get_rel_name(relid))));
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	/*
+	 * Refreshes of the same copy must run one at a time, or both would copy
+	 * the rows beyond the same watermark. Readers aren't blocked.
+	 */
+	initStringInfo(&lock);
+	appendStringInfo(&lock, "LOCK TABLE %s IN EXCLUSIVE MODE", localname);
+	if (SPI_execute(lock.data, false, 0) != SPI_OK_UTILITY)
+		elog(ERROR, "failed to lock \"%s\"", localname);
+
+	if (opts.watermark_column)
+	{
+		StringInfoData query;
+		bool		isnull;
+
+		/*
+		 * Carry on from the highest watermark already copied. Not read-only,
+		 * so that it gets a new snapshot, taken since we got the lock.
+		 */
+		initStringInfo(&query);
+		appendStringInfo(&query, "SELECT max(%s) FROM %s",
+						 quote_identifier(opts.watermark_column), localname);
+		if (SPI_execute(query.data, false, 1) != SPI_OK_SELECT)
+			elog(ERROR, "failed to find the watermark of \"%s\"", localname);
+
+		watermark = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc,
+								  1, &isnull);
+		have_watermark = !isnull;
+
+		/* Rows fetched again replace their old versions */
+		if (have_watermark && opts.key_column)
+		{
+			StringInfoData del;
+
+			initStringInfo(&del);
+			appendStringInfo(&del, "DELETE FROM %s WHERE %s = $1", localname,
+							 quote_identifier(opts.key_column));
+			delplan = SPI_prepare(del.data, 1, &argtypes[keyarg]);
+			if (delplan == NULL)
+				elog(ERROR, "SPI_prepare failed: %s",
+					 SPI_result_code_string(SPI_result));
+		}
+	}
+	else
+	{
+		StringInfoData query;
+
+		initStringInfo(&query);
+		appendStringInfo(&query, "DELETE FROM %s", localname);
+		if (SPI_execute(query.data, false, 0) != SPI_OK_DELETE)
+			elog(ERROR, "failed to empty \"%s\"", localname);
+	}
+
+	insplan = SPI_prepare(insert.data, num_attrs, argtypes);
+	if (insplan == NULL)
+		elog(ERROR, "SPI_prepare failed: %s", SPI_result_code_string(SPI_result));
+
+	conn = mysqlGetConnection(&opts, true);
+
+	/*
+	 * Without a key, rows can't be replaced, so only those beyond the
+	 * watermark are fetched, which suits an auto-increment column. With
+	 * one, rows at the watermark are fetched again too, in case more rows
+	 * were given the same timestamp after the last refresh.
+	 */
+	if (have_watermark)
+	{
+		appendStringInfoString(&remote, " WHERE ");
+		mysqlQuoteIdentifier(&remote, opts.watermark_column);
+		appendStringInfoString(&remote, opts.key_column ? " >= " : " > ");
+		mysqlDeparseLiteral(&remote, tupdesc->attrs[wmattnum - 1]->atttypid,
+							watermark, false, conn);
+	}
+
+	if (mysql_query(conn, remote.data) != 0 ||
+		(result = mysql_use_result(conn)) == NULL)
+	{
+		char *err = pstrdup(mysql_error(conn));
+		mysqlDiscardConnection(conn);
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+			errmsg("failed to execute the MySQL query: %s", err)));
+	}
+	mysqlSetPendingResult(conn, result);
+
+	conv = mysqlBuildConverter(tupdesc, attnums, num_attrs);
+	rowcxt = AllocSetContextCreate(CurrentMemoryContext,
+								   "mysql_fdw refresh row",
+								   ALLOCSET_DEFAULT_MINSIZE,
+								   ALLOCSET_DEFAULT_INITSIZE,
+								   ALLOCSET_DEFAULT_MAXSIZE);
+
+	while ((row = mysql_fetch_row(result)))
+	{
+		unsigned long *lengths = mysql_fetch_lengths(result);
+		MemoryContext oldcontext;
+
+		MemoryContextReset(rowcxt);
+		oldcontext = MemoryContextSwitchTo(rowcxt);
+		memset(rownulls, true, tupdesc->natts * sizeof(bool));
+		mysqlConvertRow(conv, row, lengths, num_attrs, rowvalues, rownulls);
+		MemoryContextSwitchTo(oldcontext);
+
+		for (i = 0; i < num_attrs; i++)
+		{
+			args[i] = rowvalues[attnums[i] - 1];
+			argnulls[i] = rownulls[attnums[i] - 1] ? 'n' : ' ';
+		}
+
+		if (delplan &&
+			SPI_execute_plan(delplan, &args[keyarg], &argnulls[keyarg],
+							 false, 0) != SPI_OK_DELETE)
+			elog(ERROR, "failed to replace a row of \"%s\"", localname);
+
+		if (SPI_execute_plan(insplan, args, argnulls, false, 0) != SPI_OK_INSERT)
+			elog(ERROR, "failed to insert a row into \"%s\"", localname);
+
+		count++;
+	}
+
+	if (mysql_errno(conn) != 0)
+	{
+		char *err = pstrdup(mysql_error(conn));
+		mysqlDiscardConnection(conn);
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				 errmsg("failed to fetch the MySQL query result: %s", err)));
+	}
+
+	mysqlSetPendingResult(conn, NULL);
+	mysql_free_result(result);
+	mysqlReleaseConnection(conn);
+
+	mysqlRecordRefresh(relid);
+
+	SPI_finish();
+	heap_close(rel, AccessShareLock);
+
+	PG_RETURN_INT64(count);
+}
+
+/*
+ * Note that a foreign table has just been refreshed. The time recorded is
+ * the start of the transaction, which is no later than we read MySQL.
+ *
+ * Only the extension's owner can write to mysql_fdw_snapshots, so that no
+ * one can make a stale copy look fresh; we act as them, having checked
+ * that the current user owns the foreign table.
+ */
+static void
+mysqlRecordRefresh(Oid relid)
+{
+	Oid			owner;
+	char	   *snapshots = mysqlSnapshotsTable(&owner);
+	Oid			argtypes[1] = {REGCLASSOID};
+	Datum		args[1];
+	StringInfoData query;
+	Oid			save_userid;
+	int			save_sec_context;
+
+	args[0] = ObjectIdGetDatum(relid);
+
+	/* Should this fail, aborting the transaction restores the user */
+	GetUserIdAndSecContext(&save_userid, &save_sec_context);
+	SetUserIdAndSecContext(owner,
+						   save_sec_context | SECURITY_LOCAL_USERID_CHANGE);
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+					 "UPDATE %s SET refreshed = now() WHERE relid = $1",
+					 snapshots);
+	if (SPI_execute_with_args(query.data, 1, argtypes, args, NULL,
+							  false, 0) != SPI_OK_UPDATE)
+		elog(ERROR, "failed to record the refresh of \"%s\"",
+			 get_rel_name(relid));
+
+	if (SPI_processed == 0)
+	{
+		resetStringInfo(&query);
+		appendStringInfo(&query,
+						 "INSERT INTO %s (relid, refreshed) VALUES ($1, now())",
+						 snapshots);
+		if (SPI_execute_with_args(query.data, 1, argtypes, args, NULL,
+								  false, 0) != SPI_OK_INSERT)
+			elog(ERROR, "failed to record the refresh of \"%s\"",
+				 get_rel_name(relid));
+	}
+
+	SetUserIdAndSecContext(save_userid, save_sec_context);
+}
+
+/*
+ * Look up the table named by the materialize option.
+ */
+static Oid
+mysqlSnapshotRelid(MySQLFdwOptions *opts, bool missing_ok)
+{
+	List	   *names = stringToQualifiedNameList(opts->materialize);
+	Oid			localrelid;
+
+	localrelid = RangeVarGetRelid(makeRangeVarFromNameList(names), missing_ok);
+	if (OidIsValid(localrelid) && get_rel_relkind(localrelid) != RELKIND_RELATION)
+	{
+		if (missing_ok)
+			return InvalidOid;
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not a table", opts->materialize)));
+	}
+
+	return localrelid;
+}
+
+/*
+ * Return the name of the mysql_fdw_snapshots table, qualified with the
+ * extension's schema, which may have been moved, and, if owner isn't NULL,
+ * its owner. Must be called within SPI.
+ */
+static char *
+mysqlSnapshotsTable(Oid *owner)
+{
+	char	   *schema;
+	bool		isnull;
+
+	if (SPI_execute("SELECT n.nspname, c.relowner"
+					" FROM pg_catalog.pg_extension e"
+					" JOIN pg_catalog.pg_namespace n ON n.oid = e.extnamespace"
+					" JOIN pg_catalog.pg_class c ON c.relnamespace = n.oid"
+					" WHERE e.extname = 'mysql_fdw'"
+					" AND c.relname = 'mysql_fdw_snapshots'",
+					true, 1) != SPI_OK_SELECT ||
+		SPI_processed == 0)
+		elog(ERROR, "could not find table \"mysql_fdw_snapshots\" of extension \"mysql_fdw\"");
+
+	schema = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1);
+	if (owner)
+		*owner = DatumGetObjectId(SPI_getbinval(SPI_tuptable->vals[0],
+												SPI_tuptable->tupdesc, 2,
+												&isnull));
+
+	return quote_qualified_identifier(schema, "mysql_fdw_snapshots");
+}
+
+/*
+ * Return a relation's name, schema qualified and quoted as needed.
+ */
+static char *
+mysqlQualifiedRelName(Oid relid)
+{
+	return quote_qualified_identifier(get_namespace_name(get_rel_namespace(relid)),
+									  get_rel_name(relid));
+}
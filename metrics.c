@@ -0,0 +1,359 @@
+/*-------------------------------------------------------------------------
+ *
+ *		  foreign-data wrapper for MySQL
+ *
+ * Copyright (c) 2011, PostgreSQL Global Development Group
+ *
+ * This software is released under the PostgreSQL Licence
+ *
+ * Author: Dave Page <dpage@pgadmin.org>
+ *
+ * IDENTIFICATION
+ *		  mysql_fdw/metrics.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "mysql_fdw.h"
+
+#include "catalog/pg_type.h"
+#include "foreign/foreign.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/syscache.h"
+
+/*
+ * Cumulative metrics of each foreign server.
+ *
+ * Each scan adds up what it did in a MySQLFdwMetrics of its own, and adds
+ * that to its server's totals when it ends, so that the totals are only
+ * locked once per scan. When mysql_fdw is loaded with
+ * shared_preload_libraries the totals are kept in shared memory, for all
+ * backends; otherwise each backend keeps its own.
+ */
+typedef struct MySQLFdwMetricsKey
+{
+	Oid			dbid;			/* database of the foreign server */
+	Oid			serverid;
+} MySQLFdwMetricsKey;
+
+typedef struct MySQLFdwMetricsEntry
+{
+	MySQLFdwMetricsKey key;		/* hash key, must be first */
+	MySQLFdwMetrics metrics;
+} MySQLFdwMetricsEntry;
+
+/* Servers whose metrics the shared memory has room for */
+#define METRICS_MAX_SERVERS		256
+
+/*
+ * Upper bounds, in milliseconds, of the buckets of the histogram of times
+ * to the first row; the last bucket has no upper bound.
+ */
+static const double latency_bounds[MYSQL_FDW_LATENCY_BUCKETS - 1] =
+{
+	1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000
+};
+
+/* Shared totals, if we were preloaded, and their lock */
+static HTAB *SharedMetrics = NULL;
+static LWLockId *SharedMetricsLock = NULL;
+
+/* Otherwise, per-backend totals */
+static HTAB *LocalMetrics = NULL;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+PG_FUNCTION_INFO_V1(mysql_fdw_server_stats);
+PG_FUNCTION_INFO_V1(mysql_fdw_stats_reset);
+
+static void mysqlMetricsShmemStartup(void);
+static Size mysqlMetricsShmemSize(void);
+
+/*
+ * mysqlInitMetrics
+ *		Reserve shared memory for the server metrics if we're being
+ *		preloaded. Called from _PG_init().
+ */
+void
+mysqlInitMetrics(void)
+{
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+	RequestAddinShmemSpace(mysqlMetricsShmemSize());
+	RequestAddinLWLocks(1);
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = mysqlMetricsShmemStartup;
+}
+
+static Size
+mysqlMetricsShmemSize(void)
+{
+	return add_size(MAXALIGN(sizeof(LWLockId)),
+					hash_estimate_size(METRICS_MAX_SERVERS,
+									   sizeof(MySQLFdwMetricsEntry)));
+}
+
+/*
+ * Attach to, or create, the shared totals.
+ */
+static void
+mysqlMetricsShmemStartup(void)
+{
+	HASHCTL		info;
+	bool		found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	SharedMetricsLock = ShmemInitStruct("mysql_fdw metrics lock",
+										sizeof(LWLockId), &found);
+	if (!found)
+		*SharedMetricsLock = LWLockAssign();
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(MySQLFdwMetricsKey);
+	info.entrysize = sizeof(MySQLFdwMetricsEntry);
+	info.hash = tag_hash;
+	SharedMetrics = ShmemInitHash("mysql_fdw metrics",
+								  METRICS_MAX_SERVERS, METRICS_MAX_SERVERS,
+								  &info, HASH_ELEM | HASH_FUNCTION);
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * mysqlMetricsAddQuery
+ *		Count a query, which took first_row_ms milliseconds from being sent
+ *		to its first row (or the end of its result) arriving.
+ */
+void
+mysqlMetricsAddQuery(MySQLFdwMetrics *m, double first_row_ms)
+{
+	int			i;
+
+	for (i = 0; i < MYSQL_FDW_LATENCY_BUCKETS - 1; i++)
+	{
+		if (first_row_ms <= latency_bounds[i])
+			break;
+	}
+
+	m->queries++;
+	m->first_row_ms += first_row_ms;
+	m->latency[i]++;
+}
+
+/*
+ * mysqlMetricsReport
+ *		Add a scan's metrics to its server's totals. If the shared memory
+ *		is full, servers not yet seen aren't counted.
+ */
+void
+mysqlMetricsReport(Oid serverid, MySQLFdwMetrics *m)
+{
+	MySQLFdwMetricsKey key;
+	MySQLFdwMetricsEntry *entry;
+	bool		found;
+	int			i;
+
+	memset(&key, 0, sizeof(key));
+	key.dbid = MyDatabaseId;
+	key.serverid = serverid;
+
+	if (SharedMetrics)
+	{
+		LWLockAcquire(*SharedMetricsLock, LW_EXCLUSIVE);
+		entry = (MySQLFdwMetricsEntry *) hash_search(SharedMetrics, &key,
+													 HASH_ENTER_NULL, &found);
+	}
+	else
+	{
+		if (LocalMetrics == NULL)
+		{
+			HASHCTL		info;
+
+			memset(&info, 0, sizeof(info));
+			info.keysize = sizeof(MySQLFdwMetricsKey);
+			info.entrysize = sizeof(MySQLFdwMetricsEntry);
+			info.hash = tag_hash;
+			info.hcxt = CacheMemoryContext;
+			LocalMetrics = hash_create("mysql_fdw metrics", 16, &info,
+									   HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+		}
+		entry = (MySQLFdwMetricsEntry *) hash_search(LocalMetrics, &key,
+													 HASH_ENTER, &found);
+	}
+
+	if (entry)
+	{
+		MySQLFdwMetrics *total = &entry->metrics;
+
+		if (!found)
+			memset(total, 0, sizeof(MySQLFdwMetrics));
+
+		total->queries += m->queries;
+		total->errors += m->errors;
+		total->rows += m->rows;
+		total->bytes += m->bytes;
+		total->rejected += m->rejected;
+		total->prepared += m->prepared;
+		total->prepare_hits += m->prepare_hits;
+		total->connect_ms += m->connect_ms;
+		total->first_row_ms += m->first_row_ms;
+		total->convert_ms += m->convert_ms;
+		for (i = 0; i < MYSQL_FDW_LATENCY_BUCKETS; i++)
+			total->latency[i] += m->latency[i];
+	}
+
+	if (SharedMetrics)
+		LWLockRelease(*SharedMetricsLock);
+}
+
+/*
+ * mysqlMetricsError
+ *		Count a failed query straight away, since the scan it was for won't
+ *		get to report.
+ */
+void
+mysqlMetricsError(Oid serverid)
+{
+	MySQLFdwMetrics m;
+
+	memset(&m, 0, sizeof(m));
+	m.errors = 1;
+	mysqlMetricsReport(serverid, &m);
+}
+
+/*
+ * mysql_fdw_server_stats
+ *		Return the totals of the current database's foreign servers.
+ */
+Datum
+mysql_fdw_server_stats(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	HTAB	   *metrics = SharedMetrics ? SharedMetrics : LocalMetrics;
+	HASH_SEQ_STATUS scan;
+	MySQLFdwMetricsEntry *entry;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	if (metrics == NULL)
+	{
+		tuplestore_donestoring(tupstore);
+		return (Datum) 0;
+	}
+
+	if (SharedMetrics)
+		LWLockAcquire(*SharedMetricsLock, LW_SHARED);
+
+	hash_seq_init(&scan, metrics);
+	while ((entry = (MySQLFdwMetricsEntry *) hash_seq_search(&scan)))
+	{
+		MySQLFdwMetrics *m = &entry->metrics;
+		Datum		values[12];
+		bool		nulls[12];
+		Datum		buckets[MYSQL_FDW_LATENCY_BUCKETS];
+		int			i;
+
+		/* Skip other databases' servers, and dropped ones */
+		if (entry->key.dbid != MyDatabaseId ||
+			!SearchSysCacheExists1(FOREIGNSERVEROID,
+								   ObjectIdGetDatum(entry->key.serverid)))
+			continue;
+
+		MemSet(nulls, 0, sizeof(nulls));
+
+		for (i = 0; i < MYSQL_FDW_LATENCY_BUCKETS; i++)
+			buckets[i] = Int64GetDatum((int64) m->latency[i]);
+
+		values[0] = CStringGetTextDatum(GetForeignServer(entry->key.serverid)->servername);
+		values[1] = Int64GetDatum((int64) m->queries);
+		values[2] = Int64GetDatum((int64) m->errors);
+		values[3] = Int64GetDatum((int64) m->rows);
+		values[4] = Int64GetDatum((int64) m->bytes);
+		values[5] = Int64GetDatum((int64) m->rejected);
+		values[6] = Float8GetDatum(m->connect_ms);
+		values[7] = Float8GetDatum(m->first_row_ms);
+		values[8] = Float8GetDatum(m->convert_ms);
+		values[9] = PointerGetDatum(construct_array(buckets,
+													MYSQL_FDW_LATENCY_BUCKETS,
+													INT8OID, sizeof(int64),
+													FLOAT8PASSBYVAL, 'd'));
+		values[10] = Int64GetDatum((int64) m->prepared);
+		values[11] = Int64GetDatum((int64) m->prepare_hits);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	if (SharedMetrics)
+		LWLockRelease(*SharedMetricsLock);
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
+
+/*
+ * mysql_fdw_stats_reset
+ *		Zero the totals of all foreign servers.
+ */
+Datum
+mysql_fdw_stats_reset(PG_FUNCTION_ARGS)
+{
+	HTAB	   *metrics = SharedMetrics ? SharedMetrics : LocalMetrics;
+	HASH_SEQ_STATUS scan;
+	MySQLFdwMetricsEntry *entry;
+
+	if (metrics == NULL)
+		PG_RETURN_VOID();
+
+	if (SharedMetrics)
+		LWLockAcquire(*SharedMetricsLock, LW_EXCLUSIVE);
+
+	hash_seq_init(&scan, metrics);
+	while ((entry = (MySQLFdwMetricsEntry *) hash_seq_search(&scan)))
+		hash_search(metrics, &entry->key, HASH_REMOVE, NULL);
+
+	if (SharedMetrics)
+		LWLockRelease(*SharedMetricsLock);
+
+	PG_RETURN_VOID();
+}
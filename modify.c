@@ -0,0 +1,394 @@
+/*-------------------------------------------------------------------------
+ *
+ *		  foreign-data wrapper for MySQL
+ *
+ * Copyright (c) 2011, PostgreSQL Global Development Group
+ *
+ * This software is released under the PostgreSQL Licence
+ *
+ * Author: Dave Page <dpage@pgadmin.org>
+ *
+ * IDENTIFICATION
+ *		  mysql_fdw/modify.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "mysql_fdw.h"
+
+#include "catalog/pg_class.h"
+#include "executor/spi.h"
+#include "miscadmin.h"
+#include "utils/acl.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+
+/*
+ * Writing to MySQL tables.
+ *
+ * PostgreSQL 9.1 doesn't let foreign data wrappers take part in INSERT,
+ * UPDATE or DELETE, so changes are made with functions instead, each of
+ * which takes a foreign table and a query giving the rows to write. The
+ * query's columns are matched to the foreign table's by name, and, as for
+ * pushdown, those names are used for the MySQL table's columns.
+ *
+ * Inserted rows are sent batch_size at a time, as multi-row INSERTs.
+ * Updates and deletes find their rows by the key_column table option, and
+ * are run one row at a time as a prepared statement. All the changes made
+ * by one call are a single MySQL transaction.
+ */
+
+typedef enum MySQLFdwModifyKind
+{
+	MYSQL_FDW_INSERT,
+	MYSQL_FDW_UPDATE,
+	MYSQL_FDW_DELETE
+} MySQLFdwModifyKind;
+
+PG_FUNCTION_INFO_V1(mysql_fdw_insert);
+PG_FUNCTION_INFO_V1(mysql_fdw_update);
+PG_FUNCTION_INFO_V1(mysql_fdw_delete);
+
+static int64 mysqlModify(Oid relid, const char *query,
+						 MySQLFdwModifyKind kind);
+static uint64 mysqlModifyInsert(MYSQL *conn, MySQLFdwOptions *opts,
+								Portal portal);
+static uint64 mysqlModifyByKey(MYSQL *conn, MySQLFdwOptions *opts,
+							   Portal portal, MySQLFdwModifyKind kind);
+static void mysqlCheckColumns(Oid relid, TupleDesc tupdesc);
+static void mysqlModifyQuery(MYSQL *conn, const char *query);
+
+/*
+ * mysql_fdw_insert
+ *		Insert the rows of a query into a foreign table's MySQL table, and
+ *		return the number inserted.
+ */
+Datum
+mysql_fdw_insert(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_INT64(mysqlModify(PG_GETARG_OID(0),
+								text_to_cstring(PG_GETARG_TEXT_PP(1)),
+								MYSQL_FDW_INSERT));
+}
+
+/*
+ * mysql_fdw_update
+ *		Update the rows of a foreign table's MySQL table whose keys are
+ *		given by a query, setting its other columns, and return the number
+ *		changed.
+ */
+Datum
+mysql_fdw_update(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_INT64(mysqlModify(PG_GETARG_OID(0),
+								text_to_cstring(PG_GETARG_TEXT_PP(1)),
+								MYSQL_FDW_UPDATE));
+}
+
+/*
+ * mysql_fdw_delete
+ *		Delete the rows of a foreign table's MySQL table whose keys are
+ *		given by a query, and return the number deleted.
+ */
+Datum
+mysql_fdw_delete(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_INT64(mysqlModify(PG_GETARG_OID(0),
+								text_to_cstring(PG_GETARG_TEXT_PP(1)),
+								MYSQL_FDW_DELETE));
+}
+
+/*
+ * Run a query, and write its rows to MySQL in one transaction.
+ */
+static int64
+mysqlModify(Oid relid, const char *query, MySQLFdwModifyKind kind)
+{
+	MySQLFdwOptions opts;
+	MYSQL	   *conn;
+	SPIPlanPtr	plan;
+	Portal		portal;
+	uint64		count = 0;
+
+	if (get_rel_relkind(relid) != RELKIND_FOREIGN_TABLE)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not a foreign table",
+						get_rel_name(relid))));
+
+	/*
+	 * Foreign tables can only be granted SELECT, which shouldn't be enough
+	 * to write to them, so only their owners may.
+	 */
+	if (!pg_class_ownercheck(relid, GetUserId()))
+		aclcheck_error(ACLCHECK_NOT_OWNER, ACL_KIND_CLASS,
+					   get_rel_name(relid));
+
+	mysqlGetOptions(relid, &opts);
+
+	if (!opts.table)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_OPTION_NAME_NOT_FOUND),
+				 errmsg("foreign table \"%s\" must have the table option to be written to",
+						get_rel_name(relid))));
+
+	if (kind != MYSQL_FDW_INSERT && !opts.key_column)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_OPTION_NAME_NOT_FOUND),
+				 errmsg("foreign table \"%s\" must have the key_column option to be updated or deleted from",
+						get_rel_name(relid))));
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	plan = SPI_prepare(query, 0, NULL);
+	if (plan == NULL)
+		elog(ERROR, "SPI_prepare failed: %s", SPI_result_code_string(SPI_result));
+	portal = SPI_cursor_open(NULL, plan, NULL, NULL, false);
+
+	mysqlCheckColumns(relid, portal->tupDesc);
+
+	/*
+	 * Hold the connection so that foreign scans in the query don't use it
+	 * while it's in our transaction. Should anything fail, dropping the
+	 * connection rolls the transaction back. Writes must go to the primary.
+	 */
+	opts.primary_only = true;
+	conn = mysqlGetConnection(&opts, true);
+
+	PG_TRY();
+	{
+		mysqlModifyQuery(conn, "START TRANSACTION");
+
+		if (kind == MYSQL_FDW_INSERT)
+			count = mysqlModifyInsert(conn, &opts, portal);
+		else
+			count = mysqlModifyByKey(conn, &opts, portal, kind);
+
+		mysqlModifyQuery(conn, "COMMIT");
+	}
+	PG_CATCH();
+	{
+		mysqlDiscardConnection(conn);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	mysqlReleaseConnection(conn);
+
+	SPI_cursor_close(portal);
+	SPI_finish();
+
+	return (int64) count;
+}
+
+/*
+ * Send the rows as INSERTs of up to batch_size rows each.
+ */
+static uint64
+mysqlModifyInsert(MYSQL *conn, MySQLFdwOptions *opts, Portal portal)
+{
+	TupleDesc	tupdesc = portal->tupDesc;
+	StringInfoData prefix;
+	StringInfoData sql;
+	uint64		count = 0;
+	bool		first = true;
+	int			i;
+
+	initStringInfo(&prefix);
+	appendStringInfo(&prefix, "INSERT INTO %s (", opts->table);
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		if (!first)
+			appendStringInfoString(&prefix, ", ");
+		mysqlQuoteIdentifier(&prefix, NameStr(tupdesc->attrs[i]->attname));
+		first = false;
+	}
+	appendStringInfoString(&prefix, ") VALUES ");
+
+	initStringInfo(&sql);
+
+	for (;;)
+	{
+		uint32		row;
+
+		SPI_cursor_fetch(portal, true, opts->batch_size);
+		if (SPI_processed == 0)
+			break;
+
+		resetStringInfo(&sql);
+		appendStringInfoString(&sql, prefix.data);
+
+		for (row = 0; row < SPI_processed; row++)
+		{
+			HeapTuple	tuple = SPI_tuptable->vals[row];
+
+			appendStringInfoString(&sql, row > 0 ? ", (" : "(");
+			for (i = 0; i < tupdesc->natts; i++)
+			{
+				Datum		value;
+				bool		isnull;
+
+				value = SPI_getbinval(tuple, tupdesc, i + 1, &isnull);
+				if (i > 0)
+					appendStringInfoString(&sql, ", ");
+				mysqlDeparseLiteral(&sql, tupdesc->attrs[i]->atttypid,
+									value, isnull, conn);
+			}
+			appendStringInfoChar(&sql, ')');
+		}
+
+		mysqlModifyQuery(conn, sql.data);
+		count += mysql_affected_rows(conn);
+
+		SPI_freetuptable(SPI_tuptable);
+	}
+
+	pfree(prefix.data);
+	pfree(sql.data);
+
+	return count;
+}
+
+/*
+ * Update or delete each row by its key, with a prepared statement.
+ */
+static uint64
+mysqlModifyByKey(MYSQL *conn, MySQLFdwOptions *opts, Portal portal,
+				 MySQLFdwModifyKind kind)
+{
+	TupleDesc	tupdesc = portal->tupDesc;
+	StringInfoData sql;
+	MySQLFdwStatement *fstmt;
+	Oid		   *paramtypes;
+	int		   *paramcols;
+	int			nparams = 0;
+	int			keycol = -1;
+	Datum	   *values;
+	bool	   *nulls;
+	uint64		count = 0;
+	int			i;
+
+	paramtypes = (Oid *) palloc(tupdesc->natts * sizeof(Oid));
+	paramcols = (int *) palloc(tupdesc->natts * sizeof(int));
+	values = (Datum *) palloc(tupdesc->natts * sizeof(Datum));
+	nulls = (bool *) palloc(tupdesc->natts * sizeof(bool));
+
+	initStringInfo(&sql);
+	if (kind == MYSQL_FDW_UPDATE)
+		appendStringInfo(&sql, "UPDATE %s SET ", opts->table);
+	else
+		appendStringInfo(&sql, "DELETE FROM %s", opts->table);
+
+	/* The columns to set come first, then the key */
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		const char *attname = NameStr(tupdesc->attrs[i]->attname);
+
+		if (strcmp(attname, opts->key_column) == 0)
+		{
+			keycol = i;
+			continue;
+		}
+		if (kind != MYSQL_FDW_UPDATE)
+			continue;
+
+		if (nparams > 0)
+			appendStringInfoString(&sql, ", ");
+		mysqlQuoteIdentifier(&sql, attname);
+		appendStringInfoString(&sql, " = ?");
+		paramtypes[nparams] = tupdesc->attrs[i]->atttypid;
+		paramcols[nparams++] = i;
+	}
+
+	if (keycol < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_COLUMN),
+				 errmsg("query must return the key column \"%s\"",
+						opts->key_column)));
+	if (kind == MYSQL_FDW_UPDATE && nparams == 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("query must return a column to update besides the key column")));
+
+	appendStringInfoString(&sql, " WHERE ");
+	mysqlQuoteIdentifier(&sql, opts->key_column);
+	appendStringInfoString(&sql, " = ?");
+	paramtypes[nparams] = tupdesc->attrs[keycol]->atttypid;
+	paramcols[nparams++] = keycol;
+
+	fstmt = mysqlStmtBegin(conn, sql.data, NULL, NULL, 0, true,
+						   paramtypes, nparams);
+
+	for (;;)
+	{
+		uint32		row;
+
+		SPI_cursor_fetch(portal, true, opts->batch_size);
+		if (SPI_processed == 0)
+			break;
+
+		for (row = 0; row < SPI_processed; row++)
+		{
+			HeapTuple	tuple = SPI_tuptable->vals[row];
+
+			for (i = 0; i < nparams; i++)
+				values[i] = SPI_getbinval(tuple, tupdesc, paramcols[i] + 1,
+										  &nulls[i]);
+
+			mysqlStmtExecute(fstmt, values, nulls);
+			count += mysqlStmtAffectedRows(fstmt);
+		}
+
+		SPI_freetuptable(SPI_tuptable);
+	}
+
+	mysqlStmtEnd(fstmt);
+	pfree(sql.data);
+
+	return count;
+}
+
+/*
+ * Check that each column of the query's result names a column of the
+ * foreign table, so a typo isn't taken for a MySQL column.
+ */
+static void
+mysqlCheckColumns(Oid relid, TupleDesc tupdesc)
+{
+	int			i;
+
+	if (tupdesc->natts == 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("query must return at least one column")));
+
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		const char *attname = NameStr(tupdesc->attrs[i]->attname);
+
+		if (get_attnum(relid, attname) == InvalidAttrNumber)
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_COLUMN),
+					 errmsg("column \"%s\" of foreign table \"%s\" does not exist",
+							attname, get_rel_name(relid))));
+	}
+}
+
+/*
+ * Run a statement that returns no rows.
+ */
+static void
+mysqlModifyQuery(MYSQL *conn, const char *query)
+{
+	if (mysql_query(conn, query) != 0)
+	{
+		char *err = pstrdup(mysql_error(conn));
+		mysqlDiscardConnection(conn);
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+			errmsg("failed to execute the MySQL query: %s", err)));
+	}
+}
@@ -0,0 +1,117 @@
+/*-------------------------------------------------------------------------
+ *
+ *                foreign-data wrapper for MySQL
+ *
+ * Copyright (c) 2011, PostgreSQL Global Development Group
+ *
+ * This software is released under the PostgreSQL Licence
+ *
+ * Author: Dave Page <dpage@pgadmin.org>
+ *
+ * IDENTIFICATION
+ *                mysql_fdw/mysql_fdw--1.0--1.1.sql
+ *
+ *-------------------------------------------------------------------------
+ */
+
+CREATE FUNCTION mysql_fdw_get_connections(OUT server_name text,
+    OUT user_name text, OUT database text, OUT thread_id bigint,
+    OUT valid boolean)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION mysql_fdw_disconnect(text)
+RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION mysql_fdw_disconnect_all()
+RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION mysql_fdw_refresh_stats(regclass)
+RETURNS float8
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION mysql_fdw_calibrate(text, OUT latency_ms float8,
+    OUT fdw_startup_cost float8, OUT bytes_per_ms float8)
+RETURNS record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION mysql_fdw_insert(regclass, text)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION mysql_fdw_update(regclass, text)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION mysql_fdw_delete(regclass, text)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION mysql_fdw_refresh(regclass)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION mysql_fdw_result_cache_reset()
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION mysql_fdw_result_cache_invalidate(regclass)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+REVOKE ALL ON FUNCTION mysql_fdw_result_cache_reset() FROM PUBLIC;
+REVOKE ALL ON FUNCTION mysql_fdw_result_cache_invalidate(regclass) FROM PUBLIC;
+
+CREATE FUNCTION mysql_fdw_result_cache_stats(OUT entries bigint,
+    OUT bytes bigint, OUT size bigint, OUT hits bigint, OUT misses bigint,
+    OUT evictions bigint)
+RETURNS record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION mysql_fdw_server_stats(OUT server_name text,
+    OUT queries bigint, OUT errors bigint, OUT rows bigint, OUT bytes bigint,
+    OUT rejected_values bigint, OUT connect_time float8,
+    OUT first_row_time float8, OUT conversion_time float8,
+    OUT first_row_histogram bigint[], OUT statements_prepared bigint,
+    OUT statement_cache_hits bigint)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE VIEW mysql_fdw_stats AS
+    SELECT * FROM mysql_fdw_server_stats();
+
+CREATE FUNCTION mysql_fdw_stats_reset()
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+REVOKE ALL ON FUNCTION mysql_fdw_stats_reset() FROM PUBLIC;
+
+CREATE FUNCTION mysql_fdw_hosts(OUT server_name text, OUT address text,
+    OUT port integer, OUT in_flight integer, OUT failures integer,
+    OUT retry_at timestamptz, OUT lag integer)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE TABLE mysql_fdw_snapshots (
+    relid regclass PRIMARY KEY,
+    refreshed timestamptz NOT NULL
+);
+SELECT pg_catalog.pg_extension_config_dump('mysql_fdw_snapshots', '');
+GRANT SELECT ON mysql_fdw_snapshots TO PUBLIC;
@@ -16,17 +16,20 @@
 
 #include "postgres.h"
 
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
-#define list_length mysql_list_length
-#define list_delete mysql_list_delete
-#define list_free mysql_list_free
-#include <mysql.h>
-#undef list_length
-#undef list_delete
-#undef list_free
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "mysql_fdw.h"
 
 #include "funcapi.h"
 #include "access/reloptions.h"
@@ -36,12 +39,14 @@
 #include "catalog/pg_type.h"
 #include "commands/defrem.h"
 #include "commands/explain.h"
+#include "executor/executor.h"
 #include "foreign/fdwapi.h"
 #include "foreign/foreign.h"
 #include "miscadmin.h"
 #include "mb/pg_wchar.h"
+#include "nodes/nodeFuncs.h"
 #include "optimizer/cost.h"
-#include "parser/parse_coerce.h"
+#include "portability/instr_time.h"
 #include "storage/fd.h"
 #include "utils/array.h"
 #include "utils/builtins.h"
@@ -68,31 +73,112 @@ static struct MySQLFdwOption valid_options[] =
 	/* Connection options */
 	{ "address",		ForeignServerRelationId },
 	{ "port",		ForeignServerRelationId },
+	{ "socket",		ForeignServerRelationId },
+	{ "replicas",		ForeignServerRelationId },
+	{ "max_replica_lag",	ForeignServerRelationId },
 	{ "username",		UserMappingRelationId },
 	{ "password",		UserMappingRelationId },
 	{ "database",		ForeignTableRelationId },
 	{ "query",		ForeignTableRelationId },
 	{ "table",		ForeignTableRelationId },
 
+	/* Fetch options, table settings override the server's */
+	{ "streaming",		ForeignServerRelationId },
+	{ "streaming",		ForeignTableRelationId },
+	{ "pushdown",		ForeignServerRelationId },
+	{ "pushdown",		ForeignTableRelationId },
+	{ "binary_protocol",	ForeignServerRelationId },
+	{ "binary_protocol",	ForeignTableRelationId },
+	{ "skip_encoding_check",	ForeignServerRelationId },
+	{ "statement_cache_size",	ForeignServerRelationId },
+	{ "subquery_pushdown",	ForeignTableRelationId },
+	{ "prefetch_buffers",	ForeignServerRelationId },
+	{ "prefetch_batch_size",	ForeignServerRelationId },
+	{ "parallel_connections",	ForeignServerRelationId },
+	{ "parallel_connections",	ForeignTableRelationId },
+	{ "split_column",	ForeignTableRelationId },
+	{ "batch_size",		ForeignServerRelationId },
+	{ "batch_size",		ForeignTableRelationId },
+	{ "key_column",		ForeignTableRelationId },
+	{ "materialize",	ForeignTableRelationId },
+	{ "watermark_column",	ForeignTableRelationId },
+	{ "max_staleness",	ForeignTableRelationId },
+	{ "async_dispatch",	ForeignServerRelationId },
+	{ "async_dispatch",	ForeignTableRelationId },
+	{ "cache_ttl",		ForeignServerRelationId },
+	{ "cache_ttl",		ForeignTableRelationId },
+
+	/* Network options */
+	{ "compression",	ForeignServerRelationId },
+	{ "net_buffer_length",	ForeignServerRelationId },
+	{ "read_timeout",	ForeignServerRelationId },
+
+	/* Cost options */
+	{ "fdw_startup_cost",	ForeignServerRelationId },
+	{ "fdw_tuple_cost",	ForeignServerRelationId },
+	{ "bytes_per_ms",	ForeignServerRelationId },
+
 	/* Sentinel */
 	{ NULL,			InvalidOid }
 };
 
+/*
+ * Indexes of the items of FdwPlan.fdw_private.
+ */
+enum MySQLFdwScanPrivateIndex
+{
+	FdwScanPrivateSelectSql,	/* query to send, as a String */
+	FdwScanPrivateRetrievedAttrs,	/* attnums of its columns, an IntList */
+	FdwScanPrivateParams,		/* Params to bind to its placeholders */
+	FdwScanPrivateCountOnly,	/* does it just count the rows? Integer */
+	FdwScanPrivateSplittable,	/* can it be split into ranges? Integer */
+	FdwScanPrivateHasWhere		/* does it have a WHERE clause? Integer */
+};
+
 /*
  * FDW-specific information for ForeignScanState.fdw_state.
  */
 
 typedef struct MySQLFdwExecutionState
 {
+	MySQLFdwOptions opts;		/* options of the foreign table */
 	MYSQL		*conn;			/* MySQL connection object */
 	MYSQL_RES	*result;		/* MySQL result set handler */
+	MySQLFdwStatement *stmt;	/* or statement, with the binary protocol */
+	MySQLFdwPrefetch *prefetch;	/* thread reading the result, if any */
+	MySQLFdwSplitScan *split;	/* or threads reading ranges of the table */
+	MySQLFdwLocalScan *local;	/* or a scan of the local copy */
+	MySQLFdwCachedResult *cached;	/* or a result from the cache */
+	bool		cacheable;		/* store the result in the cache? */
+	bool		splittable;		/* query can be split by ranges? */
+	bool		has_where;		/* query has a WHERE clause? */
+	bool		dispatched;		/* query sent, answer not yet read? */
+	bool		use_stmt;		/* run the query as a prepared statement? */
+	List	   *param_exprs;	/* ExprStates of the query's Params */
+	Oid		   *param_types;	/* and their types */
+	int			num_params;
+	bool		params_changed;	/* must re-execute with new values? */
+	bool		count_only;		/* query returns a count of the rows */
+	int64		count_total;	/* that count, or -1 if not yet known */
+	int64		count_remaining;	/* empty rows still to be returned */
 	char		*query;			/* query string */
+	int			*attnums;		/* attribute number of each field fetched */
+	int			num_attrs;		/* length of attnums */
+	MySQLFdwConverter *converter;	/* how to convert each field */
+	MemoryContext scancxt;		/* for state that outlives a tuple */
 	unsigned int num_fields;	/* how many fields the query returns */
+	bool		eof;			/* streamed result read to the end */
+	MySQLFdwMetrics metrics;	/* what the scan has done, see metrics.c */
+	bool		timing;			/* time conversions, for EXPLAIN ANALYZE? */
+	bool		awaiting_first_row;	/* query sent, no row yet? */
+	instr_time	query_start;	/* when it was sent */
+	char	   *transport;		/* how the last connection was made */
 } MySQLFdwExecutionState;
 
 /*
  * SQL functions
  */
+extern void _PG_init(void);
 extern Datum mysql_fdw_handler(PG_FUNCTION_ARGS);
 extern Datum mysql_fdw_validator(PG_FUNCTION_ARGS);
 
@@ -113,7 +199,31 @@ static void mysqlEndForeignScan(ForeignScanState *node);
  * Helper functions
  */
 static bool mysqlIsValidOption(const char *option, Oid context);
-static void mysqlGetOptions(Oid foreigntableid, char **address, int *port, char **username, char **password, char **database, char **query, char **table);
+static MySQLFdwCompression mysqlParseCompression(DefElem *def);
+static void mysqlExecuteQuery(ForeignScanState *node);
+static void mysqlExecuteStatement(ForeignScanState *node);
+static TupleTableSlot *mysqlIterateBinary(ForeignScanState *node);
+static TupleTableSlot *mysqlIterateCount(ForeignScanState *node);
+static TupleTableSlot *mysqlIterateLocal(ForeignScanState *node);
+static void mysqlFinishResult(MySQLFdwExecutionState *festate);
+static void mysqlAbandonResult(MySQLFdwExecutionState *festate);
+static void mysqlDispatchQuery(MySQLFdwExecutionState *festate);
+static MYSQL *mysqlTimedConnection(MySQLFdwExecutionState *festate,
+								   bool exclusive);
+static void mysqlQuerySent(MySQLFdwExecutionState *festate);
+static void mysqlFirstRow(MySQLFdwExecutionState *festate);
+
+/*
+ * Module load callback
+ */
+void
+_PG_init(void)
+{
+	mysqlInitStats();
+	mysqlInitMetrics();
+	mysqlInitResultCache();
+	mysqlInitReplicas();
+}
 
 /*
  * Foreign-data wrapper handler function: return a struct with pointers
@@ -205,6 +315,43 @@ mysql_fdw_validator(PG_FUNCTION_ARGS)
 
 			svr_port = atoi(defGetString(def));
 		}
+		else if (strcmp(def->defname, "compression") == 0)
+		{
+			/* Just check that it's a valid choice */
+			(void) mysqlParseCompression(def);
+		}
+		else if (strcmp(def->defname, "net_buffer_length") == 0)
+		{
+#ifdef HAVE_MYSQL_NET_BUFFER_LENGTH
+			char	   *value = defGetString(def);
+			char	   *end;
+			long		n;
+
+			/* MySQL's limits for net_buffer_length */
+			errno = 0;
+			n = strtol(value, &end, 10);
+			if (end == value || *end != '\0' || errno != 0 || n < 1024 ||
+				n > 1048576)
+				ereport(ERROR,
+					(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+					errmsg("invalid value for option \"%s\": %s", def->defname, value)
+					));
+#else
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+				errmsg("option \"%s\" is not supported by this MySQL client library",
+					   def->defname)
+				));
+#endif
+		}
+		else if (strcmp(def->defname, "replicas") == 0)
+		{
+			char	  **addresses;
+			int		   *ports;
+
+			/* Just check that it parses */
+			(void) mysqlParseHosts(defGetString(def), &addresses, &ports);
+		}
 		if (strcmp(def->defname, "username") == 0)
 		{
 			if (svr_username)
@@ -265,12 +412,111 @@ mysql_fdw_validator(PG_FUNCTION_ARGS)
 
 			svr_table = defGetString(def);
 		}
+		else if (strcmp(def->defname, "streaming") == 0 ||
+				 strcmp(def->defname, "pushdown") == 0 ||
+				 strcmp(def->defname, "binary_protocol") == 0 ||
+				 strcmp(def->defname, "subquery_pushdown") == 0 ||
+				 strcmp(def->defname, "async_dispatch") == 0 ||
+				 strcmp(def->defname, "skip_encoding_check") == 0)
+		{
+			/* Just check that it's a valid boolean */
+			(void) defGetBoolean(def);
+		}
+		else if (strcmp(def->defname, "prefetch_buffers") == 0 ||
+				 strcmp(def->defname, "prefetch_batch_size") == 0 ||
+				 strcmp(def->defname, "parallel_connections") == 0 ||
+				 strcmp(def->defname, "batch_size") == 0 ||
+				 strcmp(def->defname, "max_staleness") == 0 ||
+				 strcmp(def->defname, "cache_ttl") == 0 ||
+				 strcmp(def->defname, "max_replica_lag") == 0 ||
+				 strcmp(def->defname, "read_timeout") == 0 ||
+				 strcmp(def->defname, "statement_cache_size") == 0)
+		{
+			char	   *value = defGetString(def);
+			char	   *end;
+			long		n;
+			long		min = 1;
+			long		max = INT_MAX;
+
+			if (strcmp(def->defname, "prefetch_buffers") == 0 ||
+				strcmp(def->defname, "read_timeout") == 0 ||
+				strcmp(def->defname, "statement_cache_size") == 0)
+				min = 0;
+			if (strcmp(def->defname, "max_staleness") == 0 ||
+				strcmp(def->defname, "cache_ttl") == 0 ||
+				strcmp(def->defname, "max_replica_lag") == 0)
+			{
+				/* in seconds, converted to milliseconds */
+				min = 0;
+				max = INT_MAX / 1000;
+			}
+
+			errno = 0;
+			n = strtol(value, &end, 10);
+			if (end == value || *end != '\0' || errno != 0 || n > max ||
+				n < min)
+				ereport(ERROR,
+					(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+					errmsg("invalid value for option \"%s\": %s", def->defname, value)
+					));
+		}
+		else if (strcmp(def->defname, "fdw_startup_cost") == 0 ||
+				 strcmp(def->defname, "fdw_tuple_cost") == 0 ||
+				 strcmp(def->defname, "bytes_per_ms") == 0)
+		{
+			char	   *value = defGetString(def);
+			char	   *end;
+			double		n;
+
+			errno = 0;
+			n = strtod(value, &end);
+			if (end == value || *end != '\0' || errno != 0 || isnan(n) ||
+				isinf(n) || n < 0 ||
+				(n == 0 && strcmp(def->defname, "bytes_per_ms") == 0))
+				ereport(ERROR,
+					(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+					errmsg("invalid value for option \"%s\": %s", def->defname, value)
+					));
+		}
 	}
 
 	PG_RETURN_VOID();
 }
 
 
+/*
+ * Parse the compression option.
+ */
+static MySQLFdwCompression
+mysqlParseCompression(DefElem *def)
+{
+	char	   *value = defGetString(def);
+
+	if (pg_strcasecmp(value, "auto") == 0)
+		return MYSQL_FDW_COMPRESSION_AUTO;
+	if (pg_strcasecmp(value, "off") == 0)
+		return MYSQL_FDW_COMPRESSION_OFF;
+	if (pg_strcasecmp(value, "zlib") == 0)
+		return MYSQL_FDW_COMPRESSION_ZLIB;
+	if (pg_strcasecmp(value, "zstd") == 0)
+	{
+#ifndef HAVE_MYSQL_ZSTD
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+			errmsg("zstd compression is not supported by this MySQL client library")
+			));
+#endif
+		return MYSQL_FDW_COMPRESSION_ZSTD;
+	}
+
+	ereport(ERROR,
+		(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+		errmsg("invalid value for option \"%s\": %s", def->defname, value),
+		errhint("Valid values are auto, off, zlib and zstd.")
+		));
+	return MYSQL_FDW_COMPRESSION_AUTO;	/* keep compiler quiet */
+}
+
 /*
  * Check if the provided option is one of the valid options.
  * context is the Oid of the catalog holding the object the option is for.
@@ -291,10 +537,29 @@ mysqlIsValidOption(const char *option, Oid context)
 /*
  * Fetch the options for a mysql_fdw foreign table.
  */
-static void
-mysqlGetOptions(Oid foreigntableid, char **address, int *port, char **username, char **password, char **database, char **query, char **table)
+void
+mysqlGetOptions(Oid foreigntableid, MySQLFdwOptions *opts)
 {
 	ForeignTable	*f_table;
+
+	f_table = GetForeignTable(foreigntableid);
+	mysqlGetServerOptions(f_table->serverid, f_table->options, opts);
+
+	/* Check we have the options we need to proceed */
+	if (!opts->table && !opts->query)
+		ereport(ERROR,
+			(errcode(ERRCODE_SYNTAX_ERROR),
+			errmsg("either a table or a query must be specified")
+			));
+}
+
+/*
+ * Fetch the options of a mysql_fdw server and the current user's mapping
+ * for it, followed by those in table_options, if any.
+ */
+void
+mysqlGetServerOptions(Oid serverid, List *table_options, MySQLFdwOptions *opts)
+{
 	ForeignServer	*f_server;
 	UserMapping	*f_mapping;
 	List		*options;
@@ -303,14 +568,27 @@ mysqlGetOptions(Oid foreigntableid, char **address, int *port, char **username,
 	/*
 	 * Extract options from FDW objects.
 	 */
-	f_table = GetForeignTable(foreigntableid);
-	f_server = GetForeignServer(f_table->serverid);
-	f_mapping = GetUserMapping(GetUserId(), f_table->serverid);
-
+	f_server = GetForeignServer(serverid);
+	f_mapping = GetUserMapping(GetUserId(), serverid);
+
+	memset(opts, 0, sizeof(MySQLFdwOptions));
+	opts->serverid = f_server->serverid;
+	opts->userid = f_mapping->userid;
+	opts->pushdown = true;
+	opts->prefetch_batch_size = 1000;
+	opts->parallel_connections = 1;
+	opts->batch_size = 1000;
+	opts->max_staleness = -1;
+	opts->max_replica_lag = -1;
+	opts->fdw_startup_cost = -1;
+	opts->fdw_tuple_cost = DEFAULT_FDW_TUPLE_COST;
+	opts->bytes_per_ms = DEFAULT_BYTES_PER_MS;
+
+	/* Later options win, so table settings override server ones */
 	options = NIL;
-	options = list_concat(options, f_table->options);
-	options = list_concat(options, f_server->options);
-	options = list_concat(options, f_mapping->options);
+	options = list_concat(options, list_copy(f_server->options));
+	options = list_concat(options, list_copy(f_mapping->options));
+	options = list_concat(options, list_copy(table_options));
 
 	/* Loop through the options, and get the server/port */
 	foreach(lc, options)
@@ -318,40 +596,129 @@ mysqlGetOptions(Oid foreigntableid, char **address, int *port, char **username,
 		DefElem *def = (DefElem *) lfirst(lc);
 
 		if (strcmp(def->defname, "address") == 0)
-			*address = defGetString(def);
+			opts->address = defGetString(def);
 
 		if (strcmp(def->defname, "port") == 0)
-			*port = atoi(defGetString(def));
+			opts->port = atoi(defGetString(def));
+
+		if (strcmp(def->defname, "socket") == 0)
+			opts->socket = defGetString(def);
+
+		if (strcmp(def->defname, "compression") == 0)
+			opts->compression = mysqlParseCompression(def);
+
+		if (strcmp(def->defname, "net_buffer_length") == 0)
+			opts->net_buffer_length = atoi(defGetString(def));
+
+		if (strcmp(def->defname, "read_timeout") == 0)
+			opts->read_timeout = atoi(defGetString(def));
+
+		if (strcmp(def->defname, "replicas") == 0)
+			opts->replicas = defGetString(def);
+
+		if (strcmp(def->defname, "max_replica_lag") == 0)
+			opts->max_replica_lag = atoi(defGetString(def));
 
 		if (strcmp(def->defname, "username") == 0)
-			*username = defGetString(def);
+			opts->username = defGetString(def);
 
 		if (strcmp(def->defname, "password") == 0)
-			*password = defGetString(def);
+			opts->password = defGetString(def);
 
 		if (strcmp(def->defname, "database") == 0)
-			*database = defGetString(def);
+			opts->database = defGetString(def);
 
 		if (strcmp(def->defname, "query") == 0)
-			*query = defGetString(def);
+			opts->query = defGetString(def);
 
 		if (strcmp(def->defname, "table") == 0)
-			*table = defGetString(def);
+			opts->table = defGetString(def);
+
+		if (strcmp(def->defname, "streaming") == 0)
+			opts->streaming = defGetBoolean(def);
+
+		if (strcmp(def->defname, "pushdown") == 0)
+			opts->pushdown = defGetBoolean(def);
+
+		if (strcmp(def->defname, "binary_protocol") == 0)
+			opts->binary_protocol = defGetBoolean(def);
+
+		if (strcmp(def->defname, "subquery_pushdown") == 0)
+			opts->subquery_pushdown = defGetBoolean(def);
+
+		if (strcmp(def->defname, "skip_encoding_check") == 0)
+			opts->skip_encoding_check = defGetBoolean(def);
+
+		if (strcmp(def->defname, "prefetch_buffers") == 0)
+			opts->prefetch_buffers = atoi(defGetString(def));
+
+		if (strcmp(def->defname, "prefetch_batch_size") == 0)
+			opts->prefetch_batch_size = atoi(defGetString(def));
+
+		if (strcmp(def->defname, "parallel_connections") == 0)
+			opts->parallel_connections = atoi(defGetString(def));
+
+		if (strcmp(def->defname, "split_column") == 0)
+			opts->split_column = defGetString(def);
+
+		if (strcmp(def->defname, "batch_size") == 0)
+			opts->batch_size = atoi(defGetString(def));
+
+		if (strcmp(def->defname, "statement_cache_size") == 0)
+			opts->statement_cache_size = atoi(defGetString(def));
+
+		if (strcmp(def->defname, "key_column") == 0)
+			opts->key_column = defGetString(def);
+
+		if (strcmp(def->defname, "materialize") == 0)
+			opts->materialize = defGetString(def);
+
+		if (strcmp(def->defname, "watermark_column") == 0)
+			opts->watermark_column = defGetString(def);
+
+		if (strcmp(def->defname, "max_staleness") == 0)
+			opts->max_staleness = atoi(defGetString(def));
+
+		if (strcmp(def->defname, "async_dispatch") == 0)
+			opts->async_dispatch = defGetBoolean(def);
+
+		if (strcmp(def->defname, "cache_ttl") == 0)
+			opts->cache_ttl = atoi(defGetString(def));
+
+		if (strcmp(def->defname, "fdw_startup_cost") == 0)
+			opts->fdw_startup_cost = strtod(defGetString(def), NULL);
+
+		if (strcmp(def->defname, "fdw_tuple_cost") == 0)
+			opts->fdw_tuple_cost = strtod(defGetString(def), NULL);
+
+		if (strcmp(def->defname, "bytes_per_ms") == 0)
+			opts->bytes_per_ms = strtod(defGetString(def), NULL);
 	}
 
+	/*
+	 * Prefetching reads a streamed result in another thread; the binary
+	 * protocol reads its rows straight into the slot, so doesn't use it.
+	 */
+	if (opts->binary_protocol)
+		opts->prefetch_buffers = 0;
+	if (opts->prefetch_buffers > 0)
+		opts->streaming = true;
+
 	/* Default values, if required */
-	if (!*address)
-		*address = "127.0.0.1";
+	if (!opts->address)
+		opts->address = "127.0.0.1";
 
-	if (!*port)
-		*port = 3306;
+	if (!opts->port)
+		opts->port = 3306;
 
-	/* Check we have the options we need to proceed */
-	if (!*table && !*query)
-		ereport(ERROR,
-			(errcode(ERRCODE_SYNTAX_ERROR),
-			errmsg("either a table or a query must be specified")
-			));
+	/* Local databases are probably faster */
+	if (opts->fdw_startup_cost < 0)
+	{
+		if (opts->socket || mysqlIsLocalHost(opts->address))
+			opts->fdw_startup_cost = 10;
+		else
+			opts->fdw_startup_cost = 25;
+	}
 }
 
 /*
@@ -362,86 +729,540 @@ static FdwPlan *
 mysqlPlanForeignScan(Oid foreigntableid, PlannerInfo *root, RelOptInfo *baserel)
 {
 	FdwPlan		*fdwplan;
-	char		*svr_address = NULL;
-	int		svr_port = 0;
-	char		*svr_username = NULL;
-	char		*svr_password = NULL;
-	char 		*svr_database = NULL;
-	char 		*svr_query = NULL;
-	char 		*svr_table = NULL;
-	char		*query;
-	double		rows = 0;
-	MYSQL	   *conn;
-	MYSQL_RES	*result;
-	MYSQL_ROW	row;
+	MySQLFdwOptions	opts;
+	StringInfoData	sql;
+	List		*remote_conds;
+	List		*retrieved_attrs;
+	List		*params;
+	bool		count_only;
+	double		limit = 0;
+	double		rows;
+	double		fetched;
+	int		width;
+	QualCost	qcost;
+	Oid		localrelid;
 
 	/* Fetch options  */
-	mysqlGetOptions(foreigntableid, &svr_address, &svr_port,
-					&svr_username, &svr_password,
-					&svr_database, &svr_query, &svr_table);
+	mysqlGetOptions(foreigntableid, &opts);
 
 	/* Construct FdwPlan with cost estimates. */
 	fdwplan = makeNode(FdwPlan);
 
-	/* Local databases are probably faster */
-	if (strcmp(svr_address, "127.0.0.1") == 0 || strcmp(svr_address, "localhost") == 0)
-		fdwplan->startup_cost = 10;
+	/* Build the query, with whatever quals MySQL can check for us */
+	initStringInfo(&sql);
+	mysqlDeparseSelect(&sql, &opts, foreigntableid, root, baserel,
+					   &remote_conds, &retrieved_attrs, &params,
+					   &count_only);
+
+	/* Let MySQL sort and limit the rows too, if it safely can */
+	if (!count_only)
+		limit = mysqlDeparseOrderLimit(&sql, &opts, foreigntableid, root,
+									   baserel);
+
+	cost_qual_eval(&qcost, baserel->baserestrictinfo, root);
+
+	/*
+	 * If there's a recent enough local copy, the scan will read that, at
+	 * the cost of a local sequential scan.
+	 */
+	localrelid = mysqlGetSnapshot(foreigntableid, &opts);
+	if (OidIsValid(localrelid))
+	{
+		BlockNumber pages;
+
+		mysqlSnapshotSize(localrelid, &pages, &rows);
+
+		baserel->tuples = rows;
+		baserel->rows = clamp_row_est(rows *
+									  clauselist_selectivity(root,
+															 baserel->baserestrictinfo,
+															 0, JOIN_INNER, NULL));
+
+		fdwplan->startup_cost = qcost.startup;
+		fdwplan->total_cost = fdwplan->startup_cost + seq_page_cost * pages +
+			rows * (cpu_tuple_cost + qcost.per_tuple);
+	}
 	else
-		fdwplan->startup_cost = 25;
+	{
+		/*
+		 * Get the size of the remote table, usually from the cache rather
+		 * than MySQL, and scale it by the selectivity of the quals, which
+		 * are all checked whether or not MySQL did too. The rows that cross
+		 * the network are those passing the quals MySQL checked.
+		 */
+		mysqlGetStats(foreigntableid, &opts, &rows, &width);
+
+		baserel->tuples = rows;
+		baserel->rows = clamp_row_est(rows *
+									  clauselist_selectivity(root,
+															 baserel->baserestrictinfo,
+															 0, JOIN_INNER, NULL));
+		fetched = clamp_row_est(rows *
+								clauselist_selectivity(root, remote_conds,
+													   0, JOIN_INNER, NULL));
+		if (limit > 0)
+		{
+			baserel->rows = Min(baserel->rows, limit);
+			fetched = Min(fetched, limit);
+		}
+
+		/*
+		 * If MySQL told us the average row length, assume the columns we
+		 * fetch take their share of it; otherwise use the planner's
+		 * estimate from the column types.
+		 */
+		if (width > 0 && baserel->max_attr > 0)
+			baserel->width = Max(1, width * list_length(retrieved_attrs) /
+								 baserel->max_attr);
+
+		/*
+		 * A round trip to start with, then for each row fetched, the cost
+		 * of receiving its bytes, the per-row overhead, and checking the
+		 * quals.
+		 */
+		fdwplan->startup_cost = opts.fdw_startup_cost + qcost.startup;
+		if (count_only)
+		{
+			/* Just one row crosses the network */
+			fdwplan->total_cost = fdwplan->startup_cost + opts.fdw_tuple_cost +
+				fetched * (cpu_tuple_cost + qcost.per_tuple);
+		}
+		else
+			fdwplan->total_cost = fdwplan->startup_cost +
+				fetched * (opts.fdw_tuple_cost + cpu_tuple_cost + qcost.per_tuple) +
+				fetched * baserel->width / opts.bytes_per_ms * COST_PER_MS;
+	}
 
 	/*
-	 * TODO: Find a way to stash this connection object away, so we don't have
-	 * to reconnect to MySQL again later.
+	 * Pass the query and what the executor needs to know about it, as
+	 * listed in MySQLFdwScanPrivateIndex; they must be copyable by
+	 * copyObject. Only plain scans of a table can be split into ranges.
 	 */
+	fdwplan->fdw_private = list_make4(makeString(sql.data), retrieved_attrs,
+									  params, makeInteger(count_only));
+	fdwplan->fdw_private = lappend(fdwplan->fdw_private,
+								   makeInteger(opts.table && !count_only &&
+											   params == NIL && limit == 0));
+	fdwplan->fdw_private = lappend(fdwplan->fdw_private,
+								   makeInteger(remote_conds != NIL));
 
-	/* Connect to the server */
-	conn = mysql_init(NULL);
-	if (!conn)
-		ereport(ERROR,
-			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
-			errmsg("failed to initialise the MySQL connection object")
-			));
+	return fdwplan;
+}
 
-	mysql_options(conn, MYSQL_SET_CHARSET_NAME, GetDatabaseEncodingName());
+/*
+ * fileExplainForeignScan
+ *		Produce extra output for EXPLAIN
+ */
+static void
+mysqlExplainForeignScan(ForeignScanState *node, ExplainState *es)
+{
+	MySQLFdwExecutionState *festate = (MySQLFdwExecutionState *) node->fdw_state;
 
-	if (!mysql_real_connect(conn, svr_address, svr_username, svr_password,
-							svr_database, svr_port, NULL,
-							CLIENT_COMPRESS | CLIENT_REMEMBER_OPTIONS ))
-		ereport(ERROR,
-			(errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
-			errmsg("failed to connect to MySQL: %s", mysql_error(conn))
-			));
+	/* Show the cost parameters the plan was costed with */
+	if (es->costs)
+	{
+		ExplainPropertyFloat("MySQL startup cost", festate->opts.fdw_startup_cost, 2, es);
+		ExplainPropertyFloat("MySQL tuple cost", festate->opts.fdw_tuple_cost, 4, es);
+		ExplainPropertyFloat("MySQL bytes per ms", festate->opts.bytes_per_ms, 0, es);
+		ExplainPropertyText("MySQL query", festate->query, es);
+	}
 
-	/* Build the query */
-	if (svr_query)
+	/*
+	 * How MySQL was reached, once it's run, or otherwise how the primary
+	 * would be
+	 */
+	if (!festate->local && !festate->cached)
+		ExplainPropertyText("MySQL transport",
+							festate->transport ? festate->transport :
+							mysqlPlannedTransport(&festate->opts), es);
+
+	/* The local copy is read instead, if it was recent enough */
+	if (festate->local)
+		ExplainPropertyText("MySQL snapshot",
+							mysqlLocalScanRelName(festate->local), es);
+
+	/* The query is split into ranges when run, if the table has a key */
+	else if (festate->splittable)
+		ExplainPropertyInteger("MySQL parallel connections",
+							   festate->opts.parallel_connections, es);
+
+	/* Whether the result came from the cache is known once it's run */
+	if (festate->cacheable && es->analyze)
+		ExplainPropertyText("MySQL result cache",
+							festate->cached ? "hit" : "miss", es);
+
+	/* Where the time went, once it's run */
+	if (es->analyze && !festate->local)
 	{
-		size_t len = strlen(svr_query) + 9;
+		MySQLFdwMetrics *m = &festate->metrics;
+		uint64		bytes = m->bytes;
+
+		if (festate->stmt)
+			bytes += mysqlStmtBytes(festate->stmt);
+
+		if (m->queries != 1)
+			ExplainPropertyLong("MySQL queries", (long) m->queries, es);
+		ExplainPropertyFloat("MySQL connect time", m->connect_ms, 3, es);
+		ExplainPropertyFloat("MySQL first row time", m->first_row_ms, 3, es);
+		ExplainPropertyLong("MySQL rows received", (long) m->rows, es);
+		ExplainPropertyLong("MySQL bytes received", (long) bytes, es);
+		if (festate->timing && !festate->use_stmt)
+			ExplainPropertyFloat("MySQL conversion time", m->convert_ms, 3, es);
+		ExplainPropertyLong("MySQL rejected values", (long) m->rejected, es);
+		if (festate->use_stmt && festate->opts.statement_cache_size > 0)
+			ExplainPropertyText("MySQL statement cache",
+								m->prepare_hits > 0 ? "hit" : "miss", es);
+	}
+}
 
-		query = (char *) palloc(len);
-		snprintf(query, len, "EXPLAIN %s", svr_query);
+/*
+ * mysqlBeginForeignScan
+ *		Initiate access to the database
+ */
+static void
+mysqlBeginForeignScan(ForeignScanState *node, int eflags)
+{
+	MySQLFdwOptions		opts;
+	MySQLFdwExecutionState  *festate;
+	FdwPlan			*fdwplan = ((ForeignScan *) node->ss.ps.plan)->fdwplan;
+	char			*query;
+	List			*retrieved_attrs;
+	List			*params;
+	ListCell		*lc;
+	Oid			localrelid;
+	int			i;
+
+	/* Fetch options  */
+	mysqlGetOptions(RelationGetRelid(node->ss.ss_currentRelation), &opts);
+
+	/* Get the query built by the planner */
+	query = pstrdup(strVal(list_nth(fdwplan->fdw_private,
+									FdwScanPrivateSelectSql)));
+	retrieved_attrs = (List *) list_nth(fdwplan->fdw_private,
+										FdwScanPrivateRetrievedAttrs);
+	params = (List *) list_nth(fdwplan->fdw_private, FdwScanPrivateParams);
+
+	/* Stash away the state info we have already */
+	festate = (MySQLFdwExecutionState *) palloc(sizeof(MySQLFdwExecutionState));
+	node->fdw_state = (void *) festate;
+	festate->opts = opts;
+	festate->opts.owner = GetCurrentSubTransactionId();
+	festate->conn = NULL;
+	festate->result = NULL;
+	festate->stmt = NULL;
+	festate->prefetch = NULL;
+	festate->split = NULL;
+	festate->local = NULL;
+	festate->cached = NULL;
+	festate->query = query;
+	festate->num_fields = 0;
+	festate->eof = false;
+	festate->params_changed = false;
+	memset(&festate->metrics, 0, sizeof(MySQLFdwMetrics));
+	festate->timing = node->ss.ps.instrument != NULL;
+	festate->awaiting_first_row = false;
+	festate->transport = NULL;
+
+	/* Read the local copy instead of MySQL, if it's recent enough */
+	localrelid = mysqlGetSnapshot(RelationGetRelid(node->ss.ss_currentRelation),
+								  &opts);
+	if (OidIsValid(localrelid))
+		festate->local = mysqlLocalScanBegin(localrelid,
+											 node->ss.ss_ScanTupleSlot->tts_tupleDescriptor);
+
+	/*
+	 * Params are evaluated each time the query is run, and bound to its
+	 * placeholders, which needs a prepared statement.
+	 */
+	festate->num_params = list_length(params);
+	festate->param_exprs = NIL;
+	festate->param_types = (Oid *) palloc(Max(festate->num_params, 1) * sizeof(Oid));
+	i = 0;
+	foreach(lc, params)
+	{
+		Expr	   *param = (Expr *) lfirst(lc);
+
+		festate->param_exprs = lappend(festate->param_exprs,
+									   ExecInitExpr(param, (PlanState *) node));
+		festate->param_types[i++] = exprType((Node *) param);
 	}
-	else
+
+	/*
+	 * A count is a single row, read with the text protocol, from which the
+	 * rows (with no columns) are made up locally.
+	 */
+	festate->count_only = intVal(list_nth(fdwplan->fdw_private,
+										  FdwScanPrivateCountOnly));
+	festate->count_total = -1;
+	festate->count_remaining = 0;
+	if (festate->count_only)
 	{
-		size_t len = strlen(svr_table) + 23;
+		festate->opts.streaming = false;
+		festate->opts.prefetch_buffers = 0;
+	}
 
-		query = (char *) palloc(len);
-		snprintf(query, len, "EXPLAIN SELECT * FROM %s", svr_table);
+	festate->use_stmt = (opts.binary_protocol && !festate->count_only) ||
+		festate->num_params > 0;
+
+	/*
+	 * A result to be cached is buffered, so that it can be copied into the
+	 * cache and then read as usual. See if it's there already.
+	 */
+	festate->cacheable = opts.cache_ttl > 0 && !festate->use_stmt &&
+		!festate->local;
+	if (festate->cacheable)
+	{
+		festate->opts.streaming = false;
+		festate->opts.prefetch_buffers = 0;
+
+		if (!(eflags & EXEC_FLAG_EXPLAIN_ONLY))
+			festate->cached = mysqlCacheLookup(&opts, query);
+		if (festate->cached)
+			festate->num_fields = mysqlCacheNumFields(festate->cached);
 	}
 
 	/*
-	 * MySQL seems to have some pretty unhelpful EXPLAIN output, which only
-	 * gives a row estimate for each relation in the statement. We'll use the
-	 * sum of the rows as our cost estimate - it's not great (in fact, in some
-	 * cases it sucks), but it's all we've got for now.
+	 * A scan split into ranges is read by threads, like a prefetched one,
+	 * so it's streamed rather than buffered.
 	 */
-	if (mysql_query(conn, query) != 0)
+	festate->splittable = opts.parallel_connections > 1 && !festate->use_stmt &&
+		!festate->cacheable &&
+		intVal(list_nth(fdwplan->fdw_private, FdwScanPrivateSplittable));
+	festate->has_where = intVal(list_nth(fdwplan->fdw_private,
+										 FdwScanPrivateHasWhere));
+	if (festate->splittable)
+		festate->opts.streaming = true;
+
+	/* Note which column each field of the result belongs in */
+	festate->num_attrs = list_length(retrieved_attrs);
+	festate->attnums = (int *) palloc(Max(festate->num_attrs, 1) * sizeof(int));
+	i = 0;
+	foreach(lc, retrieved_attrs)
+		festate->attnums[i++] = lfirst_int(lc);
+
+	/* Work out the conversion of each field once, rather than per row */
+	festate->converter = mysqlBuildConverter(RelationGetDescr(node->ss.ss_currentRelation),
+											 festate->attnums,
+											 festate->num_attrs);
+
+	/*
+	 * Iterate is called in the executor's per-tuple context, which is reset
+	 * for every row, so anything kept across rows must go in here.
+	 */
+	festate->scancxt = CurrentMemoryContext;
+
+	/*
+	 * Send the query now, rather than when the first row is wanted, so that
+	 * MySQL works on it while the rest of the plan starts up, and any other
+	 * foreign scans in it send theirs too.
+	 */
+	festate->dispatched = false;
+	if (opts.async_dispatch && !(eflags & EXEC_FLAG_EXPLAIN_ONLY) &&
+		!festate->local && !festate->cached && !festate->use_stmt &&
+		!festate->splittable)
+		mysqlDispatchQuery(festate);
+}
+
+/*
+ * mysqlDispatchQuery
+ *		Send the scan's query without waiting for the answer, which
+ *		mysqlExecuteQuery() reads later.
+ *
+ * The connection is held exclusively until then, so each scan dispatched
+ * at once needs its own.
+ */
+static void
+mysqlDispatchQuery(MySQLFdwExecutionState *festate)
+{
+	festate->conn = mysqlTimedConnection(festate, true);
+
+	mysqlQuerySent(festate);
+	if (mysql_send_query(festate->conn, festate->query,
+						 strlen(festate->query)) != 0)
 	{
-		char *err = pstrdup(mysql_error(conn));
-		mysql_close(conn);
+		char *err = pstrdup(mysql_error(festate->conn));
+		mysqlDiscardConnection(festate->conn);
+		festate->conn = NULL;
+		mysqlMetricsError(festate->opts.serverid);
 		ereport(ERROR,
 			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-			errmsg("failed to execute the MySQL query: %s", err)
-			));
+			errmsg("failed to execute the MySQL query: %s", err)));
+	}
+
+	festate->dispatched = true;
+}
+
+/*
+ * mysqlTimedConnection
+ *		Get a connection for the scan, counting the time taken to connect
+ *		(or check a cached connection)
+ */
+static MYSQL *
+mysqlTimedConnection(MySQLFdwExecutionState *festate, bool exclusive)
+{
+	instr_time	start;
+	instr_time	duration;
+	MYSQL	   *conn;
+
+	INSTR_TIME_SET_CURRENT(start);
+	conn = mysqlGetConnection(&festate->opts, exclusive);
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+	festate->metrics.connect_ms += INSTR_TIME_GET_MILLISEC(duration);
+
+	/* Remember which host and transport it was, for EXPLAIN ANALYZE */
+	if (festate->timing)
+	{
+		const char *transport = mysqlConnectionTransport(conn);
+
+		if (festate->transport)
+			pfree(festate->transport);
+		festate->transport = transport ?
+			MemoryContextStrdup(festate->scancxt, transport) : NULL;
+	}
+
+	return conn;
+}
+
+/*
+ * mysqlQuerySent
+ *		Note that a query is about to be sent, to time its first row
+ */
+static void
+mysqlQuerySent(MySQLFdwExecutionState *festate)
+{
+	INSTR_TIME_SET_CURRENT(festate->query_start);
+	festate->awaiting_first_row = true;
+}
+
+/*
+ * mysqlFirstRow
+ *		Count the query whose first row, or end, has just been read
+ */
+static void
+mysqlFirstRow(MySQLFdwExecutionState *festate)
+{
+	instr_time	duration;
+
+	if (!festate->awaiting_first_row)
+		return;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, festate->query_start);
+	mysqlMetricsAddQuery(&festate->metrics, INSTR_TIME_GET_MILLISEC(duration));
+	festate->awaiting_first_row = false;
+}
+
+/*
+ * mysqlExecuteQuery
+ *		Send the scan's query to MySQL and set up to read its result
+ *
+ * A buffered result is fetched in full by mysql_store_result(), after which
+ * the connection is free for other scans. A streamed result is read a row
+ * at a time with mysql_use_result(), which keeps memory use flat however
+ * big the table is, but ties up the connection until the result is freed.
+ *
+ * With the binary protocol, or if it has parameters, the query is run as
+ * a prepared statement, which holds on to the connection until the scan
+ * is over.
+ *
+ * With prefetch_buffers set, a streamed result is read by a helper thread
+ * a batch of rows ahead of the scan, so that waiting for the network
+ * overlaps converting the rows already read.
+ *
+ * With parallel_connections set, a scan of a table is split into ranges
+ * of its key, read over that many connections at once, if it has a key
+ * to split on.
+ *
+ * With cache_ttl set, the buffered result is also copied into the shared
+ * result cache, for later scans to read instead of running the query.
+ *
+ * With async_dispatch set, the query was already sent when the scan
+ * began, and we only have to collect the answer.
+ *
+ * If the query is cancelled, or times out, while we wait for MySQL to
+ * answer, MySQL is told to stop it too.
+ */
+static void
+mysqlExecuteQuery(ForeignScanState *node)
+{
+	MySQLFdwExecutionState *festate = (MySQLFdwExecutionState *) node->fdw_state;
+	bool		failed;
+
+	if (festate->splittable)
+	{
+		MemoryContext oldcontext = MemoryContextSwitchTo(festate->scancxt);
+
+		mysqlQuerySent(festate);
+		festate->split = mysqlSplitScanBegin(&festate->opts, festate->query,
+											 festate->has_where,
+											 festate->opts.parallel_connections);
+		MemoryContextSwitchTo(oldcontext);
+
+		if (festate->split)
+		{
+			festate->num_fields = mysqlSplitScanNumFields(festate->split);
+			return;
+		}
+	}
+
+	if (festate->use_stmt)
+	{
+		MemoryContext oldcontext = MemoryContextSwitchTo(festate->scancxt);
+
+		festate->conn = mysqlTimedConnection(festate, true);
+		festate->stmt = mysqlStmtBegin(festate->conn, festate->query,
+									   node->ss.ss_ScanTupleSlot->tts_tupleDescriptor,
+									   festate->attnums, festate->num_attrs,
+									   !festate->opts.streaming,
+									   festate->param_types,
+									   festate->num_params);
+		MemoryContextSwitchTo(oldcontext);
+
+		if (mysqlStmtCached(festate->stmt))
+			festate->metrics.prepare_hits++;
+		else
+			festate->metrics.prepared++;
+
+		if (festate->opts.skip_encoding_check &&
+			mysqlCharsetMatches(festate->conn))
+			mysqlStmtTrustEncoding(festate->stmt);
+
+		mysqlExecuteStatement(node);
+		return;
+	}
+
+	if (festate->dispatched)
+	{
+		/* The query was sent when the scan began */
+		festate->dispatched = false;
+		failed = false;
+	}
+	else
+	{
+		/* Held until the result is read, so that it counts as a replica's load */
+		festate->conn = mysqlTimedConnection(festate, true);
+		mysqlQuerySent(festate);
+		failed = mysql_send_query(festate->conn, festate->query,
+								  strlen(festate->query)) != 0;
+	}
+
+	/* Wait for the answer such that a cancel stops the query on MySQL */
+	if (!failed)
+	{
+		mysqlWaitForResult(festate->conn);
+		failed = mysql_read_query_result(festate->conn) != 0;
+	}
+
+	if (failed)
+	{
+		char *err = pstrdup(mysql_error(festate->conn));
+		mysqlDiscardConnection(festate->conn);
+		festate->conn = NULL;
+		mysqlMetricsError(festate->opts.serverid);
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+			errmsg("failed to execute the MySQL query: %s", err)));
 	}
 
 	/*
@@ -450,122 +1271,245 @@ mysqlPlanForeignScan(Oid foreigntableid, PlannerInfo *root, RelOptInfo *baserel)
 	 *
 	 * We assume we're given a query that does return data (SELECT).
 	 */
-	result = mysql_store_result(conn);
+	if (festate->opts.streaming)
+		festate->result = mysql_use_result(festate->conn);
+	else
+		festate->result = mysql_store_result(festate->conn);
 
-	if (result == NULL)
+	if (festate->result == NULL)
 	{
-		char *err = pstrdup(mysql_error(conn));
-		mysql_close(conn);
+		char *err = pstrdup(mysql_error(festate->conn));
+		mysqlDiscardConnection(festate->conn);
+		festate->conn = NULL;
+		mysqlMetricsError(festate->opts.serverid);
 		ereport(ERROR,
-			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-			errmsg("failed to execute the MySQL query: %s", err)));
+				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				 errmsg("failed to execute the MySQL query: %s", err)));
 	}
 
-	while ((row = mysql_fetch_row(result)))
-		rows += atof(row[8]);
-
-	mysql_free_result(result);
-	mysql_close(conn);
-
-	baserel->rows = rows;
-	baserel->tuples = rows;
-	fdwplan->total_cost = rows + fdwplan->startup_cost;
-	fdwplan->fdw_private = NIL;	/* not used */
+	if (festate->opts.streaming)
+		mysqlSetPendingResult(festate->conn, festate->result);
+	else
+	{
+		/* A buffered result doesn't need the connection any more */
+		mysqlReleaseConnection(festate->conn);
+	}
 
-	return fdwplan;
+	/* remember the field count, that doesn't change mid-query */
+	festate->num_fields = mysql_num_fields(festate->result);
+
+	/* MySQL has converted strings to the database encoding, if asked to */
+	if (festate->opts.skip_encoding_check &&
+		mysqlCharsetMatches(festate->conn))
+		mysqlConverterTrustEncoding(festate->converter,
+									mysql_fetch_fields(festate->result),
+									festate->num_fields);
+
+	if (festate->cacheable)
+		mysqlCacheStore(&festate->opts,
+						RelationGetRelid(node->ss.ss_currentRelation),
+						festate->query, festate->result);
+
+	if (festate->opts.prefetch_buffers > 0)
+		festate->prefetch = mysqlPrefetchStart(festate->conn, festate->result,
+											   festate->opts.prefetch_buffers,
+											   festate->opts.prefetch_batch_size);
 }
 
 /*
- * fileExplainForeignScan
- *		Produce extra output for EXPLAIN
+ * mysqlExecuteStatement
+ *		Run the scan's prepared statement with the current values of its
+ *		Params
  */
 static void
-mysqlExplainForeignScan(ForeignScanState *node, ExplainState *es)
+mysqlExecuteStatement(ForeignScanState *node)
 {
-	char		    *svr_address = NULL;
-	int		     svr_port = 0;
-	char		    *svr_username = NULL;
-	char		    *svr_password = NULL;
-	char		    *svr_database = NULL;
-	char		    *svr_query = NULL;
-	char		    *svr_table = NULL;
-
 	MySQLFdwExecutionState *festate = (MySQLFdwExecutionState *) node->fdw_state;
+	ExprContext *econtext = node->ss.ps.ps_ExprContext;
+	Datum	   *values;
+	bool	   *nulls;
+	ListCell   *lc;
+	int			i = 0;
 
-	/* Fetch options  */
-	mysqlGetOptions(RelationGetRelid(node->ss.ss_currentRelation), &svr_address, &svr_port, &svr_username, &svr_password, &svr_database, &svr_query, &svr_table);
+	values = (Datum *) palloc(Max(festate->num_params, 1) * sizeof(Datum));
+	nulls = (bool *) palloc(Max(festate->num_params, 1) * sizeof(bool));
 
-	/* Give some possibly useful info about startup costs */
-	if (es->costs)
+	foreach(lc, festate->param_exprs)
 	{
-		if (strcmp(svr_address, "127.0.0.1") == 0 || strcmp(svr_address, "localhost") == 0)	
-			ExplainPropertyLong("Local server startup cost", 10, es);
-		else
-			ExplainPropertyLong("Remote server startup cost", 25, es);
-		ExplainPropertyText("MySQL query", festate->query, es);
+		ExprState  *expr = (ExprState *) lfirst(lc);
+
+		values[i] = ExecEvalExpr(expr, econtext, &nulls[i], NULL);
+		i++;
 	}
+
+	mysqlQuerySent(festate);
+	mysqlStmtExecute(festate->stmt, values, nulls);
+	festate->params_changed = false;
+
+	pfree(values);
+	pfree(nulls);
 }
 
 /*
- * mysqlBeginForeignScan
- *		Initiate access to the database
+ * mysqlFinishResult
+ *		Free the scan's result, and give back its connection if streaming
  */
 static void
-mysqlBeginForeignScan(ForeignScanState *node, int eflags)
+mysqlFinishResult(MySQLFdwExecutionState *festate)
 {
-	char			*svr_address = NULL;
-	int			svr_port = 0;
-	char			*svr_username = NULL;
-	char			*svr_password = NULL;
-	char			*svr_database = NULL;
-	char			*svr_query = NULL;
-	char			*svr_table = NULL;
-	MYSQL			*conn;
-	MySQLFdwExecutionState  *festate;
-	char			*query;
+	if (festate->split)
+	{
+		mysqlSplitScanEnd(festate->split);
+		festate->split = NULL;
+		return;
+	}
 
-	/* Fetch options  */
-	mysqlGetOptions(RelationGetRelid(node->ss.ss_currentRelation),
-					&svr_address, &svr_port,
-					&svr_username, &svr_password,
-					&svr_database, &svr_query, &svr_table);
-
-	/* Connect to the server */
-	conn = mysql_init(NULL);
-	if (!conn)
-		ereport(ERROR,
-			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
-			errmsg("failed to initialise the MySQL connection object")
-			));
+	if (festate->stmt)
+	{
+		festate->metrics.bytes += mysqlStmtBytes(festate->stmt);
+		mysqlStmtEnd(festate->stmt);
+		festate->stmt = NULL;
+		mysqlReleaseConnection(festate->conn);
+		festate->conn = NULL;
+		return;
+	}
 
-	mysql_options(conn, MYSQL_SET_CHARSET_NAME, GetDatabaseEncodingName());
+	/* The thread must be finished with the result before it's freed */
+	if (festate->prefetch)
+	{
+		mysqlPrefetchStop(festate->prefetch);
+		festate->prefetch = NULL;
+	}
 
-	if (!mysql_real_connect(conn, svr_address, svr_username, svr_password,
-							svr_database, svr_port, NULL,
-							CLIENT_COMPRESS | CLIENT_REMEMBER_OPTIONS ))
-		ereport(ERROR,
-			(errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
-			errmsg("failed to connect to MySQL: %s", mysql_error(conn))
-			));
+	/* For a streamed result, this reads and discards any remaining rows */
+	mysql_free_result(festate->result);
+	festate->result = NULL;
 
-	/* Build the query */
-	if (svr_query)
-		query = svr_query;
-	else
+	if (festate->opts.streaming)
+		mysqlReleaseConnection(festate->conn);
+	festate->conn = NULL;
+}
+
+/* Rows read of an abandoned result in the hope of reaching its end */
+#define ABANDON_READ_ROWS	100
+
+/*
+ * mysqlAbandonResult
+ *		Get rid of a streamed result the scan stopped reading part way
+ *		through, for example under a LIMIT.
+ *
+ * mysql_free_result() would read, and throw away, all the rest of it, which
+ * for a big table can take minutes and keep MySQL busy meanwhile. If the
+ * end is near (as when MySQL applied the LIMIT itself), the few remaining
+ * rows are read, and the connection kept; otherwise the query is killed and
+ * the connection closed. A split scan cancels its ranges itself when it's
+ * finished.
+ */
+static void
+mysqlAbandonResult(MySQLFdwExecutionState *festate)
+{
+	bool		cancel;
+
+	if (festate->split || festate->conn == NULL)
+		return;
+
+	if (festate->stmt)
+		cancel = true;
+	else if (festate->prefetch)
+		cancel = !mysqlPrefetchFinished(festate->prefetch);
+	else if (festate->result)
 	{
-		size_t len = strlen(svr_table) + 15;
+		int			i;
 
-		query = (char *)palloc(len);
-		snprintf(query, len, "SELECT * FROM %s", svr_table);
+		cancel = true;
+		for (i = 0; i < ABANDON_READ_ROWS; i++)
+		{
+			if (mysql_fetch_row(festate->result) == NULL)
+			{
+				cancel = mysql_errno(festate->conn) != 0;
+				break;
+			}
+		}
 	}
+	else
+		return;
 
-	/* Stash away the state info we have already */
-	festate = (MySQLFdwExecutionState *) palloc(sizeof(MySQLFdwExecutionState));
-	node->fdw_state = (void *) festate;
-	festate->conn = conn;
+	if (!cancel)
+		return;
+
+	if (festate->stmt)
+		festate->metrics.bytes += mysqlStmtBytes(festate->stmt);
+
+	/* This frees the result, statement and prefetch along with it */
+	mysqlCancelQuery(festate->conn);
+	festate->conn = NULL;
 	festate->result = NULL;
-	festate->query = query;
-	festate->num_fields = 0;
+	festate->stmt = NULL;
+	festate->prefetch = NULL;
+}
+
+/*
+ * mysqlAsciiPrefix
+ *		Return the length of the longest prefix of a string that is plain
+ *		ASCII, without NULs.
+ *
+ * Most strings are all ASCII, so this checks 32 or 16 bytes at a time
+ * with AVX2 or SSE2 where the compiler targets them, and otherwise 8 at a
+ * time, before finishing byte by byte.
+ */
+static int
+mysqlAsciiPrefix(const char *str, int len)
+{
+	int			i = 0;
+
+#if defined(__AVX2__)
+	const __m256i zero = _mm256_setzero_si256();
+
+	for (; i + 32 <= len; i += 32)
+	{
+		__m256i		chunk = _mm256_loadu_si256((const __m256i *) (str + i));
+
+		/* The top bit is set in bytes that are non-ASCII, or NULs */
+		if (_mm256_movemask_epi8(_mm256_or_si256(chunk,
+												 _mm256_cmpeq_epi8(chunk, zero))) != 0)
+			break;
+	}
+#elif defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i		chunk = _mm_loadu_si128((const __m128i *) (str + i));
+
+		/* The top bit is set in bytes that are non-ASCII, or NULs */
+		if (_mm_movemask_epi8(_mm_or_si128(chunk,
+										   _mm_cmpeq_epi8(chunk, zero))) != 0)
+			break;
+	}
+#else
+	for (; i + 8 <= len; i += 8)
+	{
+		uint64		word;
+
+		memcpy(&word, str + i, sizeof(word));
+
+		/* Any non-ASCII byte, or any zero byte */
+		if ((word & UINT64CONST(0x8080808080808080)) != 0 ||
+			((word - UINT64CONST(0x0101010101010101)) & ~word &
+			 UINT64CONST(0x8080808080808080)) != 0)
+			break;
+	}
+#endif
+
+	for (; i < len; i++)
+	{
+		unsigned char c = (unsigned char) str[i];
+
+		if (c == 0 || c >= 0x80)
+			break;
+	}
+
+	return i;
 }
 
 /*
@@ -578,6 +1522,11 @@ mysqlBeginForeignScan(ForeignScanState *node, int eflags)
  * Note that we only call that function when we have a column whose type
  * category is some string.
  *
+ * ASCII characters are single bytes in every server encoding, and never
+ * part of a multibyte character, so only what follows the ASCII prefix of
+ * a value needs checking character by character, which for most values is
+ * nothing at all.
+ *
  * Instead of erroring out when the data is not compliant with the database
  * encoding, we raise a WARNING and return false here, and return NULL at the
  * upper level, so that it's still possible to use this driver for MySQL data
@@ -585,34 +1534,43 @@ mysqlBeginForeignScan(ForeignScanState *node, int eflags)
  *
  * FIXME: a way to export this choice as a SERVER options might be good.
  */
-static bool
+uint64		mysqlRejectedValues = 0;	/* by this backend, for the metrics */
+
+bool
 mysqlVerifymbstr(const char *mbstr, int len)
 {
-	if (!pg_verifymbstr(mbstr, len, true))
+	int			ascii = mysqlAsciiPrefix(mbstr, len);
+	const char *rest = mbstr + ascii;
+	int			l;
+	char		buf[8 * 5 + 1];
+	char	   *p = buf;
+	int			j,
+				jlimit;
+
+	if (ascii == len || pg_verifymbstr(rest, len - ascii, true))
+		return true;
+
+	mysqlRejectedValues++;
+
+	/* Show the first bytes past the ASCII, where the bad ones start */
+	l = pg_encoding_mblen(GetDatabaseEncoding(), rest);
+	jlimit = Min(l, len - ascii);
+	jlimit = Min(jlimit, 8);	/* prevent buffer overrun */
+
+	buf[0] = '\0';
+	for (j = 0; j < jlimit; j++)
 	{
-		int			l = pg_encoding_mblen(GetDatabaseEncoding(), mbstr);
-		char		buf[8 * 5 + 1];
-		char	   *p = buf;
-		int			j, jlimit;
-
-		jlimit = Min(l, len);
-		jlimit = Min(jlimit, 8);	/* prevent buffer overrun */
-
-		for (j = 0; j < jlimit; j++)
-		{
-			p += sprintf(p, "0x%02x", (unsigned char) mbstr[j]);
-			if (j < jlimit - 1)
-				p += sprintf(p, " ");
-		}
-		ereport(WARNING,
-				(errcode(ERRCODE_CHARACTER_NOT_IN_REPERTOIRE),
-				 errmsg("invalid byte sequence for encoding \"%s\": %s",
-						GetDatabaseEncodingName(),
-						mbstr)));
-		return false;
-	}
-	return true;
+		p += sprintf(p, "0x%02x", (unsigned char) rest[j]);
+		if (j < jlimit - 1)
+			p += sprintf(p, " ");
+	}
+	ereport(WARNING,
+			(errcode(ERRCODE_CHARACTER_NOT_IN_REPERTOIRE),
+			 errmsg("invalid byte sequence for encoding \"%s\": %s",
+					GetDatabaseEncodingName(), buf)));
+	return false;
 }
+
 /*
  * mysqlIterateForeignScan
  *		Read next record from the data file and store it into the
@@ -622,117 +1580,238 @@ static TupleTableSlot *
 mysqlIterateForeignScan(ForeignScanState *node)
 {
 	MYSQL_ROW		row;
+	unsigned long  *lengths = NULL;
 
 	MySQLFdwExecutionState *festate = (MySQLFdwExecutionState *) node->fdw_state;
 	TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
-	AttInMetadata *meta =
-		TupleDescGetAttInMetadata(node->ss.ss_currentRelation->rd_att);
+	TupleDesc	tupdesc = slot->tts_tupleDescriptor;
+
+	if (festate->local)
+		return mysqlIterateLocal(node);
+
+	if (festate->count_only)
+		return mysqlIterateCount(node);
+
+	if (festate->use_stmt)
+		return mysqlIterateBinary(node);
 
 	/* Execute the query, if required */
-	if (!festate->result)
+	if (!festate->result && !festate->split && !festate->cached &&
+		!festate->eof)
+		mysqlExecuteQuery(node);
+
+	/*
+	 * The protocol for loading a virtual tuple into a slot is first
+	 * ExecClearTuple, then fill the values/isnull arrays, then
+	 * ExecStoreVirtualTuple. If we don't find another row, we just skip the
+	 * last step, leaving the slot empty as required.
+	 */
+	ExecClearTuple(slot);
+
+	if (festate->eof)
+		return slot;
+
+	/* Get the next tuple */
+	if (festate->cached)
+	{
+		if (!mysqlCacheNext(festate->cached, &row, &lengths))
+			row = NULL;
+	}
+	else if (festate->split)
+	{
+		if (!mysqlSplitScanNext(festate->split, &row, &lengths))
+			row = NULL;
+	}
+	else if (festate->prefetch)
+	{
+		/* Errors are reported, and the connection discarded, in here */
+		if (!mysqlPrefetchNext(festate->prefetch, &row, &lengths))
+			row = NULL;
+	}
+	else
 	{
-		if (mysql_query(festate->conn, festate->query) != 0)
+		row = mysql_fetch_row(festate->result);
+		if (row)
+			lengths = mysql_fetch_lengths(festate->result);
+	}
+
+	mysqlFirstRow(festate);
+
+	if (!row && festate->opts.streaming)
+	{
+		/* A streamed result can fail part way through */
+		if (festate->conn && mysql_errno(festate->conn) != 0)
 		{
 			char *err = pstrdup(mysql_error(festate->conn));
-			mysql_close(festate->conn);
+			mysqlDiscardConnection(festate->conn);
+			festate->conn = NULL;
+			festate->result = NULL;
+			mysqlMetricsError(festate->opts.serverid);
 			ereport(ERROR,
-				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-				errmsg("failed to execute the MySQL query: %s", err)));
+					(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+					 errmsg("failed to fetch the MySQL query result: %s", err)));
+		}
+
+		/* Let other scans have the connection as soon as we're done */
+		mysqlFinishResult(festate);
+		festate->eof = true;
+	}
+
+	if (row)
+	{
+		uint64		rejected = mysqlRejectedValues;
+		instr_time	start;
+
+		/* Rows from the cache weren't received from MySQL */
+		if (!festate->cached)
+		{
+			unsigned int i;
+
+			festate->metrics.rows++;
+			for (i = 0; i < festate->num_fields; i++)
+				festate->metrics.bytes += lengths[i];
 		}
 
+		if (festate->timing)
+			INSTR_TIME_SET_CURRENT(start);
+
 		/*
-		 * http://dev.mysql.com/doc/refman/5.0/en/mysql-use-result.html
-		 * http://dev.mysql.com/doc/refman/5.0/en/null-mysql-store-result.html
-		 *
-		 * We assume we're given a query that does return data (SELECT).
+		 * Fill the slot's own arrays; columns we didn't fetch, and dropped
+		 * ones, are left NULL. Converted values are allocated in the
+		 * per-tuple context, so they go away with the row.
 		 */
-		festate->result = mysql_store_result(festate->conn);
+		memset(slot->tts_isnull, true, tupdesc->natts * sizeof(bool));
 
-		if (festate->result == NULL)
+		mysqlConvertRow(festate->converter, row, lengths,
+						festate->num_fields,
+						slot->tts_values, slot->tts_isnull);
+
+		if (festate->timing)
 		{
-			char *err = pstrdup(mysql_error(festate->conn));
-			mysql_close(festate->conn);
-			ereport(ERROR,
-					(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-					 errmsg("failed to execute the MySQL query: %s", err)));
+			instr_time	duration;
+
+			INSTR_TIME_SET_CURRENT(duration);
+			INSTR_TIME_SUBTRACT(duration, start);
+			festate->metrics.convert_ms += INSTR_TIME_GET_MILLISEC(duration);
 		}
+		festate->metrics.rejected += mysqlRejectedValues - rejected;
 
-		/* remember the field count, that doesn't change mid-query */
-		festate->num_fields = mysql_num_fields(festate->result);
+		ExecStoreVirtualTuple(slot);
 	}
+	return slot;
+}
+
+/*
+ * mysqlIterateBinary
+ *		Read the next record with the binary protocol, storing the values
+ *		straight into the slot's arrays
+ */
+static TupleTableSlot *
+mysqlIterateBinary(ForeignScanState *node)
+{
+	MySQLFdwExecutionState *festate = (MySQLFdwExecutionState *) node->fdw_state;
+	TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+	TupleDesc	tupdesc = slot->tts_tupleDescriptor;
+	uint64		rejected;
+	bool		found;
+
+	/* Execute the query, if required */
+	if (!festate->stmt && !festate->eof)
+		mysqlExecuteQuery(node);
+	else if (festate->params_changed)
+		mysqlExecuteStatement(node);
 
-	/*
-	 * The protocol for loading a virtual tuple into a slot is first
-	 * ExecClearTuple, then fill the values/isnull arrays, then
-	 * ExecStoreVirtualTuple. If we don't find another row, we just skip the
-	 * last step, leaving the slot empty as required.
-	 */
 	ExecClearTuple(slot);
 
-	/* Get the next tuple */
-	if ((row = mysql_fetch_row(festate->result)))
+	if (festate->eof)
+		return slot;
+
+	/* Columns we don't fetch are left NULL */
+	memset(slot->tts_isnull, true, tupdesc->natts * sizeof(bool));
+
+	/* Values are converted as they're fetched, so that isn't timed */
+	rejected = mysqlRejectedValues;
+	found = mysqlStmtFetch(festate->stmt, slot->tts_values, slot->tts_isnull);
+	mysqlFirstRow(festate);
+	festate->metrics.rejected += mysqlRejectedValues - rejected;
+
+	if (found)
 	{
-		Datum	   *dvalues;
-		bool	   *nulls;
-		unsigned long    *lengths;
-		int				  x, y;
+		festate->metrics.rows++;
+		ExecStoreVirtualTuple(slot);
+	}
+	else if (festate->opts.streaming)
+	{
+		/* Let other scans have the connection as soon as we're done */
+		mysqlFinishResult(festate);
+		festate->eof = true;
+	}
 
-		nulls = (bool *) palloc(festate->num_fields * sizeof(bool));
-		dvalues = (Datum *) palloc(festate->num_fields * sizeof(Datum));
-		lengths = mysql_fetch_lengths(festate->result);
+	return slot;
+}
 
-		for (x = y = 0; x < festate->num_fields; x++, y++)
-		{
-			/* Handle dropped attributes by setting to NULL */
-			while (meta->tupdesc->attrs[y]->attisdropped)
-			{
-				elog(NOTICE, "attisdropped[%d]", y);
+/*
+ * mysqlIterateCount
+ *		Return as many rows as MySQL counted, with all columns NULL, since
+ *		none of them are used
+ */
+static TupleTableSlot *
+mysqlIterateCount(ForeignScanState *node)
+{
+	MySQLFdwExecutionState *festate = (MySQLFdwExecutionState *) node->fdw_state;
+	TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+	TupleDesc	tupdesc = slot->tts_tupleDescriptor;
 
-				dvalues[y] = (Datum) 0;
-				nulls[y] = true;
-				y++;
-			}
+	/* Get the count, if required */
+	if (festate->count_total < 0 && festate->cached)
+	{
+		MYSQL_ROW	row;
+		unsigned long *lengths;
 
-			if (row[x] == NULL)
-			{
-				/* we have a NULL value here */
-				dvalues[y] = (Datum) 0;
-				nulls[y] = true;
-			}
-			else if (lengths[x] == 0)
-			{
-				/* special case empty string input */
-				nulls[y] = false;
-				dvalues[y] = InputFunctionCall(&meta->attinfuncs[y],
-											   "",
-											   meta->attioparams[y],
-											   meta->atttypmods[y]);
-			}
-			else
-			{
-				bool encoding_error = false;
-				if (TypeCategory(meta->attioparams[y]) == TYPCATEGORY_STRING)
-					encoding_error = ! mysqlVerifymbstr(row[x], lengths[x]);
-
-				if (encoding_error)
-				{
-					nulls[y] = true;
-					dvalues[y] = (Datum) 0;
-				}
-				else
-				{
-					nulls[y] = false;
-					dvalues[y] = InputFunctionCall(&meta->attinfuncs[y],
-												   row[x],
-												   meta->attioparams[y],
-												   meta->atttypmods[y]);
-				}
-			}
-		}
-		slot->tts_isnull = nulls;
-		slot->tts_values = dvalues;
+		if (!mysqlCacheNext(festate->cached, &row, &lengths))
+			row = NULL;
+		festate->count_total = (row && row[0]) ? strtoll(row[0], NULL, 10) : 0;
+		festate->count_remaining = festate->count_total;
+	}
+	else if (festate->count_total < 0)
+	{
+		MYSQL_ROW	row;
+
+		mysqlExecuteQuery(node);
+		row = mysql_fetch_row(festate->result);
+		mysqlFirstRow(festate);
+		festate->count_total = (row && row[0]) ? strtoll(row[0], NULL, 10) : 0;
+		festate->count_remaining = festate->count_total;
+		mysqlFinishResult(festate);
+	}
+
+	ExecClearTuple(slot);
+
+	if (festate->count_remaining > 0)
+	{
+		festate->count_remaining--;
+		memset(slot->tts_isnull, true, tupdesc->natts * sizeof(bool));
 		ExecStoreVirtualTuple(slot);
 	}
+
+	return slot;
+}
+
+/*
+ * mysqlIterateLocal
+ *		Read the next record from the foreign table's local copy
+ */
+static TupleTableSlot *
+mysqlIterateLocal(ForeignScanState *node)
+{
+	MySQLFdwExecutionState *festate = (MySQLFdwExecutionState *) node->fdw_state;
+	TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+
+	ExecClearTuple(slot);
+
+	if (mysqlLocalScanNext(festate->local, slot->tts_values, slot->tts_isnull))
+		ExecStoreVirtualTuple(slot);
+
 	return slot;
 }
 
@@ -745,16 +1824,33 @@ mysqlEndForeignScan(ForeignScanState *node)
 {
 	MySQLFdwExecutionState *festate = (MySQLFdwExecutionState *) node->fdw_state;
 
-	if (festate->result)
+	/* Don't read the rest of a streamed result we've no use for */
+	if (festate->opts.streaming && !festate->eof)
+		mysqlAbandonResult(festate);
+
+	/* The connection stays in the cache for the next scan */
+	if (festate->result || festate->stmt || festate->split)
+		mysqlFinishResult(festate);
+
+	/* Add what the scan did to its server's totals */
+	if (festate->metrics.queries > 0)
+		mysqlMetricsReport(festate->opts.serverid, &festate->metrics);
+
+	/*
+	 * A query dispatched but never read is killed, and its connection
+	 * closed, rather than its rows being read just to be thrown away.
+	 */
+	if (festate->dispatched)
 	{
-		mysql_free_result(festate->result);
-		festate->result = NULL;
+		mysqlCancelQuery(festate->conn);
+		festate->conn = NULL;
+		festate->dispatched = false;
 	}
 
-	if (festate->conn)
+	if (festate->local)
 	{
-		mysql_close(festate->conn);
-		festate->conn = NULL;
+		mysqlLocalScanEnd(festate->local);
+		festate->local = NULL;
 	}
 
 	if (festate->query)
@@ -773,7 +1869,43 @@ mysqlReScanForeignScan(ForeignScanState *node)
 {
 	MySQLFdwExecutionState *festate = (MySQLFdwExecutionState *) node->fdw_state;
 
-	if (festate->result)
+	if (festate->local)
+	{
+		mysqlLocalScanRescan(festate->local);
+	}
+	else if (festate->count_only)
+	{
+		/* The count doesn't change within a query */
+		festate->count_remaining = Max(festate->count_total, 0);
+	}
+	else if (festate->stmt && festate->num_params > 0 &&
+		node->ss.ps.chgParam != NULL)
+	{
+		/* Run the statement again with the new values, when next needed */
+		festate->params_changed = true;
+	}
+	else if (festate->stmt)
+	{
+		/* Statements can just be re-executed, if they can't seek */
+		mysqlStmtRewind(festate->stmt);
+	}
+	else if (festate->use_stmt)
+	{
+		/* A streamed statement that was read to the end was closed */
+		festate->eof = false;
+	}
+	else if (festate->opts.streaming)
+	{
+		/* We can't seek in a streamed result, so run the query again */
+		if (festate->result || festate->split)
+			mysqlFinishResult(festate);
+		festate->eof = false;
+	}
+	else if (festate->cached)
+	{
+		mysqlCacheRewind(festate->cached);
+	}
+	else if (festate->result)
 	{
 		mysql_data_seek(festate->result, 0);
 	}
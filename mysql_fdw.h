@@ -0,0 +1,310 @@
+/*-------------------------------------------------------------------------
+ *
+ *		  foreign-data wrapper for MySQL
+ *
+ * Copyright (c) 2011, PostgreSQL Global Development Group
+ *
+ * This software is released under the PostgreSQL Licence
+ *
+ * Author: Dave Page <dpage@pgadmin.org>
+ *
+ * IDENTIFICATION
+ *		  mysql_fdw/mysql_fdw.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef MYSQL_FDW_H
+#define MYSQL_FDW_H
+
+#define list_length mysql_list_length
+#define list_delete mysql_list_delete
+#define list_free mysql_list_free
+#include <mysql.h>
+#undef list_length
+#undef list_delete
+#undef list_free
+
+#include "access/tupdesc.h"
+#include "fmgr.h"
+#include "lib/stringinfo.h"
+#include "nodes/relation.h"
+
+/* MySQL 8.0 replaced my_bool, which MariaDB still uses, with bool */
+#if MYSQL_VERSION_ID >= 80000 && !defined(MARIADB_BASE_VERSION)
+typedef bool mysql_bool;
+#else
+typedef my_bool mysql_bool;
+#endif
+
+/* zstd compression of the protocol arrived in MySQL 8.0.18 */
+#if MYSQL_VERSION_ID >= 80018 && !defined(MARIADB_BASE_VERSION)
+#define HAVE_MYSQL_ZSTD
+#endif
+
+/* The client's network buffer size can be set since MySQL 8.0 */
+#if MYSQL_VERSION_ID >= 80000 || defined(MARIADB_BASE_VERSION)
+#define HAVE_MYSQL_NET_BUFFER_LENGTH
+#endif
+
+/* MariaDB's client library can say what socket a connection uses */
+#ifdef MARIADB_BASE_VERSION
+#define HAVE_MYSQL_GET_SOCKET
+#endif
+
+/* MySQL's number for the "binary" character set, of raw byte columns */
+#define MYSQL_BINARY_CHARSET	63
+
+/* Compression of the protocol, see the compression option */
+typedef enum MySQLFdwCompression
+{
+	MYSQL_FDW_COMPRESSION_AUTO,	/* zlib unless the server is local */
+	MYSQL_FDW_COMPRESSION_OFF,
+	MYSQL_FDW_COMPRESSION_ZLIB,
+	MYSQL_FDW_COMPRESSION_ZSTD
+} MySQLFdwCompression;
+
+/*
+ * Options for a mysql_fdw foreign table, merged from the table, its server
+ * and the current user's mapping.
+ */
+typedef struct MySQLFdwOptions
+{
+	Oid			serverid;		/* foreign server */
+	Oid			userid;			/* user of the mapping, InvalidOid for PUBLIC */
+	char	   *address;		/* of the primary */
+	int			port;
+	char	   *socket;			/* Unix socket of the primary, or NULL */
+	MySQLFdwCompression compression;
+	int			net_buffer_length;	/* bytes, or 0 for the default */
+	int			read_timeout;	/* seconds, or 0 for none */
+	char	   *replicas;		/* list of read replicas, or NULL */
+	int			max_replica_lag;	/* seconds behind to still use one, or -1 */
+	bool		primary_only;	/* must the primary be used, to write? */
+	SubTransactionId owner;		/* subtransaction that began the scan */
+	char	   *username;
+	char	   *password;
+	char	   *database;
+	char	   *query;
+	char	   *table;
+	bool		streaming;		/* read results with mysql_use_result()? */
+	bool		pushdown;		/* send WHERE clauses to MySQL? */
+	bool		binary_protocol;	/* scan with prepared statements? */
+	bool		skip_encoding_check;	/* trust MySQL's conversion? */
+	bool		subquery_pushdown;	/* query's columns match ours by name? */
+	bool		async_dispatch;	/* send the query when the scan begins? */
+	int			prefetch_buffers;	/* batches to read ahead, 0 for none */
+	int			prefetch_batch_size;	/* rows per batch */
+	int			parallel_connections;	/* to split a scan over */
+	char	   *split_column;	/* integer column to split it by */
+	int			batch_size;		/* rows per INSERT by mysql_fdw_insert() */
+	int			statement_cache_size;	/* statements kept per connection */
+	char	   *key_column;		/* identifies rows to update or delete */
+	char	   *materialize;	/* local copy of the table, if any */
+	char	   *watermark_column;	/* for incremental refreshes of it */
+	int			max_staleness;	/* seconds before it's not used, or -1 */
+	int			cache_ttl;		/* seconds to cache results, 0 for never */
+	double		fdw_startup_cost;	/* cost of a round trip to MySQL */
+	double		fdw_tuple_cost;	/* cost of receiving a row, besides its bytes */
+	double		bytes_per_ms;	/* network throughput */
+} MySQLFdwOptions;
+
+/*
+ * Planner cost units are nominally a sequential page fetch; we take one to
+ * be worth 10 microseconds of waiting for the network.
+ */
+#define COST_PER_MS				100.0
+
+#define DEFAULT_FDW_TUPLE_COST	0.01
+#define DEFAULT_BYTES_PER_MS	100000.0	/* about gigabit ethernet */
+
+/* Buckets of the histogram of times to the first row, see metrics.c */
+#define MYSQL_FDW_LATENCY_BUCKETS	13
+
+/*
+ * What scans of a foreign server did, and how long it took; kept for each
+ * scan, and totalled for each server.
+ */
+typedef struct MySQLFdwMetrics
+{
+	uint64		queries;		/* sent to MySQL */
+	uint64		errors;			/* of them that failed */
+	uint64		rows;			/* received */
+	uint64		bytes;			/* of values received */
+	uint64		rejected;		/* values invalid in the database encoding */
+	uint64		prepared;		/* statements prepared */
+	uint64		prepare_hits;	/* statements reused instead */
+	double		connect_ms;		/* getting connections */
+	double		first_row_ms;	/* from sending queries to their first rows */
+	double		convert_ms;		/* converting values, when timed */
+	uint64		latency[MYSQL_FDW_LATENCY_BUCKETS];	/* queries by first_row_ms */
+} MySQLFdwMetrics;
+
+/* A query run with the binary protocol, see statement.c */
+typedef struct MySQLFdwStatement MySQLFdwStatement;
+
+/* How to convert the text values of a result, see convert.c */
+typedef struct MySQLFdwConverter MySQLFdwConverter;
+
+/* Rows being read ahead by a helper thread, see prefetch.c */
+typedef struct MySQLFdwPrefetch MySQLFdwPrefetch;
+
+/* A scan read over several connections, see parallel.c */
+typedef struct MySQLFdwSplitScan MySQLFdwSplitScan;
+
+/* A scan of a foreign table's local copy, see materialize.c */
+typedef struct MySQLFdwLocalScan MySQLFdwLocalScan;
+
+/* A result copied from the shared result cache, see cache.c */
+typedef struct MySQLFdwCachedResult MySQLFdwCachedResult;
+
+/* in mysql_fdw.c */
+extern void mysqlGetOptions(Oid foreigntableid, MySQLFdwOptions *opts);
+extern void mysqlGetServerOptions(Oid serverid, List *table_options,
+								  MySQLFdwOptions *opts);
+extern bool mysqlVerifymbstr(const char *mbstr, int len);
+extern uint64 mysqlRejectedValues;
+
+/* in connection.c */
+extern MYSQL *mysqlGetConnection(MySQLFdwOptions *opts, bool exclusive);
+extern MYSQL *mysqlGetSiblingConnection(MySQLFdwOptions *opts, MYSQL *conn);
+extern void mysqlSetPendingResult(MYSQL *conn, MYSQL_RES *result);
+extern void mysqlSetPendingStatement(MYSQL *conn, MYSQL_STMT *stmt);
+extern void mysqlSetAbortCallback(MYSQL *conn, void (*callback) (void *arg),
+								  void *arg);
+extern void mysqlReleaseConnection(MYSQL *conn);
+extern void mysqlDiscardConnection(MYSQL *conn);
+extern void mysqlCancelQuery(MYSQL *conn);
+extern void mysqlWaitForResult(MYSQL *conn);
+extern int	mysqlConnectionSocket(MYSQL *conn);
+extern bool mysqlIsLocalHost(const char *address);
+extern char *mysqlPlannedTransport(MySQLFdwOptions *opts);
+extern const char *mysqlConnectionTransport(MYSQL *conn);
+extern bool mysqlCharsetMatches(MYSQL *conn);
+extern MYSQL_STMT *mysqlPrepareStatement(MYSQL *conn, const char *query,
+										 bool *hit);
+extern void mysqlReleaseStatement(MYSQL *conn, MYSQL_STMT *stmt);
+
+/* in deparse.c */
+extern void mysqlDeparseSelect(StringInfo buf, MySQLFdwOptions *opts,
+							   Oid relid, PlannerInfo *root,
+							   RelOptInfo *baserel,
+							   List **remote_conds, List **retrieved_attrs,
+							   List **params, bool *count_only);
+extern double mysqlDeparseOrderLimit(StringInfo buf, MySQLFdwOptions *opts,
+									 Oid relid, PlannerInfo *root,
+									 RelOptInfo *baserel);
+extern void mysqlDeparseLiteral(StringInfo buf, Oid type, Datum value,
+								bool isnull, MYSQL *conn);
+extern void mysqlDeparseStringLiteral(StringInfo buf, const char *val,
+									  MYSQL *conn);
+extern void mysqlQuoteIdentifier(StringInfo buf, const char *ident);
+
+/* in stats.c */
+extern void mysqlInitStats(void);
+extern void mysqlGetStats(Oid relid, MySQLFdwOptions *opts, double *rows,
+						  int *width);
+extern char *mysqlGetSplitColumn(MYSQL *conn, MySQLFdwOptions *opts);
+extern bool mysqlGetSplitBounds(MYSQL *conn, MySQLFdwOptions *opts,
+								const char *column, int64 *min, int64 *max);
+
+/* in convert.c */
+extern MySQLFdwConverter *mysqlBuildConverter(TupleDesc tupdesc, int *attnums,
+											  int num_attrs);
+extern void mysqlConvertRow(MySQLFdwConverter *conv, char **row,
+							unsigned long *lengths, int nfields,
+							Datum *values, bool *nulls);
+extern void mysqlConverterTrustEncoding(MySQLFdwConverter *conv,
+										MYSQL_FIELD *fields, int nfields);
+
+/* in statement.c */
+extern MySQLFdwStatement *mysqlStmtBegin(MYSQL *conn, const char *query,
+										 TupleDesc tupdesc, int *attnums,
+										 int num_attrs, bool buffered,
+										 Oid *paramtypes, int nparams);
+extern void mysqlStmtExecute(MySQLFdwStatement *fstmt, Datum *values,
+							 bool *nulls);
+extern bool mysqlStmtFetch(MySQLFdwStatement *fstmt, Datum *values,
+						   bool *nulls);
+extern uint64 mysqlStmtAffectedRows(MySQLFdwStatement *fstmt);
+extern uint64 mysqlStmtBytes(MySQLFdwStatement *fstmt);
+extern bool mysqlStmtCached(MySQLFdwStatement *fstmt);
+extern void mysqlStmtRewind(MySQLFdwStatement *fstmt);
+extern void mysqlStmtTrustEncoding(MySQLFdwStatement *fstmt);
+extern void mysqlStmtEnd(MySQLFdwStatement *fstmt);
+
+/* in prefetch.c */
+extern MySQLFdwPrefetch *mysqlPrefetchStart(MYSQL *conn, MYSQL_RES *result,
+											int nbatches, int batch_size);
+extern bool mysqlPrefetchNext(MySQLFdwPrefetch *pf, char ***row,
+							  unsigned long **lengths);
+extern bool mysqlPrefetchFinished(MySQLFdwPrefetch *pf);
+extern void mysqlPrefetchStop(MySQLFdwPrefetch *pf);
+
+/* in parallel.c */
+extern MySQLFdwSplitScan *mysqlSplitScanBegin(MySQLFdwOptions *opts,
+											  const char *query,
+											  bool has_where, int nconns);
+extern bool mysqlSplitScanNext(MySQLFdwSplitScan *ss, char ***row,
+							   unsigned long **lengths);
+extern unsigned int mysqlSplitScanNumFields(MySQLFdwSplitScan *ss);
+extern void mysqlSplitScanEnd(MySQLFdwSplitScan *ss);
+
+/* in materialize.c */
+extern Oid	mysqlGetSnapshot(Oid relid, MySQLFdwOptions *opts);
+extern void mysqlSnapshotSize(Oid localrelid, BlockNumber *pages,
+							  double *tuples);
+extern MySQLFdwLocalScan *mysqlLocalScanBegin(Oid localrelid,
+											  TupleDesc tupdesc);
+extern bool mysqlLocalScanNext(MySQLFdwLocalScan *ls, Datum *values,
+							   bool *nulls);
+extern void mysqlLocalScanRescan(MySQLFdwLocalScan *ls);
+extern void mysqlLocalScanEnd(MySQLFdwLocalScan *ls);
+extern char *mysqlLocalScanRelName(MySQLFdwLocalScan *ls);
+
+/* in metrics.c */
+extern void mysqlInitMetrics(void);
+extern void mysqlMetricsAddQuery(MySQLFdwMetrics *m, double first_row_ms);
+extern void mysqlMetricsReport(Oid serverid, MySQLFdwMetrics *m);
+extern void mysqlMetricsError(Oid serverid);
+
+/* in replicas.c */
+extern void mysqlInitReplicas(void);
+extern int	mysqlParseHosts(const char *list, char ***addresses, int **ports);
+extern int	mysqlHostInflight(Oid serverid, const char *address, int port);
+extern void mysqlHostAddInflight(Oid serverid, const char *address, int port,
+								 int delta);
+extern void mysqlHostConnected(Oid serverid, const char *address, int port,
+							   bool ok);
+extern int	mysqlHostGetLag(Oid serverid, const char *address, int port);
+extern void mysqlHostSetLag(Oid serverid, const char *address, int port,
+							int lag);
+
+/* in cache.c */
+extern void mysqlInitResultCache(void);
+extern MySQLFdwCachedResult *mysqlCacheLookup(MySQLFdwOptions *opts,
+											  const char *query);
+extern void mysqlCacheStore(MySQLFdwOptions *opts, Oid relid,
+							const char *query, MYSQL_RES *result);
+extern bool mysqlCacheNext(MySQLFdwCachedResult *cr, char ***row,
+						   unsigned long **lengths);
+extern unsigned int mysqlCacheNumFields(MySQLFdwCachedResult *cr);
+extern void mysqlCacheRewind(MySQLFdwCachedResult *cr);
+
+extern Datum mysql_fdw_get_connections(PG_FUNCTION_ARGS);
+extern Datum mysql_fdw_disconnect(PG_FUNCTION_ARGS);
+extern Datum mysql_fdw_disconnect_all(PG_FUNCTION_ARGS);
+extern Datum mysql_fdw_refresh_stats(PG_FUNCTION_ARGS);
+extern Datum mysql_fdw_calibrate(PG_FUNCTION_ARGS);
+extern Datum mysql_fdw_insert(PG_FUNCTION_ARGS);
+extern Datum mysql_fdw_update(PG_FUNCTION_ARGS);
+extern Datum mysql_fdw_delete(PG_FUNCTION_ARGS);
+extern Datum mysql_fdw_refresh(PG_FUNCTION_ARGS);
+extern Datum mysql_fdw_result_cache_reset(PG_FUNCTION_ARGS);
+extern Datum mysql_fdw_result_cache_invalidate(PG_FUNCTION_ARGS);
+extern Datum mysql_fdw_result_cache_stats(PG_FUNCTION_ARGS);
+extern Datum mysql_fdw_server_stats(PG_FUNCTION_ARGS);
+extern Datum mysql_fdw_stats_reset(PG_FUNCTION_ARGS);
+extern Datum mysql_fdw_hosts(PG_FUNCTION_ARGS);
+
+#endif   /* MYSQL_FDW_H */
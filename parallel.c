@@ -0,0 +1,306 @@
+/*-------------------------------------------------------------------------
+ *
+ *		  foreign-data wrapper for MySQL
+ *
+ * Copyright (c) 2011, PostgreSQL Global Development Group
+ *
+ * This software is released under the PostgreSQL Licence
+ *
+ * Author: Dave Page <dpage@pgadmin.org>
+ *
+ * IDENTIFICATION
+ *		  mysql_fdw/parallel.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "mysql_fdw.h"
+
+/*
+ * Split scans.
+ *
+ * A large table is read over several connections at once, each fetching a
+ * range of values of an integer key column, so that MySQL reads and sends
+ * the ranges in parallel. Each connection's rows are read ahead by its own
+ * prefetch thread (see prefetch.c), and the scan takes batches of rows
+ * from each in turn. The order of the rows is therefore not that of a
+ * single query, which doesn't matter since a scan promises none.
+ *
+ * Each range is read from the same host, in a transaction started WITH
+ * CONSISTENT SNAPSHOT, all of them begun together before any range query
+ * is sent, so that the ranges see the table as of (nearly) the same
+ * moment, however long each takes to read. MySQL can't share one snapshot
+ * between sessions, so a change committed while the transactions are
+ * starting may still be seen by some ranges but not others.
+ */
+
+#define SPLIT_BEGIN_SQL		"START TRANSACTION WITH CONSISTENT SNAPSHOT"
+
+/* Batches read ahead per connection, unless prefetch_buffers says */
+#define SPLIT_DEFAULT_BUFFERS	4
+
+typedef struct MySQLFdwSplitPart
+{
+	MYSQL	   *conn;
+	MYSQL_RES  *result;
+	MySQLFdwPrefetch *prefetch;
+	bool		done;			/* all rows read and connection released */
+} MySQLFdwSplitPart;
+
+struct MySQLFdwSplitScan
+{
+	int			nparts;
+	MySQLFdwSplitPart *parts;
+	int			nactive;		/* parts not yet done */
+	int			current;		/* part we're reading from */
+	int			taken;			/* rows taken from it in this turn */
+	int			batch_size;		/* rows to take from a part per turn */
+	unsigned int nfields;
+};
+
+static void mysqlSplitPartEnd(MySQLFdwSplitPart *part);
+static void mysqlSplitPartError(MySQLFdwSplitPart *part);
+
+/*
+ * mysqlSplitScanBegin
+ *		Start reading a query over up to nconns connections, by appending a
+ *		range condition on the split column to it for each. Returns NULL if
+ *		the table has no column to split on, or too few values to split.
+ *
+ * has_where says whether the query already has a WHERE clause.
+ */
+MySQLFdwSplitScan *
+mysqlSplitScanBegin(MySQLFdwOptions *opts, const char *query, bool has_where,
+					int nconns)
+{
+	MYSQL	   *conn = mysqlGetConnection(opts, false);
+	MySQLFdwSplitScan *ss;
+	char	   *column;
+	int64		min;
+	int64		max;
+	uint64		span;
+	int			nbuffers;
+	int			i;
+
+	column = opts->split_column;
+	if (column == NULL)
+		column = mysqlGetSplitColumn(conn, opts);
+	if (column == NULL ||
+		!mysqlGetSplitBounds(conn, opts, column, &min, &max))
+		return NULL;
+
+	/* Every range must have at least one value in it */
+	span = (uint64) max - (uint64) min;
+	if (span < (uint64) nconns)
+		nconns = (int) span;
+	if (nconns < 2)
+		return NULL;
+
+	nbuffers = opts->prefetch_buffers > 0 ?
+		opts->prefetch_buffers : SPLIT_DEFAULT_BUFFERS;
+
+	ss = (MySQLFdwSplitScan *) palloc0(sizeof(MySQLFdwSplitScan));
+	ss->nparts = nconns;
+	ss->parts = (MySQLFdwSplitPart *) palloc0(sizeof(MySQLFdwSplitPart) * nconns);
+	ss->batch_size = opts->prefetch_batch_size;
+
+	/*
+	 * Take the snapshots as close together as we can, all on the same host:
+	 * replicas that are behind by different amounts would give each range
+	 * a different view of the table.
+	 */
+	for (i = 0; i < nconns; i++)
+	{
+		MySQLFdwSplitPart *part = &ss->parts[i];
+
+		if (i == 0)
+			part->conn = mysqlGetConnection(opts, true);
+		else
+			part->conn = mysqlGetSiblingConnection(opts, ss->parts[0].conn);
+		if (mysql_send_query(part->conn, SPLIT_BEGIN_SQL,
+							 strlen(SPLIT_BEGIN_SQL)) != 0)
+			mysqlSplitPartError(part);
+	}
+	for (i = 0; i < nconns; i++)
+	{
+		MySQLFdwSplitPart *part = &ss->parts[i];
+
+		mysqlWaitForResult(part->conn);
+		if (mysql_read_query_result(part->conn) != 0)
+			mysqlSplitPartError(part);
+	}
+
+	/*
+	 * Send all the queries before waiting for any, so that MySQL starts on
+	 * them all at once. Should one fail, those already running are stopped
+	 * when the connections are closed by the abort, which ends their
+	 * transactions too.
+	 */
+	for (i = 0; i < nconns; i++)
+	{
+		MySQLFdwSplitPart *part = &ss->parts[i];
+		StringInfoData sql;
+		int64		lo = min + (int64) ((span / nconns) * i);
+		int64		hi = min + (int64) ((span / nconns) * (i + 1));
+
+		initStringInfo(&sql);
+		appendStringInfo(&sql, "%s %s (", query, has_where ? "AND" : "WHERE");
+		if (i == 0)
+		{
+			mysqlQuoteIdentifier(&sql, column);
+			appendStringInfoString(&sql, " IS NULL OR ");
+		}
+		else
+		{
+			mysqlQuoteIdentifier(&sql, column);
+			appendStringInfo(&sql, " >= " INT64_FORMAT, lo);
+		}
+		if (i < nconns - 1)
+		{
+			if (i > 0)
+				appendStringInfoString(&sql, " AND ");
+			mysqlQuoteIdentifier(&sql, column);
+			appendStringInfo(&sql, " < " INT64_FORMAT, hi);
+		}
+		appendStringInfoChar(&sql, ')');
+
+		if (mysql_send_query(part->conn, sql.data, strlen(sql.data)) != 0)
+			mysqlSplitPartError(part);
+		pfree(sql.data);
+	}
+
+	for (i = 0; i < nconns; i++)
+	{
+		MySQLFdwSplitPart *part = &ss->parts[i];
+
+		mysqlWaitForResult(part->conn);
+		if (mysql_read_query_result(part->conn) != 0 ||
+			(part->result = mysql_use_result(part->conn)) == NULL)
+			mysqlSplitPartError(part);
+		mysqlSetPendingResult(part->conn, part->result);
+
+		part->prefetch = mysqlPrefetchStart(part->conn, part->result,
+											nbuffers, ss->batch_size);
+	}
+
+	ss->nactive = nconns;
+	ss->nfields = mysql_num_fields(ss->parts[0].result);
+
+	return ss;
+}
+
+/*
+ * mysqlSplitScanNext
+ *		Get the next row of a split scan, returning false once every range
+ *		has been read. The row is valid until the next call.
+ */
+bool
+mysqlSplitScanNext(MySQLFdwSplitScan *ss, char ***row, unsigned long **lengths)
+{
+	for (;;)
+	{
+		MySQLFdwSplitPart *part = &ss->parts[ss->current];
+
+		if (!part->done && ss->taken < ss->batch_size)
+		{
+			if (mysqlPrefetchNext(part->prefetch, row, lengths))
+			{
+				ss->taken++;
+				return true;
+			}
+
+			mysqlSplitPartEnd(part);
+			ss->nactive--;
+		}
+
+		if (ss->nactive == 0)
+			return false;
+
+		ss->current = (ss->current + 1) % ss->nparts;
+		ss->taken = 0;
+	}
+}
+
+/*
+ * mysqlSplitScanNumFields
+ *		Return the number of fields in the rows of a split scan.
+ */
+unsigned int
+mysqlSplitScanNumFields(MySQLFdwSplitScan *ss)
+{
+	return ss->nfields;
+}
+
+/*
+ * mysqlSplitScanEnd
+ *		Stop a split scan, discarding any rows not yet read. The queries of
+ *		ranges that haven't been read to the end are cancelled, rather than
+ *		the rest of their rows being read just to be thrown away.
+ */
+void
+mysqlSplitScanEnd(MySQLFdwSplitScan *ss)
+{
+	int			i;
+
+	for (i = 0; i < ss->nparts; i++)
+	{
+		MySQLFdwSplitPart *part = &ss->parts[i];
+
+		if (part->done || !part->conn)
+			continue;
+
+		if (part->prefetch && !mysqlPrefetchFinished(part->prefetch))
+		{
+			/* This stops the prefetch and frees the result too */
+			mysqlCancelQuery(part->conn);
+			part->prefetch = NULL;
+			part->result = NULL;
+			part->conn = NULL;
+			part->done = true;
+		}
+		else
+			mysqlSplitPartEnd(part);
+	}
+
+	pfree(ss->parts);
+	pfree(ss);
+}
+
+/*
+ * Stop reading a range, end its transaction, and give its connection back.
+ */
+static void
+mysqlSplitPartEnd(MySQLFdwSplitPart *part)
+{
+	mysqlPrefetchStop(part->prefetch);
+	mysqlSetPendingResult(part->conn, NULL);
+	mysql_free_result(part->result);
+
+	/* It only read, so there's nothing to lose if this fails */
+	if (mysql_query(part->conn, "COMMIT") != 0)
+		mysqlDiscardConnection(part->conn);
+	else
+		mysqlReleaseConnection(part->conn);
+
+	part->prefetch = NULL;
+	part->result = NULL;
+	part->conn = NULL;
+	part->done = true;
+}
+
+/*
+ * Report a failure of a range's connection, which is closed.
+ */
+static void
+mysqlSplitPartError(MySQLFdwSplitPart *part)
+{
+	char	   *err = pstrdup(mysql_error(part->conn));
+
+	mysqlDiscardConnection(part->conn);
+	part->conn = NULL;
+	ereport(ERROR,
+		(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+		errmsg("failed to execute the MySQL query: %s", err)));
+}
@@ -0,0 +1,479 @@
+/*-------------------------------------------------------------------------
+ *
+ *		  foreign-data wrapper for MySQL
+ *
+ * Copyright (c) 2011, PostgreSQL Global Development Group
+ *
+ * This software is released under the PostgreSQL Licence
+ *
+ * Author: Dave Page <dpage@pgadmin.org>
+ *
+ * IDENTIFICATION
+ *		  mysql_fdw/prefetch.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "mysql_fdw.h"
+
+#include "miscadmin.h"
+
+/*
+ * Prefetching streamed results.
+ *
+ * A helper thread reads rows with mysql_fetch_row() and copies them into a
+ * ring of batches, while the backend converts the rows of the batches
+ * already read. Network time and conversion time then overlap rather than
+ * add up.
+ *
+ * The helper thread must not call into PostgreSQL at all: it uses only
+ * libmysqlclient, malloc() and pthreads, and everything it touches is
+ * malloc'd so it doesn't depend on memory contexts. Likewise the backend
+ * doesn't touch the connection while the thread is running.
+ */
+
+/* Offset recorded for a NULL value */
+#define PREFETCH_NULL	((size_t) -1)
+
+/* How often a waiting backend checks for interrupts, in milliseconds */
+#define PREFETCH_WAIT_MS	100
+
+typedef struct MySQLFdwBatch
+{
+	int			nrows;			/* rows in the batch */
+	size_t	   *offsets;		/* of each value in data, per row and field */
+	unsigned long *lengths;		/* of each value, likewise */
+	char	   *data;			/* values, each NUL terminated */
+	size_t		used;
+	size_t		size;
+} MySQLFdwBatch;
+
+struct MySQLFdwPrefetch
+{
+	MYSQL	   *conn;
+	int			fd;				/* conn's socket */
+	MYSQL_RES  *result;
+	unsigned int nfields;
+	int			batch_size;		/* rows per batch */
+	int			nbatches;		/* batches in the ring */
+	MySQLFdwBatch *batches;
+
+	/* protected by lock */
+	pthread_mutex_t lock;
+	pthread_cond_t filled;		/* signalled when a batch is filled */
+	pthread_cond_t emptied;		/* signalled when a batch is consumed */
+	int			count;			/* batches filled and not yet consumed */
+	bool		done;			/* no more rows to read */
+	bool		failed;			/* reading failed, see errmsg */
+	bool		cancel;			/* backend wants the thread to stop */
+	char		errmsg[256];
+
+	/* used by the reader thread only */
+	int			head;			/* next batch to fill */
+
+	/* used by the backend only */
+	pthread_t	thread;
+	bool		running;
+	int			tail;			/* batch being consumed */
+	MySQLFdwBatch *current;		/* or NULL if none */
+	int			pos;			/* next row of current to return */
+	char	  **row;			/* pointers to the values of that row */
+};
+
+static void *mysqlPrefetchMain(void *arg);
+static bool mysqlPrefetchFill(MySQLFdwPrefetch *pf, MySQLFdwBatch *batch);
+static void mysqlPrefetchAbort(void *arg);
+static void mysqlPrefetchFree(MySQLFdwPrefetch *pf);
+
+/*
+ * mysqlPrefetchStart
+ *		Start a thread reading the rows of a result from mysql_use_result()
+ *		into nbatches batches of batch_size rows.
+ *
+ * The caller must hold the connection exclusively until the prefetch is
+ * stopped with mysqlPrefetchStop(); if the connection is discarded first,
+ * the thread is stopped then.
+ */
+MySQLFdwPrefetch *
+mysqlPrefetchStart(MYSQL *conn, MYSQL_RES *result, int nbatches,
+				   int batch_size)
+{
+	MySQLFdwPrefetch *pf;
+	sigset_t	blockall;
+	sigset_t	saved;
+	int			rc;
+	int			i;
+
+	pf = (MySQLFdwPrefetch *) calloc(1, sizeof(MySQLFdwPrefetch));
+	if (!pf)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+				 errmsg("out of memory")));
+
+	pthread_mutex_init(&pf->lock, NULL);
+	pthread_cond_init(&pf->filled, NULL);
+	pthread_cond_init(&pf->emptied, NULL);
+
+	pf->conn = conn;
+	pf->fd = mysqlConnectionSocket(conn);
+	pf->result = result;
+	pf->nfields = mysql_num_fields(result);
+	pf->batch_size = batch_size;
+	pf->batches = (MySQLFdwBatch *) calloc(nbatches, sizeof(MySQLFdwBatch));
+	pf->row = (char **) malloc(Max(pf->nfields, 1) * sizeof(char *));
+	if (!pf->batches || !pf->row)
+	{
+		mysqlPrefetchFree(pf);
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+				 errmsg("out of memory")));
+	}
+	pf->nbatches = nbatches;
+
+	for (i = 0; i < nbatches; i++)
+	{
+		MySQLFdwBatch *batch = &pf->batches[i];
+		size_t		nvalues = (size_t) batch_size * Max(pf->nfields, 1);
+
+		batch->offsets = (size_t *) malloc(nvalues * sizeof(size_t));
+		batch->lengths = (unsigned long *) malloc(nvalues * sizeof(unsigned long));
+		if (!batch->offsets || !batch->lengths)
+		{
+			mysqlPrefetchFree(pf);
+			ereport(ERROR,
+					(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+					 errmsg("out of memory")));
+		}
+	}
+
+	/* Signals are for the backend, so the thread must block them all */
+	sigfillset(&blockall);
+	pthread_sigmask(SIG_SETMASK, &blockall, &saved);
+	rc = pthread_create(&pf->thread, NULL, mysqlPrefetchMain, pf);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+	if (rc != 0)
+	{
+		mysqlPrefetchFree(pf);
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_ERROR),
+				 errmsg("could not start MySQL prefetch thread: %s",
+						strerror(rc))));
+	}
+	pf->running = true;
+
+	mysqlSetAbortCallback(conn, mysqlPrefetchAbort, pf);
+
+	return pf;
+}
+
+/*
+ * mysqlPrefetchNext
+ *		Return the next row read by the thread, in the same form as
+ *		mysql_fetch_row() and mysql_fetch_lengths() would, or false at the
+ *		end of the result. The row is valid until the next call.
+ */
+bool
+mysqlPrefetchNext(MySQLFdwPrefetch *pf, char ***row, unsigned long **lengths)
+{
+	for (;;)
+	{
+		MySQLFdwBatch *batch = pf->current;
+
+		if (batch && pf->pos < batch->nrows)
+		{
+			size_t	   *offsets = &batch->offsets[pf->pos * pf->nfields];
+			unsigned int i;
+
+			for (i = 0; i < pf->nfields; i++)
+				pf->row[i] = (offsets[i] == PREFETCH_NULL) ?
+					NULL : batch->data + offsets[i];
+
+			*row = pf->row;
+			*lengths = &batch->lengths[pf->pos * pf->nfields];
+			pf->pos++;
+			return true;
+		}
+
+		pthread_mutex_lock(&pf->lock);
+
+		/* Hand the batch we've finished with back to the thread */
+		if (batch)
+		{
+			pf->current = NULL;
+			pf->tail = (pf->tail + 1) % pf->nbatches;
+			pf->count--;
+			pthread_cond_signal(&pf->emptied);
+		}
+
+		/*
+		 * Wait for the next batch, checking for interrupts now and then.
+		 * We mustn't hold the lock if CHECK_FOR_INTERRUPTS() throws.
+		 */
+		while (pf->count == 0 && !pf->done && !pf->failed)
+		{
+			struct timeval now;
+			struct timespec until;
+
+			gettimeofday(&now, NULL);
+			until.tv_sec = now.tv_sec;
+			until.tv_nsec = now.tv_usec * 1000 + PREFETCH_WAIT_MS * 1000000L;
+			if (until.tv_nsec >= 1000000000L)
+			{
+				until.tv_sec++;
+				until.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&pf->filled, &pf->lock, &until);
+
+			if (pf->count == 0)
+			{
+				pthread_mutex_unlock(&pf->lock);
+				CHECK_FOR_INTERRUPTS();
+				pthread_mutex_lock(&pf->lock);
+			}
+		}
+
+		if (pf->count > 0)
+		{
+			pf->current = &pf->batches[pf->tail];
+			pf->pos = 0;
+			pthread_mutex_unlock(&pf->lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&pf->lock);
+
+		if (pf->failed)
+		{
+			char	   *err = pstrdup(pf->errmsg);
+			MYSQL	   *conn = pf->conn;
+
+			mysqlPrefetchStop(pf);
+			mysqlDiscardConnection(conn);
+			ereport(ERROR,
+					(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+					 errmsg("failed to fetch the MySQL query result: %s", err)));
+		}
+
+		return false;
+	}
+}
+
+/*
+ * mysqlPrefetchFinished
+ *		Has the thread read the whole result? If so, stopping the prefetch
+ *		and freeing the result don't have to wait for MySQL.
+ */
+bool
+mysqlPrefetchFinished(MySQLFdwPrefetch *pf)
+{
+	bool		finished;
+
+	pthread_mutex_lock(&pf->lock);
+	finished = pf->done;
+	pthread_mutex_unlock(&pf->lock);
+
+	return finished;
+}
+
+/*
+ * mysqlPrefetchStop
+ *		Stop the thread and free the prefetch state. The result is left for
+ *		the caller to free.
+ */
+void
+mysqlPrefetchStop(MySQLFdwPrefetch *pf)
+{
+	mysqlSetAbortCallback(pf->conn, NULL, NULL);
+
+	if (pf->running)
+	{
+		pthread_mutex_lock(&pf->lock);
+		pf->cancel = true;
+		pthread_cond_signal(&pf->emptied);
+		pthread_mutex_unlock(&pf->lock);
+
+		/*
+		 * The thread exits once it has the row it is reading, which waits
+		 * for MySQL to send it. Callers that can't wait for that shut the
+		 * socket down first, as mysqlPrefetchAbort() does.
+		 */
+		pthread_join(pf->thread, NULL);
+		pf->running = false;
+	}
+
+	mysqlPrefetchFree(pf);
+}
+
+/*
+ * The connection is being closed by an error or abort. The thread may be
+ * waiting for the server indefinitely, so shut the socket down under it.
+ */
+static void
+mysqlPrefetchAbort(void *arg)
+{
+	MySQLFdwPrefetch *pf = (MySQLFdwPrefetch *) arg;
+
+	if (pf->running && pf->fd >= 0)
+		shutdown(pf->fd, SHUT_RDWR);
+	mysqlPrefetchStop(pf);
+}
+
+/*
+ * Free the prefetch state; the thread must not be running.
+ */
+static void
+mysqlPrefetchFree(MySQLFdwPrefetch *pf)
+{
+	int			i;
+
+	for (i = 0; i < pf->nbatches; i++)
+	{
+		free(pf->batches[i].offsets);
+		free(pf->batches[i].lengths);
+		free(pf->batches[i].data);
+	}
+	free(pf->batches);
+	free(pf->row);
+
+	pthread_mutex_destroy(&pf->lock);
+	pthread_cond_destroy(&pf->filled);
+	pthread_cond_destroy(&pf->emptied);
+
+	free(pf);
+}
+
+/*
+ * Main loop of the reader thread: fill batches until the result is read,
+ * reading fails, or the backend tells us to stop.
+ */
+static void *
+mysqlPrefetchMain(void *arg)
+{
+	MySQLFdwPrefetch *pf = (MySQLFdwPrefetch *) arg;
+
+	mysql_thread_init();
+
+	for (;;)
+	{
+		MySQLFdwBatch *batch;
+		bool		more;
+
+		pthread_mutex_lock(&pf->lock);
+		while (pf->count == pf->nbatches && !pf->cancel)
+			pthread_cond_wait(&pf->emptied, &pf->lock);
+		if (pf->cancel)
+		{
+			pthread_mutex_unlock(&pf->lock);
+			break;
+		}
+		pthread_mutex_unlock(&pf->lock);
+
+		/* The backend doesn't look at this batch until we publish it */
+		batch = &pf->batches[pf->head];
+		more = mysqlPrefetchFill(pf, batch);
+
+		pthread_mutex_lock(&pf->lock);
+		pf->head = (pf->head + 1) % pf->nbatches;
+		pf->count++;
+		if (!more)
+			pf->done = true;
+		pthread_cond_signal(&pf->filled);
+		pthread_mutex_unlock(&pf->lock);
+
+		if (!more)
+			break;
+	}
+
+	mysql_thread_end();
+
+	return NULL;
+}
+
+/*
+ * Read up to batch_size rows into a batch, stopping early if the backend
+ * tells us to. Returns false if there are no more to read, setting
+ * pf->failed if that's because of an error.
+ */
+static bool
+mysqlPrefetchFill(MySQLFdwPrefetch *pf, MySQLFdwBatch *batch)
+{
+	batch->nrows = 0;
+	batch->used = 0;
+
+	while (batch->nrows < pf->batch_size)
+	{
+		MYSQL_ROW	row;
+		unsigned long *lengths;
+		size_t		need = 0;
+		unsigned int i;
+		bool		cancel;
+
+		pthread_mutex_lock(&pf->lock);
+		cancel = pf->cancel;
+		pthread_mutex_unlock(&pf->lock);
+		if (cancel)
+			return true;
+
+		row = mysql_fetch_row(pf->result);
+		if (!row)
+		{
+			if (mysql_errno(pf->conn) != 0)
+			{
+				pthread_mutex_lock(&pf->lock);
+				strlcpy(pf->errmsg, mysql_error(pf->conn), sizeof(pf->errmsg));
+				pf->failed = true;
+				pthread_mutex_unlock(&pf->lock);
+			}
+			return false;
+		}
+
+		lengths = mysql_fetch_lengths(pf->result);
+		for (i = 0; i < pf->nfields; i++)
+			need += lengths[i] + 1;
+
+		if (batch->used + need > batch->size)
+		{
+			size_t		newsize = Max(batch->size * 2, batch->used + need);
+			char	   *data = (char *) realloc(batch->data, newsize);
+
+			if (!data)
+			{
+				pthread_mutex_lock(&pf->lock);
+				strlcpy(pf->errmsg, "out of memory", sizeof(pf->errmsg));
+				pf->failed = true;
+				pthread_mutex_unlock(&pf->lock);
+				return false;
+			}
+			batch->data = data;
+			batch->size = newsize;
+		}
+
+		for (i = 0; i < pf->nfields; i++)
+		{
+			size_t		idx = batch->nrows * pf->nfields + i;
+
+			batch->lengths[idx] = lengths[i];
+			if (row[i] == NULL)
+				batch->offsets[idx] = PREFETCH_NULL;
+			else
+			{
+				batch->offsets[idx] = batch->used;
+				memcpy(batch->data + batch->used, row[i], lengths[i]);
+				batch->data[batch->used + lengths[i]] = '\0';
+				batch->used += lengths[i] + 1;
+			}
+		}
+
+		batch->nrows++;
+	}
+
+	return true;
+}
@@ -0,0 +1,509 @@
+/*-------------------------------------------------------------------------
+ *
+ *		  foreign-data wrapper for MySQL
+ *
+ * Copyright (c) 2011, PostgreSQL Global Development Group
+ *
+ * This software is released under the PostgreSQL Licence
+ *
+ * Author: Dave Page <dpage@pgadmin.org>
+ *
+ * IDENTIFICATION
+ *		  mysql_fdw/replicas.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <ctype.h>
+#include <limits.h>
+
+#include "mysql_fdw.h"
+
+#include "foreign/foreign.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/syscache.h"
+#include "utils/timestamp.h"
+
+/*
+ * The state of the read replicas of foreign servers.
+ *
+ * Scans are sent to the replica with the fewest queries running on it, so
+ * each host has a count of the connections claimed by scans on it. Hosts
+ * that couldn't be connected to are left alone for a while, for longer
+ * each time they fail again, and the replication lag of each is checked
+ * now and then. When mysql_fdw is loaded with shared_preload_libraries
+ * this is kept in shared memory, so that the counts are for all backends;
+ * otherwise each backend keeps its own.
+ */
+typedef struct MySQLFdwHostKey
+{
+	Oid			dbid;			/* database of the foreign server */
+	Oid			serverid;
+	char		address[128];	/* host name, truncated if need be */
+	int			port;
+} MySQLFdwHostKey;
+
+typedef struct MySQLFdwHostEntry
+{
+	MySQLFdwHostKey key;		/* hash key, must be first */
+	int			inflight;		/* connections claimed by scans */
+	int			failures;		/* failed connection attempts in a row */
+	TimestampTz retry_at;		/* don't try to connect again until then */
+	int			lag;			/* seconds behind the primary, -1 if never
+								 * checked, INT_MAX if unknown */
+	TimestampTz lag_checked;	/* when that was found */
+} MySQLFdwHostEntry;
+
+/* Hosts the shared memory has room for */
+#define HOSTS_MAX				256
+
+/* Longest backoff after failing to connect, in seconds */
+#define HOST_MAX_BACKOFF		60
+
+/* How often to check the replication lag of a host, in seconds */
+#define LAG_CHECK_INTERVAL		10
+
+/* Shared state, if we were preloaded, and its lock */
+static HTAB *SharedHosts = NULL;
+static LWLockId *SharedHostsLock = NULL;
+
+/* Otherwise, per-backend state */
+static HTAB *LocalHosts = NULL;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+PG_FUNCTION_INFO_V1(mysql_fdw_hosts);
+
+static void mysqlHostsShmemStartup(void);
+static Size mysqlHostsShmemSize(void);
+static MySQLFdwHostEntry *mysqlHostLock(Oid serverid, const char *address,
+										int port);
+static void mysqlHostUnlock(void);
+
+/*
+ * mysqlInitReplicas
+ *		Reserve shared memory for the state of the replicas if we're being
+ *		preloaded. Called from _PG_init().
+ */
+void
+mysqlInitReplicas(void)
+{
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+	RequestAddinShmemSpace(mysqlHostsShmemSize());
+	RequestAddinLWLocks(1);
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = mysqlHostsShmemStartup;
+}
+
+static Size
+mysqlHostsShmemSize(void)
+{
+	return add_size(MAXALIGN(sizeof(LWLockId)),
+					hash_estimate_size(HOSTS_MAX, sizeof(MySQLFdwHostEntry)));
+}
+
+/*
+ * Attach to, or create, the shared state.
+ */
+static void
+mysqlHostsShmemStartup(void)
+{
+	HASHCTL		info;
+	bool		found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	SharedHostsLock = ShmemInitStruct("mysql_fdw hosts lock",
+									  sizeof(LWLockId), &found);
+	if (!found)
+		*SharedHostsLock = LWLockAssign();
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(MySQLFdwHostKey);
+	info.entrysize = sizeof(MySQLFdwHostEntry);
+	info.hash = tag_hash;
+	SharedHosts = ShmemInitHash("mysql_fdw hosts",
+								HOSTS_MAX, HOSTS_MAX,
+								&info, HASH_ELEM | HASH_FUNCTION);
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * mysqlParseHosts
+ *		Split a list of hosts, such as "db2, db3:3307", into their addresses
+ *		and ports, returning how many there are. A host without a port uses
+ *		the default port of 3306.
+ */
+int
+mysqlParseHosts(const char *list, char ***addresses, int **ports)
+{
+	char	   *copy = pstrdup(list);
+	char	   *p = copy;
+	int			max = 1;
+	int			n = 0;
+
+	for (p = copy; *p; p++)
+	{
+		if (*p == ',')
+			max++;
+	}
+	*addresses = (char **) palloc(max * sizeof(char *));
+	*ports = (int *) palloc(max * sizeof(int));
+
+	p = copy;
+	for (;;)
+	{
+		char	   *end = strchr(p, ',');
+		char	   *colon;
+		char	   *last;
+
+		if (end)
+			*end = '\0';
+
+		/* Trim surrounding spaces */
+		while (isspace((unsigned char) *p))
+			p++;
+		last = p + strlen(p);
+		while (last > p && isspace((unsigned char) last[-1]))
+			*--last = '\0';
+
+		if (*p == '\0')
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+				errmsg("invalid host list: \"%s\"", list)
+				));
+
+		(*ports)[n] = 3306;
+		colon = strrchr(p, ':');
+		if (colon)
+		{
+			char	   *portend;
+			long		port;
+
+			*colon = '\0';
+			port = strtol(colon + 1, &portend, 10);
+			if (portend == colon + 1 || *portend != '\0' || port < 1 ||
+				port > 65535 || *p == '\0')
+				ereport(ERROR,
+					(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+					errmsg("invalid host list: \"%s\"", list)
+					));
+			(*ports)[n] = (int) port;
+		}
+		(*addresses)[n++] = p;
+
+		if (!end)
+			break;
+		p = end + 1;
+	}
+
+	return n;
+}
+
+/*
+ * Find, or add, the state of a host, and lock it. The caller must call
+ * mysqlHostUnlock() without throwing an error meanwhile. Returns NULL,
+ * unlocked, if the shared memory is full.
+ */
+static MySQLFdwHostEntry *
+mysqlHostLock(Oid serverid, const char *address, int port)
+{
+	MySQLFdwHostKey key;
+	MySQLFdwHostEntry *entry;
+	bool		found;
+
+	memset(&key, 0, sizeof(key));
+	key.dbid = MyDatabaseId;
+	key.serverid = serverid;
+	strlcpy(key.address, address ? address : "", sizeof(key.address));
+	key.port = port;
+
+	if (SharedHosts)
+	{
+		LWLockAcquire(*SharedHostsLock, LW_EXCLUSIVE);
+		entry = (MySQLFdwHostEntry *) hash_search(SharedHosts, &key,
+												  HASH_ENTER_NULL, &found);
+		if (entry == NULL)
+		{
+			LWLockRelease(*SharedHostsLock);
+			return NULL;
+		}
+	}
+	else
+	{
+		if (LocalHosts == NULL)
+		{
+			HASHCTL		info;
+
+			memset(&info, 0, sizeof(info));
+			info.keysize = sizeof(MySQLFdwHostKey);
+			info.entrysize = sizeof(MySQLFdwHostEntry);
+			info.hash = tag_hash;
+			info.hcxt = CacheMemoryContext;
+			LocalHosts = hash_create("mysql_fdw hosts", 16, &info,
+									 HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+		}
+		entry = (MySQLFdwHostEntry *) hash_search(LocalHosts, &key,
+												  HASH_ENTER, &found);
+	}
+
+	if (!found)
+	{
+		entry->inflight = 0;
+		entry->failures = 0;
+		entry->retry_at = 0;
+		entry->lag = -1;
+		entry->lag_checked = 0;
+	}
+
+	return entry;
+}
+
+static void
+mysqlHostUnlock(void)
+{
+	if (SharedHosts)
+		LWLockRelease(*SharedHostsLock);
+}
+
+/*
+ * mysqlHostInflight
+ *		Return the number of connections to a host claimed by scans, or -1
+ *		if it failed recently and shouldn't be tried yet.
+ */
+int
+mysqlHostInflight(Oid serverid, const char *address, int port)
+{
+	MySQLFdwHostEntry *entry = mysqlHostLock(serverid, address, port);
+	int			inflight;
+
+	if (entry == NULL)
+		return 0;
+
+	if (entry->failures > 0 && entry->retry_at > GetCurrentTimestamp())
+		inflight = -1;
+	else
+		inflight = entry->inflight;
+
+	mysqlHostUnlock();
+	return inflight;
+}
+
+/*
+ * mysqlHostAddInflight
+ *		Count a connection to a host being claimed (delta 1) or released
+ *		(delta -1) by a scan.
+ */
+void
+mysqlHostAddInflight(Oid serverid, const char *address, int port, int delta)
+{
+	MySQLFdwHostEntry *entry = mysqlHostLock(serverid, address, port);
+
+	if (entry == NULL)
+		return;
+
+	entry->inflight = Max(entry->inflight + delta, 0);
+	mysqlHostUnlock();
+}
+
+/*
+ * mysqlHostConnected
+ *		Note whether connecting to a host worked. After a failure, it isn't
+ *		tried again for a second, doubling with each further failure up to
+ *		HOST_MAX_BACKOFF seconds.
+ */
+void
+mysqlHostConnected(Oid serverid, const char *address, int port, bool ok)
+{
+	MySQLFdwHostEntry *entry = mysqlHostLock(serverid, address, port);
+
+	if (entry == NULL)
+		return;
+
+	if (ok)
+		entry->failures = 0;
+	else
+	{
+		int			backoff;
+
+		entry->failures++;
+		backoff = entry->failures > 6 ? HOST_MAX_BACKOFF :
+			Min(1 << (entry->failures - 1), HOST_MAX_BACKOFF);
+		entry->retry_at = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+													  backoff * 1000);
+	}
+
+	mysqlHostUnlock();
+}
+
+/*
+ * mysqlHostGetLag
+ *		Return the replication lag last found for a host, or -1 if it's
+ *		time to check it again.
+ */
+int
+mysqlHostGetLag(Oid serverid, const char *address, int port)
+{
+	MySQLFdwHostEntry *entry = mysqlHostLock(serverid, address, port);
+	int			lag = -1;
+
+	if (entry == NULL)
+		return -1;
+
+	if (entry->lag >= 0 &&
+		!TimestampDifferenceExceeds(entry->lag_checked, GetCurrentTimestamp(),
+									LAG_CHECK_INTERVAL * 1000))
+		lag = entry->lag;
+
+	mysqlHostUnlock();
+	return lag;
+}
+
+/*
+ * mysqlHostSetLag
+ *		Remember the replication lag of a host, in seconds, or INT_MAX if
+ *		it couldn't be found.
+ */
+void
+mysqlHostSetLag(Oid serverid, const char *address, int port, int lag)
+{
+	MySQLFdwHostEntry *entry = mysqlHostLock(serverid, address, port);
+
+	if (entry == NULL)
+		return;
+
+	entry->lag = lag;
+	entry->lag_checked = GetCurrentTimestamp();
+	mysqlHostUnlock();
+}
+
+/*
+ * mysql_fdw_hosts
+ *		List the replicas of the current database's foreign servers that
+ *		have been used, with their state.
+ */
+Datum
+mysql_fdw_hosts(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	HTAB	   *hosts = SharedHosts ? SharedHosts : LocalHosts;
+	HASH_SEQ_STATUS scan;
+	MySQLFdwHostEntry *entry;
+	MySQLFdwHostEntry *entries;
+	int			nentries = 0;
+	int			maxentries = 16;
+	TimestampTz now = GetCurrentTimestamp();
+	int			i;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	if (hosts == NULL)
+	{
+		tuplestore_donestoring(tupstore);
+		return (Datum) 0;
+	}
+
+	/*
+	 * Copy this database's entries out, so that the catalogs aren't read
+	 * while every backend's scans wait for the lock.
+	 */
+	entries = (MySQLFdwHostEntry *)
+		palloc(maxentries * sizeof(MySQLFdwHostEntry));
+
+	if (SharedHosts)
+		LWLockAcquire(*SharedHostsLock, LW_SHARED);
+
+	hash_seq_init(&scan, hosts);
+	while ((entry = (MySQLFdwHostEntry *) hash_seq_search(&scan)))
+	{
+		if (entry->key.dbid != MyDatabaseId)
+			continue;
+		if (nentries == maxentries)
+		{
+			maxentries *= 2;
+			entries = (MySQLFdwHostEntry *)
+				repalloc(entries, maxentries * sizeof(MySQLFdwHostEntry));
+		}
+		entries[nentries++] = *entry;
+	}
+
+	if (SharedHosts)
+		LWLockRelease(*SharedHostsLock);
+
+	for (i = 0; i < nentries; i++)
+	{
+		Datum		values[7];
+		bool		nulls[7];
+
+		entry = &entries[i];
+
+		/* Skip dropped servers */
+		if (!SearchSysCacheExists1(FOREIGNSERVEROID,
+								   ObjectIdGetDatum(entry->key.serverid)))
+			continue;
+
+		MemSet(nulls, 0, sizeof(nulls));
+
+		values[0] = CStringGetTextDatum(GetForeignServer(entry->key.serverid)->servername);
+		values[1] = CStringGetTextDatum(entry->key.address);
+		values[2] = Int32GetDatum(entry->key.port);
+		values[3] = Int32GetDatum(entry->inflight);
+		values[4] = Int32GetDatum(entry->failures);
+		if (entry->failures > 0 && entry->retry_at > now)
+			values[5] = TimestampTzGetDatum(entry->retry_at);
+		else
+			nulls[5] = true;
+		if (entry->lag >= 0 && entry->lag != INT_MAX)
+			values[6] = Int32GetDatum(entry->lag);
+		else
+			nulls[6] = true;
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	pfree(entries);
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
@@ -0,0 +1,661 @@
+/*-------------------------------------------------------------------------
+ *
+ *		  foreign-data wrapper for MySQL
+ *
+ * Copyright (c) 2011, PostgreSQL Global Development Group
+ *
+ * This software is released under the PostgreSQL Licence
+ *
+ * Author: Dave Page <dpage@pgadmin.org>
+ *
+ * IDENTIFICATION
+ *		  mysql_fdw/statement.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "mysql_fdw.h"
+
+#include "catalog/pg_type.h"
+#include "miscadmin.h"
+#include "parser/parse_coerce.h"
+#include "pgtime.h"
+#include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/datetime.h"
+#include "utils/lsyscache.h"
+#include "utils/timestamp.h"
+
+/*
+ * Scans using the binary protocol run the query as a prepared statement,
+ * and have libmysqlclient put each value straight into a C variable of the
+ * column's type, rather than MySQL printing it for us to parse again.
+ * Types without a native binding are fetched as strings and go through the
+ * type's input function, as with the text protocol.
+ */
+typedef enum MySQLFdwBindKind
+{
+	BIND_INT2,
+	BIND_INT4,
+	BIND_INT8,
+	BIND_FLOAT4,
+	BIND_FLOAT8,
+	BIND_BOOL,
+	BIND_DATE,
+	BIND_TIMESTAMP,
+	BIND_TIMESTAMPTZ,
+	BIND_STRING
+} MySQLFdwBindKind;
+
+/* Initial size of string buffers, longer values are fetched separately */
+#define MYSQL_FDW_STRING_BUFFER	1024
+
+typedef struct MySQLFdwBindColumn
+{
+	int			attnum;			/* attribute the value goes into */
+	Oid			type;			/* and its type */
+	MySQLFdwBindKind kind;
+	union
+	{
+		int16		i2;
+		int32		i4;
+		int64		i8;
+		float		f4;
+		double		f8;
+		signed char	b;
+		MYSQL_TIME	t;
+	}			value;			/* buffer for native values */
+	char	   *buffer;			/* buffer for strings */
+	unsigned long buflen;		/* its size, less the terminator */
+	unsigned long length;		/* length of the fetched value */
+	mysql_bool	is_null;
+	mysql_bool	error;			/* value didn't fit the buffer */
+
+	/* for BIND_STRING */
+	FmgrInfo	infunc;
+	Oid			ioparam;
+	int32		typmod;
+	bool		is_string;		/* needs encoding verification? */
+	bool		trusted;		/* converted by MySQL, so only NULs need it? */
+} MySQLFdwBindColumn;
+
+/*
+ * Parameters are sent in binary too, if they're integers or booleans, and
+ * otherwise as strings for MySQL to convert.
+ */
+typedef struct MySQLFdwBindParam
+{
+	Oid			type;
+	int64		i8;				/* buffer for integers */
+	signed char	b;				/* buffer for booleans */
+	char	   *str;			/* buffer for strings */
+	unsigned long length;		/* length of the string */
+	mysql_bool	is_null;
+	FmgrInfo	outfunc;		/* for strings */
+} MySQLFdwBindParam;
+
+struct MySQLFdwStatement
+{
+	MYSQL	   *conn;
+	MYSQL_STMT *stmt;
+	MemoryContext cxt;			/* for state that outlives a row */
+	MYSQL_BIND *binds;			/* one per result field */
+	MySQLFdwBindColumn *cols;	/* one per fetched attribute */
+	int			ncols;
+	MYSQL_BIND *param_binds;	/* one per parameter */
+	MySQLFdwBindParam *params;
+	int			nparams;
+	bool		buffered;		/* result held client side? */
+	bool		cached;			/* prepared by an earlier scan? */
+	uint64		bytes;			/* of the values fetched so far */
+};
+
+static void mysqlStmtError(MySQLFdwStatement *fstmt, const char *what);
+static char *mysqlParamOutput(MySQLFdwBindParam *param, Datum value);
+static void mysqlBindColumn(MySQLFdwBindColumn *col, MYSQL_BIND *bind,
+							Form_pg_attribute attr);
+static Datum mysqlConvertColumn(MySQLFdwStatement *fstmt,
+								MySQLFdwBindColumn *col, int field,
+								bool *isnull);
+
+/*
+ * mysqlStmtBegin
+ *		Prepare a query with the binary protocol, to be run with
+ *		mysqlStmtExecute()
+ *
+ * The values of result field i are stored in attribute attnums[i] of rows
+ * fetched with mysqlStmtFetch(). The query has nparams placeholders, of
+ * the given types. The statement is registered with the connection cache,
+ * so the caller must hold the connection exclusively until mysqlStmtEnd().
+ * It may have been prepared already, if the connection keeps statements.
+ */
+MySQLFdwStatement *
+mysqlStmtBegin(MYSQL *conn, const char *query, TupleDesc tupdesc,
+			   int *attnums, int num_attrs, bool buffered,
+			   Oid *paramtypes, int nparams)
+{
+	MySQLFdwStatement *fstmt;
+	unsigned int nfields;
+	unsigned int i;
+
+	fstmt = (MySQLFdwStatement *) palloc0(sizeof(MySQLFdwStatement));
+	fstmt->conn = conn;
+	fstmt->cxt = CurrentMemoryContext;
+	fstmt->buffered = buffered;
+
+	fstmt->stmt = mysqlPrepareStatement(conn, query, &fstmt->cached);
+	mysqlSetPendingStatement(conn, fstmt->stmt);
+
+	nfields = mysql_stmt_field_count(fstmt->stmt);
+	fstmt->ncols = Min(nfields, num_attrs);
+	fstmt->binds = (MYSQL_BIND *) palloc0(Max(nfields, 1) * sizeof(MYSQL_BIND));
+	fstmt->cols = (MySQLFdwBindColumn *)
+		palloc0(Max(fstmt->ncols, 1) * sizeof(MySQLFdwBindColumn));
+
+	/* Fields beyond those we want are ignored */
+	for (i = 0; i < nfields; i++)
+	{
+		if (i < fstmt->ncols)
+		{
+			fstmt->cols[i].attnum = attnums[i];
+			mysqlBindColumn(&fstmt->cols[i], &fstmt->binds[i],
+							tupdesc->attrs[attnums[i] - 1]);
+		}
+		else
+			fstmt->binds[i].buffer_type = MYSQL_TYPE_NULL;
+	}
+
+	if (mysql_stmt_bind_result(fstmt->stmt, fstmt->binds) != 0)
+		mysqlStmtError(fstmt, "failed to bind the MySQL query result");
+
+	fstmt->nparams = nparams;
+	fstmt->param_binds = (MYSQL_BIND *) palloc0(Max(nparams, 1) * sizeof(MYSQL_BIND));
+	fstmt->params = (MySQLFdwBindParam *)
+		palloc0(Max(nparams, 1) * sizeof(MySQLFdwBindParam));
+
+	for (i = 0; i < (unsigned int) nparams; i++)
+	{
+		MySQLFdwBindParam *param = &fstmt->params[i];
+		MYSQL_BIND *bind = &fstmt->param_binds[i];
+
+		param->type = paramtypes[i];
+		switch (param->type)
+		{
+			case BOOLOID:
+				bind->buffer_type = MYSQL_TYPE_TINY;
+				bind->buffer = &param->b;
+				break;
+			case INT2OID:
+			case INT4OID:
+			case INT8OID:
+				bind->buffer_type = MYSQL_TYPE_LONGLONG;
+				bind->buffer = &param->i8;
+				break;
+			default:
+				{
+					Oid			typoutput;
+					bool		typIsVarlena;
+
+					getTypeOutputInfo(param->type, &typoutput, &typIsVarlena);
+					fmgr_info(typoutput, &param->outfunc);
+					bind->buffer_type = MYSQL_TYPE_STRING;
+					bind->length = &param->length;
+				}
+				break;
+		}
+		bind->is_null = &param->is_null;
+	}
+
+	return fstmt;
+}
+
+/*
+ * mysqlStmtExecute
+ *		Run a prepared statement with the given parameter values. A buffered
+ *		result is read in full before returning, otherwise rows are read
+ *		from the server as they are fetched.
+ *
+ * The statement can be executed again, with new values, once the caller
+ * has finished with the rows of the previous execution.
+ */
+void
+mysqlStmtExecute(MySQLFdwStatement *fstmt, Datum *values, bool *nulls)
+{
+	int			i;
+
+	mysql_stmt_free_result(fstmt->stmt);
+
+	for (i = 0; i < fstmt->nparams; i++)
+	{
+		MySQLFdwBindParam *param = &fstmt->params[i];
+		MYSQL_BIND *bind = &fstmt->param_binds[i];
+
+		param->is_null = nulls[i];
+		if (nulls[i])
+			continue;
+
+		switch (param->type)
+		{
+			case BOOLOID:
+				param->b = DatumGetBool(values[i]) ? 1 : 0;
+				break;
+			case INT2OID:
+				param->i8 = DatumGetInt16(values[i]);
+				break;
+			case INT4OID:
+				param->i8 = DatumGetInt32(values[i]);
+				break;
+			case INT8OID:
+				param->i8 = DatumGetInt64(values[i]);
+				break;
+			default:
+				/* Kept with the statement, for mysqlStmtRewind() */
+				if (param->str)
+					pfree(param->str);
+				param->str = MemoryContextStrdup(fstmt->cxt,
+												 mysqlParamOutput(param,
+																  values[i]));
+				param->length = strlen(param->str);
+				bind->buffer = param->str;
+				bind->buffer_length = param->length;
+				break;
+		}
+	}
+
+	if (fstmt->nparams > 0 &&
+		mysql_stmt_bind_param(fstmt->stmt, fstmt->param_binds) != 0)
+		mysqlStmtError(fstmt, "failed to bind the MySQL query parameters");
+
+	if (mysql_stmt_execute(fstmt->stmt) != 0)
+		mysqlStmtError(fstmt, "failed to execute the MySQL query");
+
+	if (fstmt->buffered && mysql_stmt_store_result(fstmt->stmt) != 0)
+		mysqlStmtError(fstmt, "failed to fetch the MySQL query result");
+}
+
+/*
+ * mysqlStmtFetch
+ *		Fetch the next row into the given arrays, which must be sized for
+ *		the tuple descriptor. Returns false at the end of the result.
+ *
+ * Only the attributes being fetched are set.
+ */
+bool
+mysqlStmtFetch(MySQLFdwStatement *fstmt, Datum *values, bool *nulls)
+{
+	int			rc;
+	int			i;
+
+	rc = mysql_stmt_fetch(fstmt->stmt);
+	if (rc == MYSQL_NO_DATA)
+		return false;
+	if (rc == 1)
+		mysqlStmtError(fstmt, "failed to fetch the MySQL query result");
+
+	for (i = 0; i < fstmt->ncols; i++)
+	{
+		MySQLFdwBindColumn *col = &fstmt->cols[i];
+		int			att = col->attnum - 1;
+
+		values[att] = mysqlConvertColumn(fstmt, col, i, &nulls[att]);
+		if (!col->is_null)
+			fstmt->bytes += col->length;
+	}
+
+	return true;
+}
+
+/*
+ * mysqlStmtAffectedRows
+ *		Return the number of rows changed by the last execution of an
+ *		INSERT, UPDATE or DELETE statement
+ */
+uint64
+mysqlStmtAffectedRows(MySQLFdwStatement *fstmt)
+{
+	return (uint64) mysql_stmt_affected_rows(fstmt->stmt);
+}
+
+/*
+ * mysqlStmtCached
+ *		Was the statement prepared already, by an earlier scan?
+ */
+bool
+mysqlStmtCached(MySQLFdwStatement *fstmt)
+{
+	return fstmt->cached;
+}
+
+/*
+ * mysqlStmtBytes
+ *		Return the total length of the values fetched by a statement
+ */
+uint64
+mysqlStmtBytes(MySQLFdwStatement *fstmt)
+{
+	return fstmt->bytes;
+}
+
+/*
+ * mysqlStmtTrustEncoding
+ *		Stop verifying the encoding of string fields, other than those of
+ *		raw bytes, as for mysqlConverterTrustEncoding().
+ */
+void
+mysqlStmtTrustEncoding(MySQLFdwStatement *fstmt)
+{
+	MYSQL_RES  *meta = mysql_stmt_result_metadata(fstmt->stmt);
+	MYSQL_FIELD *fields;
+	int			i;
+
+	if (meta == NULL)
+		return;
+
+	fields = mysql_fetch_fields(meta);
+	for (i = 0; i < fstmt->ncols; i++)
+	{
+		if (fields[i].charsetnr != MYSQL_BINARY_CHARSET)
+			fstmt->cols[i].trusted = true;
+	}
+	mysql_free_result(meta);
+}
+
+/*
+ * mysqlStmtRewind
+ *		Go back to the start of a buffered result, or run the statement
+ *		again, with the same parameters, otherwise.
+ */
+void
+mysqlStmtRewind(MySQLFdwStatement *fstmt)
+{
+	if (fstmt->buffered)
+		mysql_stmt_data_seek(fstmt->stmt, 0);
+	else
+	{
+		mysql_stmt_free_result(fstmt->stmt);
+		if (mysql_stmt_execute(fstmt->stmt) != 0)
+			mysqlStmtError(fstmt, "failed to execute the MySQL query");
+	}
+}
+
+/*
+ * mysqlStmtEnd
+ *		Give back the statement, discarding any rows not yet read
+ */
+void
+mysqlStmtEnd(MySQLFdwStatement *fstmt)
+{
+	mysqlSetPendingStatement(fstmt->conn, NULL);
+	mysqlReleaseStatement(fstmt->conn, fstmt->stmt);
+	fstmt->stmt = NULL;
+}
+
+/*
+ * Report a failure of the statement, after dropping the connection (which
+ * takes the statement with it), since we don't know what state it's in.
+ */
+static void
+mysqlStmtError(MySQLFdwStatement *fstmt, const char *what)
+{
+	char	   *err = pstrdup(mysql_stmt_error(fstmt->stmt));
+
+	mysqlDiscardConnection(fstmt->conn);
+	fstmt->stmt = NULL;
+
+	ereport(ERROR,
+			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+			 errmsg("%s: %s", what, err)));
+}
+
+/*
+ * Print a parameter sent as a string. Dates and floats are printed in a
+ * style MySQL reads back exactly, whatever the session settings are.
+ */
+static char *
+mysqlParamOutput(MySQLFdwBindParam *param, Datum value)
+{
+	int			save_datestyle = DateStyle;
+	int			save_float_digits = extra_float_digits;
+	char	   *extval;
+
+	if (param->type != DATEOID && param->type != TIMESTAMPOID &&
+		param->type != FLOAT4OID && param->type != FLOAT8OID)
+		return OutputFunctionCall(&param->outfunc, value);
+
+	DateStyle = USE_ISO_DATES;
+	extra_float_digits = 3;
+	PG_TRY();
+	{
+		extval = OutputFunctionCall(&param->outfunc, value);
+	}
+	PG_CATCH();
+	{
+		DateStyle = save_datestyle;
+		extra_float_digits = save_float_digits;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+	DateStyle = save_datestyle;
+	extra_float_digits = save_float_digits;
+
+	return extval;
+}
+
+/*
+ * Set up the buffer for one column, according to its PostgreSQL type.
+ */
+static void
+mysqlBindColumn(MySQLFdwBindColumn *col, MYSQL_BIND *bind,
+				Form_pg_attribute attr)
+{
+	Oid			type = attr->atttypid;
+
+	col->type = type;
+
+	/* Values with a typmod to apply go through the input function */
+	if (attr->atttypmod != -1)
+		col->kind = BIND_STRING;
+	else
+	{
+		switch (type)
+		{
+			case INT2OID:
+				col->kind = BIND_INT2;
+				bind->buffer_type = MYSQL_TYPE_SHORT;
+				bind->buffer = &col->value.i2;
+				break;
+			case INT4OID:
+				col->kind = BIND_INT4;
+				bind->buffer_type = MYSQL_TYPE_LONG;
+				bind->buffer = &col->value.i4;
+				break;
+			case INT8OID:
+				col->kind = BIND_INT8;
+				bind->buffer_type = MYSQL_TYPE_LONGLONG;
+				bind->buffer = &col->value.i8;
+				break;
+			case FLOAT4OID:
+				col->kind = BIND_FLOAT4;
+				bind->buffer_type = MYSQL_TYPE_FLOAT;
+				bind->buffer = &col->value.f4;
+				break;
+			case FLOAT8OID:
+				col->kind = BIND_FLOAT8;
+				bind->buffer_type = MYSQL_TYPE_DOUBLE;
+				bind->buffer = &col->value.f8;
+				break;
+			case BOOLOID:
+				col->kind = BIND_BOOL;
+				bind->buffer_type = MYSQL_TYPE_TINY;
+				bind->buffer = &col->value.b;
+				break;
+			case DATEOID:
+				col->kind = BIND_DATE;
+				bind->buffer_type = MYSQL_TYPE_DATE;
+				bind->buffer = &col->value.t;
+				break;
+			case TIMESTAMPOID:
+				col->kind = BIND_TIMESTAMP;
+				bind->buffer_type = MYSQL_TYPE_DATETIME;
+				bind->buffer = &col->value.t;
+				break;
+			case TIMESTAMPTZOID:
+				col->kind = BIND_TIMESTAMPTZ;
+				bind->buffer_type = MYSQL_TYPE_DATETIME;
+				bind->buffer = &col->value.t;
+				break;
+			default:
+				col->kind = BIND_STRING;
+				break;
+		}
+	}
+
+	if (col->kind == BIND_STRING)
+	{
+		Oid			typinput;
+
+		col->buflen = MYSQL_FDW_STRING_BUFFER;
+		col->buffer = palloc(col->buflen + 1);
+		bind->buffer_type = MYSQL_TYPE_STRING;
+		bind->buffer = col->buffer;
+		bind->buffer_length = col->buflen;
+
+		getTypeInputInfo(type, &typinput, &col->ioparam);
+		fmgr_info(typinput, &col->infunc);
+		col->typmod = attr->atttypmod;
+		col->is_string = (TypeCategory(type) == TYPCATEGORY_STRING);
+	}
+
+	bind->length = &col->length;
+	bind->is_null = &col->is_null;
+	bind->error = &col->error;
+}
+
+/*
+ * Turn the fetched value of a column into a Datum.
+ */
+static Datum
+mysqlConvertColumn(MySQLFdwStatement *fstmt, MySQLFdwBindColumn *col,
+				   int field, bool *isnull)
+{
+	MYSQL_TIME *t = &col->value.t;
+
+	*isnull = col->is_null;
+	if (col->is_null)
+		return (Datum) 0;
+
+	/* Numbers that don't fit are an error, as the input function would */
+	if (col->error && col->kind != BIND_STRING)
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("value of MySQL result column %d is out of range for type %s",
+						field + 1,
+						format_type_be(col->type))));
+
+	switch (col->kind)
+	{
+		case BIND_INT2:
+			return Int16GetDatum(col->value.i2);
+		case BIND_INT4:
+			return Int32GetDatum(col->value.i4);
+		case BIND_INT8:
+			return Int64GetDatum(col->value.i8);
+		case BIND_FLOAT4:
+			return Float4GetDatum(col->value.f4);
+		case BIND_FLOAT8:
+			return Float8GetDatum(col->value.f8);
+		case BIND_BOOL:
+			return BoolGetDatum(col->value.b != 0);
+
+		case BIND_DATE:
+			if (t->year == 0 || t->month == 0 || t->day == 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+						 errmsg("date/time field value out of range: \"%04u-%02u-%02u\"",
+								t->year, t->month, t->day)));
+			return DateADTGetDatum(date2j(t->year, t->month, t->day) -
+								   POSTGRES_EPOCH_JDATE);
+
+		case BIND_TIMESTAMP:
+		case BIND_TIMESTAMPTZ:
+			{
+				struct pg_tm tm;
+				fsec_t		fsec;
+				int			tz;
+				Timestamp	result;
+
+				if (t->year == 0 || t->month == 0 || t->day == 0)
+					ereport(ERROR,
+							(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+							 errmsg("date/time field value out of range: \"%04u-%02u-%02u %02u:%02u:%02u\"",
+									t->year, t->month, t->day,
+									t->hour, t->minute, t->second)));
+
+				memset(&tm, 0, sizeof(tm));
+				tm.tm_year = t->year;
+				tm.tm_mon = t->month;
+				tm.tm_mday = t->day;
+				tm.tm_hour = t->hour;
+				tm.tm_min = t->minute;
+				tm.tm_sec = t->second;
+#ifdef HAVE_INT64_TIMESTAMP
+				fsec = t->second_part;
+#else
+				fsec = t->second_part / 1000000.0;
+#endif
+
+				/* Like timestamptz_in, take the time as local time */
+				if (col->kind == BIND_TIMESTAMPTZ)
+				{
+					tz = DetermineTimeZoneOffset(&tm, session_timezone);
+					if (tm2timestamp(&tm, fsec, &tz, &result) != 0)
+						ereport(ERROR,
+								(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+								 errmsg("timestamp out of range")));
+					return TimestampTzGetDatum(result);
+				}
+
+				if (tm2timestamp(&tm, fsec, NULL, &result) != 0)
+					ereport(ERROR,
+							(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+							 errmsg("timestamp out of range")));
+				return TimestampGetDatum(result);
+			}
+
+		case BIND_STRING:
+			{
+				char	   *str = col->buffer;
+
+				/* Fetch values that didn't fit into a buffer of their own */
+				if (col->length > col->buflen)
+				{
+					MYSQL_BIND	bind;
+
+					str = palloc(col->length + 1);
+					memset(&bind, 0, sizeof(bind));
+					bind.buffer_type = MYSQL_TYPE_STRING;
+					bind.buffer = str;
+					bind.buffer_length = col->length;
+					if (mysql_stmt_fetch_column(fstmt->stmt, &bind, field, 0) != 0)
+						mysqlStmtError(fstmt, "failed to fetch the MySQL query result");
+				}
+				str[col->length] = '\0';
+
+				if (col->is_string && col->length > 0 &&
+					(!col->trusted || memchr(str, '\0', col->length) != NULL) &&
+					!mysqlVerifymbstr(str, col->length))
+				{
+					*isnull = true;
+					return (Datum) 0;
+				}
+
+				return InputFunctionCall(&col->infunc, str, col->ioparam,
+										 col->typmod);
+			}
+	}
+
+	/* keep compiler quiet */
+	return (Datum) 0;
+}
@@ -0,0 +1,701 @@
+/*-------------------------------------------------------------------------
+ *
+ *		  foreign-data wrapper for MySQL
+ *
+ * Copyright (c) 2011, PostgreSQL Global Development Group
+ *
+ * This software is released under the PostgreSQL Licence
+ *
+ * Author: Dave Page <dpage@pgadmin.org>
+ *
+ * IDENTIFICATION
+ *		  mysql_fdw/stats.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <ctype.h>
+#include <limits.h>
+
+#include "mysql_fdw.h"
+
+#include "catalog/pg_class.h"
+#include "executor/spi.h"
+#include "foreign/foreign.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "portability/instr_time.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+
+/*
+ * Planner statistics for foreign tables.
+ *
+ * Asking MySQL for a row estimate costs a network round trip, which is a
+ * lot to pay every time a query is planned, so the estimates are cached
+ * for mysql_fdw.stats_ttl seconds. When mysql_fdw is loaded with
+ * shared_preload_libraries the cache is kept in shared memory and shared
+ * by all backends; otherwise each backend keeps its own.
+ */
+typedef struct MySQLFdwStatsKey
+{
+	Oid			dbid;			/* database of the foreign table */
+	Oid			relid;			/* the foreign table */
+} MySQLFdwStatsKey;
+
+typedef struct MySQLFdwStatsEntry
+{
+	MySQLFdwStatsKey key;		/* hash key, must be first */
+	double		rows;			/* rows in the remote table or query */
+	int			width;			/* average row length, or 0 if unknown */
+	TimestampTz fetched;		/* when we asked MySQL */
+} MySQLFdwStatsEntry;
+
+/* Rows assumed when MySQL won't tell us */
+#define DEFAULT_REMOTE_ROWS		1000
+
+/* Round trips and bulk fetches made by mysql_fdw_calibrate() */
+#define CALIBRATE_PINGS			10
+#define CALIBRATE_FETCHES		4
+
+/*
+ * About 1.3MB of random bytes, 128 to a row, over 10000 rows, so that the
+ * protocol compression connections may use can't shrink it the way it
+ * would a repeated character.
+ */
+#define CALIBRATE_DIGITS \
+	"(SELECT 0 UNION ALL SELECT 1 UNION ALL SELECT 2 UNION ALL SELECT 3 " \
+	"UNION ALL SELECT 4 UNION ALL SELECT 5 UNION ALL SELECT 6 " \
+	"UNION ALL SELECT 7 UNION ALL SELECT 8 UNION ALL SELECT 9)"
+#define CALIBRATE_QUERY \
+	"SELECT CONCAT(UNHEX(SHA2(RAND(), 512)), UNHEX(SHA2(RAND(), 512))) " \
+	"FROM " CALIBRATE_DIGITS " a, " CALIBRATE_DIGITS " b, " \
+	CALIBRATE_DIGITS " c, " CALIBRATE_DIGITS " d"
+
+/* GUC variables */
+static int	stats_ttl = 300;
+static int	stats_max_tables = 1000;
+
+/* Shared cache, if we were preloaded, and its lock */
+static HTAB *SharedStats = NULL;
+static LWLockId *SharedStatsLock = NULL;
+
+/* Otherwise, a per-backend cache */
+static HTAB *LocalStats = NULL;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+PG_FUNCTION_INFO_V1(mysql_fdw_refresh_stats);
+PG_FUNCTION_INFO_V1(mysql_fdw_calibrate);
+
+static void mysqlStatsShmemStartup(void);
+static Size mysqlStatsShmemSize(void);
+static bool mysqlLookupStats(MySQLFdwStatsKey *key, double *rows, int *width);
+static void mysqlStoreStats(MySQLFdwStatsKey *key, double rows, int width);
+static void mysqlFetchStats(MySQLFdwOptions *opts, double *rows, int *width);
+static bool mysqlFetchTableStats(MYSQL *conn, MySQLFdwOptions *opts,
+								 double *rows, int *width);
+static double mysqlFetchExplainRows(MYSQL *conn, const char *query);
+static void mysqlSplitTableName(const char *table, char **schema, char **name);
+static MYSQL_RES *mysqlStatsQuery(MYSQL *conn, const char *query);
+
+/*
+ * mysqlInitStats
+ *		Define the statistics GUCs, and reserve shared memory for the cache
+ *		if we're being preloaded. Called from _PG_init().
+ */
+void
+mysqlInitStats(void)
+{
+	DefineCustomIntVariable("mysql_fdw.stats_ttl",
+							"Sets how long remote row estimates are cached.",
+							"Zero asks MySQL every time a query is planned.",
+							&stats_ttl,
+							300,
+							0,
+							INT_MAX / 1000,
+							PGC_USERSET,
+							GUC_UNIT_S,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("mysql_fdw.stats_max_tables",
+							"Sets the number of foreign tables whose row estimates are kept in shared memory.",
+							NULL,
+							&stats_max_tables,
+							1000,
+							16,
+							INT_MAX / 2,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+	RequestAddinShmemSpace(mysqlStatsShmemSize());
+	RequestAddinLWLocks(1);
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = mysqlStatsShmemStartup;
+}
+
+static Size
+mysqlStatsShmemSize(void)
+{
+	return add_size(MAXALIGN(sizeof(LWLockId)),
+					hash_estimate_size(stats_max_tables,
+									   sizeof(MySQLFdwStatsEntry)));
+}
+
+/*
+ * Attach to, or create, the shared cache.
+ */
+static void
+mysqlStatsShmemStartup(void)
+{
+	HASHCTL		info;
+	bool		found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	SharedStatsLock = ShmemInitStruct("mysql_fdw stats lock",
+									  sizeof(LWLockId), &found);
+	if (!found)
+		*SharedStatsLock = LWLockAssign();
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(MySQLFdwStatsKey);
+	info.entrysize = sizeof(MySQLFdwStatsEntry);
+	info.hash = tag_hash;
+	SharedStats = ShmemInitHash("mysql_fdw stats",
+								stats_max_tables, stats_max_tables,
+								&info, HASH_ELEM | HASH_FUNCTION);
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * mysqlGetStats
+ *		Return the estimated number of rows of a foreign table, before any
+ *		quals are applied, and its average row width if MySQL knows it
+ *		(otherwise 0). A cached estimate is used if it's recent enough.
+ */
+void
+mysqlGetStats(Oid relid, MySQLFdwOptions *opts, double *rows, int *width)
+{
+	MySQLFdwStatsKey key;
+
+	memset(&key, 0, sizeof(key));
+	key.dbid = MyDatabaseId;
+	key.relid = relid;
+
+	if (stats_ttl > 0 && mysqlLookupStats(&key, rows, width))
+		return;
+
+	mysqlFetchStats(opts, rows, width);
+
+	if (stats_ttl > 0)
+		mysqlStoreStats(&key, *rows, *width);
+}
+
+/*
+ * Look for a cache entry that hasn't expired.
+ */
+static bool
+mysqlLookupStats(MySQLFdwStatsKey *key, double *rows, int *width)
+{
+	MySQLFdwStatsEntry *entry;
+	bool		found = false;
+
+	if (SharedStats)
+		LWLockAcquire(*SharedStatsLock, LW_SHARED);
+	else if (LocalStats == NULL)
+		return false;
+
+	entry = (MySQLFdwStatsEntry *) hash_search(SharedStats ? SharedStats : LocalStats,
+											   key, HASH_FIND, NULL);
+	if (entry &&
+		!TimestampDifferenceExceeds(entry->fetched, GetCurrentTimestamp(),
+									stats_ttl * 1000))
+	{
+		*rows = entry->rows;
+		*width = entry->width;
+		found = true;
+	}
+
+	if (SharedStats)
+		LWLockRelease(*SharedStatsLock);
+
+	return found;
+}
+
+/*
+ * Add or update a cache entry. When the shared cache is full, the oldest
+ * entry makes way.
+ */
+static void
+mysqlStoreStats(MySQLFdwStatsKey *key, double rows, int width)
+{
+	MySQLFdwStatsEntry *entry;
+
+	if (SharedStats == NULL)
+	{
+		if (LocalStats == NULL)
+		{
+			HASHCTL		info;
+
+			memset(&info, 0, sizeof(info));
+			info.keysize = sizeof(MySQLFdwStatsKey);
+			info.entrysize = sizeof(MySQLFdwStatsEntry);
+			info.hash = tag_hash;
+			info.hcxt = CacheMemoryContext;
+			LocalStats = hash_create("mysql_fdw stats", 64, &info,
+									 HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+		}
+		entry = (MySQLFdwStatsEntry *) hash_search(LocalStats, key,
+												   HASH_ENTER, NULL);
+	}
+	else
+	{
+		LWLockAcquire(*SharedStatsLock, LW_EXCLUSIVE);
+
+		entry = (MySQLFdwStatsEntry *) hash_search(SharedStats, key,
+												   HASH_ENTER_NULL, NULL);
+		if (entry == NULL)
+		{
+			HASH_SEQ_STATUS scan;
+			MySQLFdwStatsEntry *oldest = NULL;
+
+			hash_seq_init(&scan, SharedStats);
+			while ((entry = (MySQLFdwStatsEntry *) hash_seq_search(&scan)))
+			{
+				if (oldest == NULL || entry->fetched < oldest->fetched)
+					oldest = entry;
+			}
+			if (oldest)
+				hash_search(SharedStats, &oldest->key, HASH_REMOVE, NULL);
+
+			entry = (MySQLFdwStatsEntry *) hash_search(SharedStats, key,
+													   HASH_ENTER_NULL, NULL);
+		}
+	}
+
+	if (entry)
+	{
+		entry->rows = rows;
+		entry->width = width;
+		entry->fetched = GetCurrentTimestamp();
+	}
+
+	if (SharedStats)
+		LWLockRelease(*SharedStatsLock);
+}
+
+/*
+ * Ask MySQL for the size of a foreign table.
+ *
+ * For a table, information_schema.TABLES has the row count (exact for
+ * MyISAM, estimated for InnoDB) and the average row length. For a query,
+ * or a view, which have neither, we sum the rows column of EXPLAIN.
+ */
+static void
+mysqlFetchStats(MySQLFdwOptions *opts, double *rows, int *width)
+{
+	MYSQL	   *conn = mysqlGetConnection(opts, false);
+	StringInfoData query;
+
+	*rows = 0;
+	*width = 0;
+
+	if (opts->table && mysqlFetchTableStats(conn, opts, rows, width))
+		return;
+
+	initStringInfo(&query);
+	if (opts->query)
+		appendStringInfo(&query, "EXPLAIN %s", opts->query);
+	else
+		appendStringInfo(&query, "EXPLAIN SELECT * FROM %s", opts->table);
+
+	*rows = mysqlFetchExplainRows(conn, query.data);
+	pfree(query.data);
+}
+
+/*
+ * Look the table up in information_schema.TABLES, returning false if it
+ * isn't there or has no row count.
+ */
+static bool
+mysqlFetchTableStats(MYSQL *conn, MySQLFdwOptions *opts, double *rows,
+					 int *width)
+{
+	StringInfoData query;
+	MYSQL_RES  *result;
+	MYSQL_ROW	row;
+	char	   *schema;
+	char	   *name;
+	bool		found = false;
+
+	mysqlSplitTableName(opts->table, &schema, &name);
+
+	initStringInfo(&query);
+	appendStringInfoString(&query,
+						   "SELECT TABLE_ROWS, AVG_ROW_LENGTH"
+						   " FROM information_schema.TABLES"
+						   " WHERE TABLE_SCHEMA = ");
+	if (schema)
+		mysqlDeparseStringLiteral(&query, schema, conn);
+	else
+		appendStringInfoString(&query, "DATABASE()");
+	appendStringInfoString(&query, " AND TABLE_NAME = ");
+	mysqlDeparseStringLiteral(&query, name, conn);
+
+	result = mysqlStatsQuery(conn, query.data);
+
+	row = mysql_fetch_row(result);
+	if (row && row[0])
+	{
+		*rows = strtod(row[0], NULL);
+		*width = row[1] ? atoi(row[1]) : 0;
+		found = true;
+	}
+
+	mysql_free_result(result);
+	pfree(query.data);
+
+	return found;
+}
+
+/*
+ * Run EXPLAIN and add up its rows column. MySQL's EXPLAIN only gives a row
+ * estimate for each table in the statement, so this is crude, but it's
+ * all we've got. The column is found by name, since its position varies
+ * between versions.
+ */
+static double
+mysqlFetchExplainRows(MYSQL *conn, const char *query)
+{
+	MYSQL_RES  *result = mysqlStatsQuery(conn, query);
+	MYSQL_FIELD *fields = mysql_fetch_fields(result);
+	unsigned int nfields = mysql_num_fields(result);
+	unsigned int rowscol;
+	MYSQL_ROW	row;
+	double		rows = 0;
+
+	for (rowscol = 0; rowscol < nfields; rowscol++)
+	{
+		if (pg_strcasecmp(fields[rowscol].name, "rows") == 0)
+			break;
+	}
+
+	if (rowscol == nfields)
+	{
+		mysql_free_result(result);
+		return DEFAULT_REMOTE_ROWS;
+	}
+
+	while ((row = mysql_fetch_row(result)))
+	{
+		if (row[rowscol])
+			rows += strtod(row[rowscol], NULL);
+	}
+
+	mysql_free_result(result);
+
+	return rows;
+}
+
+/*
+ * mysqlGetSplitColumn
+ *		Return the name of an integer column of a table's primary key, which
+ *		a parallel scan can divide into ranges, or NULL if it hasn't one.
+ */
+char *
+mysqlGetSplitColumn(MYSQL *conn, MySQLFdwOptions *opts)
+{
+	StringInfoData query;
+	MYSQL_RES  *result;
+	MYSQL_ROW	row;
+	char	   *schema;
+	char	   *name;
+	char	   *column = NULL;
+
+	mysqlSplitTableName(opts->table, &schema, &name);
+
+	initStringInfo(&query);
+	appendStringInfoString(&query,
+						   "SELECT COLUMN_NAME"
+						   " FROM information_schema.COLUMNS"
+						   " WHERE TABLE_SCHEMA = ");
+	if (schema)
+		mysqlDeparseStringLiteral(&query, schema, conn);
+	else
+		appendStringInfoString(&query, "DATABASE()");
+	appendStringInfoString(&query, " AND TABLE_NAME = ");
+	mysqlDeparseStringLiteral(&query, name, conn);
+	appendStringInfoString(&query,
+						   " AND COLUMN_KEY = 'PRI'"
+						   " AND DATA_TYPE IN ('tinyint', 'smallint', 'mediumint', 'int', 'bigint')"
+						   " ORDER BY ORDINAL_POSITION LIMIT 1");
+
+	result = mysqlStatsQuery(conn, query.data);
+
+	row = mysql_fetch_row(result);
+	if (row && row[0])
+		column = pstrdup(row[0]);
+
+	mysql_free_result(result);
+	pfree(query.data);
+
+	return column;
+}
+
+/*
+ * mysqlGetSplitBounds
+ *		Fetch the lowest and highest values of an integer column of a table,
+ *		returning false if it's empty or the values aren't integers.
+ */
+bool
+mysqlGetSplitBounds(MYSQL *conn, MySQLFdwOptions *opts, const char *column,
+					int64 *min, int64 *max)
+{
+	StringInfoData query;
+	MYSQL_RES  *result;
+	MYSQL_ROW	row;
+	bool		found = false;
+
+	initStringInfo(&query);
+	appendStringInfoString(&query, "SELECT MIN(");
+	mysqlQuoteIdentifier(&query, column);
+	appendStringInfoString(&query, "), MAX(");
+	mysqlQuoteIdentifier(&query, column);
+	appendStringInfo(&query, ") FROM %s", opts->table);
+
+	result = mysqlStatsQuery(conn, query.data);
+
+	row = mysql_fetch_row(result);
+	if (row && row[0] && row[1])
+	{
+		char	   *end0;
+		char	   *end1;
+
+		errno = 0;
+		*min = strtoll(row[0], &end0, 10);
+		*max = strtoll(row[1], &end1, 10);
+		found = (errno == 0 && *end0 == '\0' && *end1 == '\0');
+	}
+
+	mysql_free_result(result);
+	pfree(query.data);
+
+	return found;
+}
+
+/*
+ * Split a table option, which may be qualified with a database name and
+ * quoted with backticks, into its parts. *schema is NULL if unqualified.
+ */
+static void
+mysqlSplitTableName(const char *table, char **schema, char **name)
+{
+	StringInfoData part;
+	const char *p = table;
+	bool		quoted = false;
+
+	*schema = NULL;
+	initStringInfo(&part);
+
+	for (; *p; p++)
+	{
+		if (*p == '`')
+		{
+			/* A doubled backtick is a literal one */
+			if (quoted && p[1] == '`')
+				appendStringInfoChar(&part, *p++);
+			else
+				quoted = !quoted;
+		}
+		else if (*p == '.' && !quoted && *schema == NULL)
+		{
+			*schema = part.data;
+			initStringInfo(&part);
+		}
+		else if (quoted || !isspace((unsigned char) *p))
+			appendStringInfoChar(&part, *p);
+	}
+
+	*name = part.data;
+}
+
+/*
+ * Run a query whose result we're going to read in full.
+ */
+static MYSQL_RES *
+mysqlStatsQuery(MYSQL *conn, const char *query)
+{
+	MYSQL_RES  *result;
+
+	if (mysql_query(conn, query) != 0 ||
+		(result = mysql_store_result(conn)) == NULL)
+	{
+		char *err = pstrdup(mysql_error(conn));
+		mysqlDiscardConnection(conn);
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+			errmsg("failed to execute the MySQL query: %s", err)));
+	}
+
+	return result;
+}
+
+/*
+ * mysql_fdw_refresh_stats
+ *		Fetch a foreign table's row estimate from MySQL now, replacing any
+ *		cached one, and return it.
+ */
+Datum
+mysql_fdw_refresh_stats(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	MySQLFdwOptions opts;
+	MySQLFdwStatsKey key;
+	double		rows;
+	int			width;
+
+	if (get_rel_relkind(relid) != RELKIND_FOREIGN_TABLE)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not a foreign table",
+						get_rel_name(relid))));
+
+	mysqlGetOptions(relid, &opts);
+	mysqlFetchStats(&opts, &rows, &width);
+
+	memset(&key, 0, sizeof(key));
+	key.dbid = MyDatabaseId;
+	key.relid = relid;
+	mysqlStoreStats(&key, rows, width);
+
+	PG_RETURN_FLOAT8(rows);
+}
+
+/*
+ * mysql_fdw_calibrate
+ *		Measure the round trip time and throughput of the network to a
+ *		server, and store them as its fdw_startup_cost and bytes_per_ms
+ *		options.
+ *
+ * The round trip time is the quickest of several trivial queries, so as
+ * not to be thrown by the odd slow one. Throughput is measured by fetching
+ * a few large values, less a round trip for each.
+ */
+Datum
+mysql_fdw_calibrate(PG_FUNCTION_ARGS)
+{
+	char	   *servername = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	ForeignServer *server = GetForeignServerByName(servername, false);
+	MySQLFdwOptions opts;
+	MYSQL	   *conn;
+	TupleDesc	tupdesc;
+	Datum		values[3];
+	bool		nulls[3];
+	double		latency = -1;
+	double		elapsed;
+	double		bytes = 0;
+	double		bytes_per_ms;
+	double		startup_cost;
+	instr_time	start;
+	instr_time	duration;
+	StringInfoData cmd;
+	ListCell   *lc;
+	bool		have_startup = false;
+	bool		have_bytes = false;
+	int			i;
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	mysqlGetServerOptions(server->serverid, NIL, &opts);
+	conn = mysqlGetConnection(&opts, false);
+
+	for (i = 0; i < CALIBRATE_PINGS; i++)
+	{
+		MYSQL_RES  *result;
+
+		INSTR_TIME_SET_CURRENT(start);
+		result = mysqlStatsQuery(conn, "SELECT 1");
+		mysql_free_result(result);
+		INSTR_TIME_SET_CURRENT(duration);
+		INSTR_TIME_SUBTRACT(duration, start);
+
+		if (latency < 0 || INSTR_TIME_GET_MILLISEC(duration) < latency)
+			latency = INSTR_TIME_GET_MILLISEC(duration);
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	INSTR_TIME_SET_CURRENT(start);
+	for (i = 0; i < CALIBRATE_FETCHES; i++)
+	{
+		MYSQL_RES  *result;
+		MYSQL_ROW	row;
+
+		result = mysqlStatsQuery(conn, CALIBRATE_QUERY);
+		while ((row = mysql_fetch_row(result)))
+			bytes += mysql_fetch_lengths(result)[0];
+		mysql_free_result(result);
+		CHECK_FOR_INTERRUPTS();
+	}
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+
+	elapsed = INSTR_TIME_GET_MILLISEC(duration) - CALIBRATE_FETCHES * latency;
+	bytes_per_ms = (elapsed > 0) ? bytes / elapsed : bytes;
+	bytes_per_ms = Max(bytes_per_ms, 1);
+	startup_cost = latency * COST_PER_MS;
+
+	/* Store them as options of the server, replacing any already there */
+	foreach(lc, server->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "fdw_startup_cost") == 0)
+			have_startup = true;
+		else if (strcmp(def->defname, "bytes_per_ms") == 0)
+			have_bytes = true;
+	}
+
+	initStringInfo(&cmd);
+	appendStringInfo(&cmd, "ALTER SERVER %s OPTIONS (%s fdw_startup_cost '%.2f', %s bytes_per_ms '%.0f')",
+					 quote_identifier(server->servername),
+					 have_startup ? "SET" : "ADD", startup_cost,
+					 have_bytes ? "SET" : "ADD", bytes_per_ms);
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+	if (SPI_execute(cmd.data, false, 0) != SPI_OK_UTILITY)
+		elog(ERROR, "SPI_execute failed: %s", cmd.data);
+	SPI_finish();
+
+	memset(nulls, 0, sizeof(nulls));
+	values[0] = Float8GetDatum(latency);
+	values[1] = Float8GetDatum(startup_cost);
+	values[2] = Float8GetDatum(bytes_per_ms);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(BlessTupleDesc(tupdesc),
+													  values, nulls)));
+}